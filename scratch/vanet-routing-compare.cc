@@ -74,6 +74,74 @@
  * - ASCII trace file
  * - PCAP trace files for each node
  *
+ * With --sweep="protocol=1,2,3,4;txp=7.5,20;RngRun=1,2", every
+ * combination of the given values is run in its own process, --jobs
+ * at a time.  Each run writes its outputs under names suffixed with
+ * -run<n>, and the final statistics of all runs, preceded by their
+ * parameter values, are merged into --sweepCsv.
+ *
+ * With --forkVariants="protocol=1,2,3,4", the nodes, their mobility
+ * and the devices are set up once, and a copy-on-write child is forked
+ * for each combination right before the routing setup.  Only the
+ * parameters used from then on (protocol, sinks, bsm, interval,
+ * txdist, flowmon, routing_tables, ...) can vary.  RngRun and RngSeed
+ * cannot: the random streams already created keep the parent's run, so
+ * seeds are varied with --sweep instead.  The variants' outputs are
+ * suffixed with -v<n>, and their final statistics rows are appended to
+ * the parent's final CSV file.
+ *
+ * With --checkpointTime=60 as well, the variants are forked at that
+ * simulation time instead: the warmup runs once, and each variant goes
+ * on from a copy of the whole simulation, mobility, routing tables,
+ * application timers and statistics included.  The checkpoint is only
+ * this fork of the process: nothing is written to disk.  Everything but
+ * the end of the run is already set up by then, so that totaltime is
+ * the only parameter that can vary, up to the parent's totaltime, which
+ * the applications stop at.  The per-second CSV and the log of each
+ * variant start with the parent's warmup part.
+ *
+ * With --traceStart=100 --traceStop=200, --traceArea="0,1000,0,1000"
+ * or --traceNodes="0,4,7", only a part of an ns-2 trace is installed:
+ * seconds 100 to 200 of the trace, played from time 0, the nodes that
+ * enter the area, or the given nodes.  Only the selected nodes are
+ * created, and --nodes is ignored.
+ *
+ * With --partitionsX=4 --partitionsY=2, the area of an ns-2 trace is
+ * split into a grid of partitions, each run in its own process,
+ * --partitionJobs at a time, with the vehicles that come within
+ * --partitionHalo of it.  Each partition counts the BSMs sent from
+ * inside it, and the counts of all of them are merged into
+ * --partitionCsv.  By default the halo is the line-of-sight range of
+ * the ITU-R 1411 model at the carrier sense threshold, so that
+ * --partitionHalo must be given with the other loss models.
+ *
+ * With --lossModel=2 --buildings=1, the ITU-R 1411 obstacle loss comes
+ * from the buildings of the scenario, or of --buildingsFile, a SUMO
+ * polygon file such as polyconvert writes: each <poly> shape is a
+ * building, indexed once before the simulation.  --linkCache=4096 then
+ * remembers that many unobstructed links, which are not tested against
+ * the buildings again until one of their nodes has moved.
+ *
+ * With --lossModel=2 --hybridCore=100, the ITU-R 1411 obstacle loss is
+ * only evaluated for the receivers within 100 m of the transmitter.
+ * Farther out, whether a frame gets through is drawn from a per-distance
+ * delivery table calibrated on the first links of each bin with the
+ * full model.  --lossStats=1 prints how many links took each path and
+ * the delivery drift on the links checked against the full model; a
+ * --sweep="hybridCore=0,100" compares the BSM_PDR with full fidelity.
+ *
+ * With --benchmark=1, each scenario of --benchmarkScenarios is run in
+ * turn, in its own process, with fixed seeds.  The wall time of the
+ * trace load, of the device and stack installation and of
+ * Simulator::Run, the events executed per second and the peak RSS are
+ * written to --benchmarkCsv, one Benchmark,Case,Metric,Value row each,
+ * followed by micro-benchmarks of the trace parser, the ITU-R 1411
+ * loss, batched and per receiver, and the BSM neighbor counting.
+ *
+ * In builds with NS3_PHASE_PROFILER defined, the time spent in the
+ * loss model, the trace-driven mobility changes, BSM generation and
+ * reception and CheckThroughput is written to <tr_name>.profile.csv.
+ *
  * Known issues:
  * - According to the following, DSR not showing results in 
  *   flowmon is a known bug:
@@ -96,6 +164,15 @@
 
 #include <fstream>
 #include <iostream>
+#include <sstream>
+#include <iterator>
+#include <map>
+#include <limits>
+#include <cstdio>
+#include <cstdlib>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
 #include "ns3/core-module.h"
 #include "ns3/network-module.h"
 #include "ns3/internet-module.h"
@@ -107,6 +184,8 @@
 #include "ns3/dsr-module.h"
 #include "ns3/applications-module.h"
 #include "ns3/itu-r-1411-los-propagation-loss-model.h"
+#include "ns3/obstacle-index.h"
+#include "ns3/phase-profiler.h"
 #include "ns3/ocb-wifi-mac.h"
 #include "ns3/wifi-80211p-helper.h"
 #include "ns3/wave-mac-helper.h"
@@ -118,384 +197,1655 @@ using namespace dsr;
 
 NS_LOG_COMPONENT_DEFINE ("vanet-routing-compare");
 
-class VanetRoutingExperiment
+/**
+ * \brief Position and velocity of every node, kept in contiguous arrays.
+ *
+ * A node's entry is read from its mobility model at most once per
+ * simulation timestamp, and again once it changes course, so that the
+ * many distance and "is moving" checks made within a timestamp neither
+ * go through the object aggregation nor call into the mobility models.
+ */
+class MobilitySnapshot
 {
 public:
-  VanetRoutingExperiment ();
-  void Run ();
-  void CommandSetup (int argc, char **argv);
-
-  static int wavePktSendCount;
-  static int wavePktReceiveCount;
-  static int wavePktInCoverageReceiveCount;
-  static int wavePktExpectedReceiveCount;
-  static NodeContainer m_adhocTxNodes;
-  static double m_txSafetyRangeSq;
+  MobilitySnapshot ();
+
+  /**
+   * \param nodes the nodes to track; nodes are identified by their id,
+   *        which must be their index in the container
+   */
+  void Setup (const NodeContainer &nodes);
+
+  /**
+   * \param id the node id
+   * \return the current position of the node
+   */
+  Vector GetPosition (uint32_t id);
+
+  /**
+   * \param id the node id
+   * \return the current velocity of the node
+   */
+  Vector GetVelocity (uint32_t id);
+
+  /**
+   * \param id the node id
+   * \return whether the node has a non-zero horizontal velocity
+   */
+  bool IsMoving (uint32_t id);
+
+  /**
+   * \param id1 the first node id
+   * \param id2 the second node id
+   * \return the square of the horizontal distance between the nodes
+   */
+  double GetDistSq (uint32_t id1, uint32_t id2);
 
 private:
-  Ptr<Socket> SetupPacketReceive (Ipv4Address addr, Ptr<Node> node);
-  void ReceivePacket (Ptr<Socket> socket);
-  void ReceiveWavePacket (Ptr<Socket> socket);
-  void CheckThroughput ();
-  void SetupLogFile ();
-  void SetupLogging ();
-  void ConfigureDefaults ();
-  void SetupAdhocMobilityNodes ();
-  void SetupAdhocDevices ();
-  void SetupRouting ();
-  void AssignIpAddresses ();
-  void SetupWaveMessages ();
-  void SetupRoutingMessages ();
-  void SetupScenario ();
-  void WriteCsvHeader ();
-
-  uint32_t port;
-  uint32_t bytesTotal;
-  uint32_t totalBytesTotal;
-  uint32_t packetsReceived;
-  uint32_t totalPacketsReceived;
-
-  std::string m_CSVfileName;
-  std::string m_CSVfileName2;
-  int m_nSinks;
-  std::string m_protocolName;
-  double m_txp;
-  bool m_traceMobility;
-  uint32_t m_protocol;
-
-  uint32_t m_lossModel;
-  std::string m_lossModelName;
-
-  std::string m_phyMode;
-  uint32_t m_80211mode;
-
-  std::string m_traceFile;
-  std::string m_logFile;
-  uint32_t m_mobility;
-  uint32_t m_nNodes;
-  double m_TotalTime;
-  std::string m_rate;
-  std::string m_phyMode_b;
-  std::string m_tr_name;
-  int m_nodeSpeed; //in m/s
-  int m_nodePause; //in s
-  uint32_t m_wavePacketSize; // bytes
-  uint32_t m_numWavePackets;
-  double m_waveInterval; // seconds
-  int m_verbose;
-  std::ofstream m_os;
-  NetDeviceContainer m_adhocTxDevices;
-  Ipv4InterfaceContainer m_adhocTxInterfaces;
-  uint32_t m_scenario;
-  int m_flowmon;
-  double m_gpsAccuracyNs;
-  int m_routing_tables;
-  int m_ascii_trace;
-  int m_pcap;
-
-  // future
-  int m_loadBuildings;
+  void Update (uint32_t id);
+  void CourseChanged (Ptr<const MobilityModel> mobility);
+
+  std::vector<Ptr<MobilityModel> > m_mobility; // mobility of each node
+  std::vector<double> m_x;
+  std::vector<double> m_y;
+  std::vector<double> m_vx;
+  std::vector<double> m_vy;
+  std::vector<uint8_t> m_moving;
+  std::vector<int64_t> m_stamp; // time step each entry was read at, or -1 if stale
 };
 
-int VanetRoutingExperiment::wavePktSendCount = 0;
-int VanetRoutingExperiment::wavePktReceiveCount = 0;
-int VanetRoutingExperiment::wavePktInCoverageReceiveCount = 0;
-int VanetRoutingExperiment::wavePktExpectedReceiveCount = 0;
-NodeContainer VanetRoutingExperiment::m_adhocTxNodes;
-double VanetRoutingExperiment::m_txSafetyRangeSq = 145.0 * 145.0;
-
-VanetRoutingExperiment::VanetRoutingExperiment ()
-  : port (9),
-    bytesTotal (0),
-    totalBytesTotal (0),
-    packetsReceived (0),
-    totalPacketsReceived (0),
-    m_CSVfileName ("vanet-routing.output.csv"),
-    m_CSVfileName2 ("vanet-routing.output2.csv"),
-    m_nSinks (10),
-    m_protocolName ("protocol"),
-    m_txp (7.5),
-    m_traceMobility (false),
-    m_protocol (2), // AODV
-    m_lossModel (2), // ITU R-1441
-    m_lossModelName (""),
-    m_phyMode ("OfdmRate6MbpsBW10MHz"),
-    m_80211mode (1),  // 1=802.11p
-    m_traceFile ("./scratch/low_ct-unterstrass-1day.filt.5.adj.mov"),
-    m_logFile ("low_ct-unterstrass-1day.filt.5.adj.log"),
-    m_mobility (1),
-    m_nNodes (156),
-    m_TotalTime(300.01),
-    m_rate ("2048bps"),
-    m_phyMode_b ("DsssRate11Mbps"),
-    m_tr_name ("vanet-routing-compare"),
-    m_nodeSpeed (20),
-    m_nodePause (0),
-    m_wavePacketSize (200),
-    m_numWavePackets (1),
-    m_waveInterval (0.1),
-    m_verbose (0),
-    m_scenario (1),
-    m_flowmon (1),
-    m_gpsAccuracyNs (10000),
-    m_routing_tables (0),
-    m_ascii_trace (0),
-    m_pcap (0),
-    m_loadBuildings (0)
+MobilitySnapshot::MobilitySnapshot ()
 {
 }
 
-// Prints actual position and velocity when a course change event occurs
-static void
-CourseChange (std::ostream *os, std::string foo, Ptr<const MobilityModel> mobility)
+void
+MobilitySnapshot::Setup (const NodeContainer &nodes)
 {
-  Vector pos = mobility->GetPosition (); // Get position
-  Vector vel = mobility->GetVelocity (); // Get velocity
-
-  pos.z = 1.5;
-
-  // Prints position and velocities
-  *os << Simulator::Now () << " POS: x=" << pos.x << ", y=" << pos.y
-      << ", z=" << pos.z << "; VEL:" << vel.x << ", y=" << vel.y
-      << ", z=" << vel.z << std::endl;
+  uint32_t n = nodes.GetN ();
+  m_mobility.clear ();
+  for (uint32_t i = 0; i < n; i++)
+    {
+      NS_ASSERT (nodes.Get (i)->GetId () == i);
+      Ptr<MobilityModel> mobility = nodes.Get (i)->GetObject<MobilityModel> ();
+      NS_ASSERT (mobility != 0);
+      mobility->TraceConnectWithoutContext ("CourseChange", MakeCallback (&MobilitySnapshot::CourseChanged, this));
+      m_mobility.push_back (mobility);
+    }
+  m_x.assign (n, 0.0);
+  m_y.assign (n, 0.0);
+  m_vx.assign (n, 0.0);
+  m_vy.assign (n, 0.0);
+  m_moving.assign (n, 0);
+  m_stamp.assign (n, -1);
 }
 
-
-static inline std::string
-PrintReceivedPacket (Ptr<Socket> socket, Ptr<Packet> packet)
+inline void
+MobilitySnapshot::Update (uint32_t id)
 {
-  SocketAddressTag tag;
-  bool found;
-  found = packet->PeekPacketTag (tag);
-  std::ostringstream oss;
-
-  oss << Simulator::Now ().GetSeconds () << " " << socket->GetNode ()->GetId ();
-
-  if (found)
-    {
-      InetSocketAddress addr = InetSocketAddress::ConvertFrom (tag.GetAddress ());
-      oss << " received one packet from " << addr.GetIpv4 ();
-    }
-  else
+  int64_t now = Simulator::Now ().GetTimeStep ();
+  if (m_stamp[id] != now)
     {
-      oss << " received one packet!";
+      Vector pos = m_mobility[id]->GetPosition ();
+      Vector vel = m_mobility[id]->GetVelocity ();
+      m_x[id] = pos.x;
+      m_y[id] = pos.y;
+      m_vx[id] = vel.x;
+      m_vy[id] = vel.y;
+      m_moving[id] = (vel.x != 0.0 || vel.y != 0.0);
+      m_stamp[id] = now;
     }
-  return oss.str ();
 }
 
 void
-VanetRoutingExperiment::ReceivePacket (Ptr<Socket> socket)
+MobilitySnapshot::CourseChanged (Ptr<const MobilityModel> mobility)
 {
-  Ptr<Packet> packet;
-  while ((packet = socket->Recv ()))
+  uint32_t id = mobility->GetObject<Node> ()->GetId ();
+  if (id < m_stamp.size ())
     {
-      bytesTotal += packet->GetSize ();
-      totalBytesTotal += packet->GetSize ();
-      packetsReceived += 1;
-      totalPacketsReceived += 1;
-      NS_LOG_UNCOND ("ROUT  " + PrintReceivedPacket (socket, packet));
+      m_stamp[id] = -1;
     }
 }
 
-static double
-getDistSq(Ptr<Node> n1, Ptr<Node> n2) 
+Vector
+MobilitySnapshot::GetPosition (uint32_t id)
 {
-  double distSq = 0.0;
+  Update (id);
+  return Vector (m_x[id], m_y[id], 0.0);
+}
 
-  Ptr<MobilityModel> rxPosition = n1->GetObject<MobilityModel> ();
-  NS_ASSERT (rxPosition != 0);
-  Vector rxPos = rxPosition->GetPosition ();
-  double rx_x = rxPos.x;
-  double rx_y =rxPos.y;
+Vector
+MobilitySnapshot::GetVelocity (uint32_t id)
+{
+  Update (id);
+  return Vector (m_vx[id], m_vy[id], 0.0);
+}
 
-  Ptr<MobilityModel> txPosition = n2->GetObject<MobilityModel> ();
-  NS_ASSERT (txPosition != 0);
-  Vector txPos = txPosition->GetPosition ();
-  double tx_x = txPos.x;
-  double tx_y = txPos.y;
-  distSq = (tx_x - rx_x) * (tx_x - rx_x) + (tx_y - rx_y) * (tx_y - rx_y);
+bool
+MobilitySnapshot::IsMoving (uint32_t id)
+{
+  Update (id);
+  return m_moving[id] != 0;
+}
 
-  return distSq;
+double
+MobilitySnapshot::GetDistSq (uint32_t id1, uint32_t id2)
+{
+  Update (id1);
+  Update (id2);
+  double dx = m_x[id2] - m_x[id1];
+  double dy = m_y[id2] - m_y[id1];
+  return dx * dx + dy * dy;
 }
 
-void VanetRoutingExperiment::ReceiveWavePacket (Ptr<Socket> socket)
+/**
+ * \brief Uniform grid index over node positions, answering "which
+ * nodes are within range of a point" by only visiting nearby cells.
+ *
+ * The grid is rebuilt from current positions at most once per refresh
+ * period.  In between, nodes keep moving: a query widens its search by
+ * the farthest a binned node may have moved since the rebuild (a speed
+ * bound, raised on course changes, times the elapsed time) and then
+ * checks candidates against their current position, so the result is
+ * the same as that of an exhaustive search.  Nodes which would push
+ * the speed bound too high (e.g. the near-instant jumps traces use to
+ * place a vehicle) leave the grid and are checked on every query until
+ * the next rebuild.
+ */
+class NeighborGrid
 {
-  Ptr<Packet> packet;
-  while ((packet = socket->Recv ()))
-    {
-      VanetRoutingExperiment::wavePktReceiveCount++;
-      Ptr<Node> node = socket->GetNode ();
+public:
+  NeighborGrid ();
+
+  /**
+   * \param nodes the nodes to index; nodes are identified by their id,
+   *        which must be their index in the container
+   * \param snapshot where the node positions are read from
+   * \param cellSize size of the grid cells, typically the query range
+   * \param refresh how often the grid is rebuilt
+   */
+  void Setup (const NodeContainer &nodes, MobilitySnapshot *snapshot, double cellSize, Time refresh);
+
+  /**
+   * \param pos the position to search around
+   * \param range the search range (2D)
+   * \param result cleared, then filled with the ids of the nodes
+   *        within range of pos (including any node at pos)
+   */
+  void GetNodesWithin (const Vector &pos, double range, std::vector<uint32_t> &result);
 
-      Ptr<MobilityModel> rxPosition = node->GetObject<MobilityModel> ();
-      NS_ASSERT (rxPosition != 0);
-      Vector rxVel = rxPosition->GetVelocity ();
-      // confirm that the receiving node 
-      // has also started moving in the scenario
-      // if it has not started moving, then
-      // it is not a candidate to receive a packet
-      int receiverMoving = 1;
-      if (rxVel.x != 0.0 || rxVel.y != 0.0)
-        {
-          receiverMoving = 1;
-        }
-      else
-        {
-          receiverMoving = 0;
-        }
-      if (receiverMoving == 1)
-        {
-        SocketAddressTag tag;
-        bool found;
-        found = packet->PeekPacketTag (tag);
+private:
+  void Rebuild (void);
+  void CourseChanged (Ptr<const MobilityModel> mobility);
+  void CheckNode (uint32_t id, const Vector &pos, double rangeSq, std::vector<uint32_t> &result) const;
 
-        if (found)
-          {
-            InetSocketAddress addr = InetSocketAddress::ConvertFrom (tag.GetAddress ());
-            for (int i = 0; i < (int) m_nNodes; i++)
-              {
-                if (addr.GetIpv4() == m_adhocTxInterfaces.GetAddress (i) )
-                {
-                  std::pair<Ptr<Ipv4>, uint32_t> xx = m_adhocTxInterfaces.Get (i);
-                  Ptr<Ipv4> pp = xx.first;
-                  Ptr<Node> txNode = pp->GetObject<Node> ();
+  MobilitySnapshot *m_snapshot;        // positions of the nodes
+  uint32_t m_nNodes;
+  std::vector<Vector> m_binnedPos;     // position of each node at the last rebuild
+  std::vector<bool> m_unbinned;        // whether a node is checked on every query
+  std::vector<uint32_t> m_unbinnedIds; // nodes checked on every query
+  std::vector<uint32_t> m_cellStart;   // index in m_cellNodes of the first node of each cell
+  std::vector<uint32_t> m_cellNodes;   // binned node ids, sorted by cell
+  std::vector<uint32_t> m_nodeCell;    // cell of each binned node (rebuild scratch)
+  double m_cellSize;
+  double m_minX;
+  double m_minY;
+  uint32_t m_nx;
+  uint32_t m_ny;
+  double m_maxSpeed;       // bound on the speed of binned nodes since the rebuild, m/s
+  double m_maxBinnedSpeed; // nodes needing a higher bound are not binned, m/s
+  Time m_buildTime;
+  Time m_refresh;
+  bool m_built;
+};
 
-                  double rxDistSq = getDistSq(node, txNode);
-                  if (rxDistSq <= VanetRoutingExperiment::m_txSafetyRangeSq)
-                    {
-                      VanetRoutingExperiment::wavePktInCoverageReceiveCount++;
-                    }
-                }
-              }
-          }
-        }
-    }
+NeighborGrid::NeighborGrid ()
+  : m_snapshot (0),
+    m_nNodes (0),
+    m_cellSize (1.0),
+    m_minX (0.0),
+    m_minY (0.0),
+    m_nx (0),
+    m_ny (0),
+    m_maxSpeed (0.0),
+    m_maxBinnedSpeed (100.0),
+    m_built (false)
+{
 }
 
-static void GenerateWaveTraffic (Ptr<Socket> socket, uint32_t pktSize,
-                             uint32_t pktCount, Time pktInterval )
+void
+NeighborGrid::Setup (const NodeContainer &nodes, MobilitySnapshot *snapshot, double cellSize, Time refresh)
 {
-  if (pktCount > 0)
+  NS_ASSERT (cellSize > 0.0);
+  m_snapshot = snapshot;
+  m_nNodes = nodes.GetN ();
+  m_cellSize = cellSize;
+  m_refresh = refresh;
+  m_built = false;
+  for (uint32_t i = 0; i < m_nNodes; i++)
     {
-      // first, we make sure this node is moving
-      // if not, then skip
-      int txNodeId = socket->GetNode ()->GetId ();
-      NodeContainer const & n = VanetRoutingExperiment::m_adhocTxNodes;
-      Ptr<MobilityModel> txPosition = n.Get (txNodeId) ->GetObject<MobilityModel> ();
-      NS_ASSERT (txPosition != 0);
+      NS_ASSERT (nodes.Get (i)->GetId () == i);
+      Ptr<MobilityModel> mobility = nodes.Get (i)->GetObject<MobilityModel> ();
+      NS_ASSERT (mobility != 0);
+      mobility->TraceConnectWithoutContext ("CourseChange", MakeCallback (&NeighborGrid::CourseChanged, this));
+    }
+}
 
-      Vector txVel = txPosition->GetVelocity ();
-      int senderMoving = 1;
-      if ((txVel.x == 0.0) && (txVel.y == 0.0))
+void
+NeighborGrid::Rebuild (void)
+{
+  uint32_t n = m_nNodes;
+  m_binnedPos.resize (n);
+  m_unbinned.assign (n, false);
+  m_unbinnedIds.clear ();
+  m_nodeCell.resize (n);
+  m_maxSpeed = 0.0;
+
+  double maxX = 0.0;
+  double maxY = 0.0;
+  bool first = true;
+  for (uint32_t i = 0; i < n; i++)
+    {
+      Vector vel = m_snapshot->GetVelocity (i);
+      double speed = std::sqrt (vel.x * vel.x + vel.y * vel.y);
+      if (speed > m_maxBinnedSpeed)
         {
-          senderMoving = 0;
+          m_unbinned[i] = true;
+          m_unbinnedIds.push_back (i);
+          continue;
         }
-      else
+      m_maxSpeed = std::max (m_maxSpeed, speed);
+      Vector pos = m_snapshot->GetPosition (i);
+      m_binnedPos[i] = pos;
+      if (first)
         {
-          senderMoving = 1;
+          m_minX = maxX = pos.x;
+          m_minY = maxY = pos.y;
+          first = false;
         }
-      if (senderMoving != 0)
-        {
-        socket->Send (Create<Packet> (pktSize));
-
-        VanetRoutingExperiment::wavePktSendCount++;
-        if ((VanetRoutingExperiment::wavePktSendCount % 1000) == 0)
-          {
-            NS_LOG_UNCOND ("Sending WAVE pkt # " << VanetRoutingExperiment::wavePktSendCount );
-          }
-
-        // find other nodes close to this one
-        // iterate our nodes and print their position.
-        NodeContainer const & n = VanetRoutingExperiment::m_adhocTxNodes;
-        for (NodeContainer::Iterator j = n.Begin ();
-             j != n.End (); ++j)
-          {
-            Ptr<Node> object = *j;
-            int rxNodeId = object->GetId ();
+      m_minX = std::min (m_minX, pos.x);
+      m_minY = std::min (m_minY, pos.y);
+      maxX = std::max (maxX, pos.x);
+      maxY = std::max (maxY, pos.y);
+    }
+  m_nx = (uint32_t) ((maxX - m_minX) / m_cellSize) + 1;
+  m_ny = (uint32_t) ((maxY - m_minY) / m_cellSize) + 1;
 
-            if (rxNodeId != txNodeId) 
-              {
-              Ptr<MobilityModel> rxPosition = object->GetObject<MobilityModel> ();
-              NS_ASSERT (rxPosition != 0);
-              Vector rxVel = rxPosition->GetVelocity ();
-              // confirm that the receiving node 
-              // has also started moving in the scenario
-              // if it has not started moving, then
-              // it is not a candidate to receive a packet
-              int receiverMoving = 1;
-              if (rxVel.x != 0.0 || rxVel.y != 0.0)
-                {
-                  receiverMoving = 1;
-                }
-              else
-                {
-                  receiverMoving = 0;
-                }
-              if (receiverMoving == 1)
-                {
-                double distSq = getDistSq(n.Get (txNodeId), object);
-                if (distSq <= VanetRoutingExperiment::m_txSafetyRangeSq)
-                  {
-                    VanetRoutingExperiment::wavePktExpectedReceiveCount++;
-                  }
-                }
-              }
-          }
+  // counting sort of the binned nodes by cell
+  m_cellStart.assign (m_nx * m_ny + 1, 0);
+  for (uint32_t i = 0; i < n; i++)
+    {
+      if (!m_unbinned[i])
+        {
+          uint32_t cx = std::min ((uint32_t) ((m_binnedPos[i].x - m_minX) / m_cellSize), m_nx - 1);
+          uint32_t cy = std::min ((uint32_t) ((m_binnedPos[i].y - m_minY) / m_cellSize), m_ny - 1);
+          m_nodeCell[i] = cy * m_nx + cx;
+          m_cellStart[m_nodeCell[i] + 1]++;
         }
-
-      Simulator::Schedule (pktInterval, &GenerateWaveTraffic,
-                           socket, pktSize,pktCount - 1, pktInterval);
     }
-  else
+  for (uint32_t c = 0; c < m_nx * m_ny; c++)
+    {
+      m_cellStart[c + 1] += m_cellStart[c];
+    }
+  m_cellNodes.resize (m_cellStart[m_nx * m_ny]);
+  std::vector<uint32_t> fill (m_cellStart.begin (), m_cellStart.end () - 1);
+  for (uint32_t i = 0; i < n; i++)
     {
-      socket->Close ();
+      if (!m_unbinned[i])
+        {
+          m_cellNodes[fill[m_nodeCell[i]]++] = i;
+        }
     }
+
+  m_buildTime = Simulator::Now ();
+  m_built = true;
 }
 
 void
-VanetRoutingExperiment::CheckThroughput ()
+NeighborGrid::CourseChanged (Ptr<const MobilityModel> mobility)
 {
-  double kbs = (bytesTotal * 8.0) / 1000;
-  double wavePDR = 0.0;
-  if (VanetRoutingExperiment::wavePktSendCount > 0) {
-    wavePDR = (double) VanetRoutingExperiment::wavePktReceiveCount / (double) VanetRoutingExperiment::wavePktSendCount;
+  if (!m_built)
+    {
+      return;
     }
-
-  double wavePDR2 = 0.0;
-  if (VanetRoutingExperiment::wavePktExpectedReceiveCount > 0) {
-    wavePDR2 = (double) VanetRoutingExperiment::wavePktInCoverageReceiveCount / (double) VanetRoutingExperiment::wavePktExpectedReceiveCount;
+  uint32_t id = mobility->GetObject<Node> ()->GetId ();
+  if (m_unbinned[id])
+    {
+      return;
     }
 
-  bytesTotal = 0;
-  std::ofstream out (m_CSVfileName.c_str (), std::ios::app);
-
-  NS_LOG_UNCOND ("CheckThroughput at " << (Simulator::Now ()).GetSeconds () << " Rx=" << VanetRoutingExperiment::wavePktInCoverageReceiveCount << " of Tx=" <<  VanetRoutingExperiment::wavePktExpectedReceiveCount << " PDR=" << wavePDR2);
-
-  out << (Simulator::Now ()).GetSeconds () << ","
-      << kbs << ","
-      << packetsReceived << ","
-      << m_nSinks << ","
-      << m_protocolName << ","
-      << m_txp << ","
-      << VanetRoutingExperiment::wavePktReceiveCount << ","
-      << VanetRoutingExperiment::wavePktSendCount << ","
-      << wavePDR << ","
-      << VanetRoutingExperiment::wavePktExpectedReceiveCount << ","
-      << VanetRoutingExperiment::wavePktInCoverageReceiveCount << ","
-      << wavePDR2 << ""
-      << std::endl;
-
-  out.close ();
-  packetsReceived = 0;
-  VanetRoutingExperiment::wavePktReceiveCount = 0;
-  VanetRoutingExperiment::wavePktSendCount = 0;
+  // The node must remain within m_maxSpeed * (t - m_buildTime) of its
+  // binned position, for any time t until the next rebuild
+  Vector pos = mobility->GetPosition ();
+  Vector vel = mobility->GetVelocity ();
+  double speed = std::sqrt (vel.x * vel.x + vel.y * vel.y);
+  double dx = pos.x - m_binnedPos[id].x;
+  double dy = pos.y - m_binnedPos[id].y;
+  double moved = std::sqrt (dx * dx + dy * dy);
+  double age = (Simulator::Now () - m_buildTime).GetSeconds ();
+  double needed = speed;
+  if (moved > 0.0)
+    {
+      needed = (age > 0.0) ? std::max (speed, moved / age) : m_maxBinnedSpeed + 1.0;
+    }
+  if (needed > m_maxBinnedSpeed)
+    {
+      m_unbinned[id] = true;
+      m_unbinnedIds.push_back (id);
+    }
+  else
+    {
+      m_maxSpeed = std::max (m_maxSpeed, needed);
+    }
+}
 
-  Simulator::Schedule (Seconds (1.0), &VanetRoutingExperiment::CheckThroughput, this);
+void
+NeighborGrid::CheckNode (uint32_t id, const Vector &pos, double rangeSq, std::vector<uint32_t> &result) const
+{
+  Vector p = m_snapshot->GetPosition (id);
+  double distSq = (p.x - pos.x) * (p.x - pos.x) + (p.y - pos.y) * (p.y - pos.y);
+  if (distSq <= rangeSq)
+    {
+      result.push_back (id);
+    }
 }
 
-Ptr<Socket>
-VanetRoutingExperiment::SetupPacketReceive (Ipv4Address addr, Ptr<Node> node)
+void
+NeighborGrid::GetNodesWithin (const Vector &pos, double range, std::vector<uint32_t> &result)
 {
-  TypeId tid = TypeId::LookupByName ("ns3::UdpSocketFactory");
+  result.clear ();
+  if (!m_built || Simulator::Now () - m_buildTime >= m_refresh)
+    {
+      Rebuild ();
+    }
+
+  double rangeSq = range * range;
+  double reach = range + m_maxSpeed * (Simulator::Now () - m_buildTime).GetSeconds ();
+  double x0 = std::floor ((pos.x - reach - m_minX) / m_cellSize);
+  double x1 = std::floor ((pos.x + reach - m_minX) / m_cellSize);
+  double y0 = std::floor ((pos.y - reach - m_minY) / m_cellSize);
+  double y1 = std::floor ((pos.y + reach - m_minY) / m_cellSize);
+  if (x1 >= 0 && y1 >= 0 && x0 < m_nx && y0 < m_ny)
+    {
+      uint32_t cx0 = (uint32_t) std::max (x0, 0.0);
+      uint32_t cx1 = (uint32_t) std::min (x1, (double) m_nx - 1);
+      uint32_t cy0 = (uint32_t) std::max (y0, 0.0);
+      uint32_t cy1 = (uint32_t) std::min (y1, (double) m_ny - 1);
+      for (uint32_t cy = cy0; cy <= cy1; cy++)
+        {
+          for (uint32_t c = cy * m_nx + cx0; c <= cy * m_nx + cx1; c++)
+            {
+              for (uint32_t k = m_cellStart[c]; k < m_cellStart[c + 1]; k++)
+                {
+                  uint32_t id = m_cellNodes[k];
+                  if (!m_unbinned[id])
+                    {
+                      CheckNode (id, pos, rangeSq, result);
+                    }
+                }
+            }
+        }
+    }
+  for (std::vector<uint32_t>::const_iterator i = m_unbinnedIds.begin (); i != m_unbinnedIds.end (); ++i)
+    {
+      CheckNode (*i, pos, rangeSq, result);
+    }
+}
+
+/**
+ * \brief Log of the course changes of a set of nodes.
+ *
+ * Each course change is either written to the log right away or kept
+ * in a ring buffer of the last ringSize changes, written only by Dump.
+ * Sampling keeps every everyN-th change overall and, with a non-zero
+ * interval, at most one change per node per interval.
+ */
+class MobilityTracer
+{
+public:
+  MobilityTracer ();
+  void Setup (const NodeContainer &nodes, std::ostream *os,
+              uint32_t everyN, Time interval, uint32_t ringSize);
+  void Dump (void);
+
+private:
+  struct Record
+  {
+    Time m_at;
+    Vector m_pos;
+    Vector m_vel;
+  };
+
+  void CourseChanged (Ptr<const MobilityModel> mobility);
+  void Write (const Record &record);
+
+  std::ostream *m_os;
+  uint32_t m_everyN;
+  uint32_t m_count;
+  Time m_interval;
+  std::vector<Time> m_lastLogged; // by node id
+  std::vector<Record> m_ring;
+  uint32_t m_ringNext;
+  uint32_t m_ringUsed;
+};
+
+MobilityTracer::MobilityTracer ()
+  : m_os (0),
+    m_everyN (1),
+    m_count (0),
+    m_ringNext (0),
+    m_ringUsed (0)
+{
+}
+
+void
+MobilityTracer::Setup (const NodeContainer &nodes, std::ostream *os,
+                       uint32_t everyN, Time interval, uint32_t ringSize)
+{
+  m_os = os;
+  m_everyN = std::max (everyN, (uint32_t) 1);
+  m_interval = interval;
+  m_lastLogged.assign (nodes.GetN (), Seconds (-1.0) - interval);
+  m_ring.resize (ringSize);
+  for (uint32_t i = 0; i < nodes.GetN (); i++)
+    {
+      Ptr<MobilityModel> mobility = nodes.Get (i)->GetObject<MobilityModel> ();
+      mobility->TraceConnectWithoutContext ("CourseChange", MakeCallback (&MobilityTracer::CourseChanged, this));
+    }
+}
+
+void
+MobilityTracer::CourseChanged (Ptr<const MobilityModel> mobility)
+{
+  if (m_count++ % m_everyN != 0)
+    {
+      return;
+    }
+  Time now = Simulator::Now ();
+  if (m_interval.IsStrictlyPositive ())
+    {
+      uint32_t id = mobility->GetObject<Node> ()->GetId ();
+      if (now - m_lastLogged[id] < m_interval)
+        {
+          return;
+        }
+      m_lastLogged[id] = now;
+    }
+
+  Record record;
+  record.m_at = now;
+  record.m_pos = mobility->GetPosition ();
+  record.m_vel = mobility->GetVelocity ();
+  if (m_ring.empty ())
+    {
+      Write (record);
+    }
+  else
+    {
+      m_ring[m_ringNext] = record;
+      m_ringNext = (m_ringNext + 1) % m_ring.size ();
+      m_ringUsed = std::min (m_ringUsed + 1, (uint32_t) m_ring.size ());
+    }
+}
+
+void
+MobilityTracer::Write (const Record &record)
+{
+  Vector pos = record.m_pos;
+  pos.z = 1.5;
+
+  // Prints position and velocities
+  *m_os << record.m_at << " POS: x=" << pos.x << ", y=" << pos.y
+        << ", z=" << pos.z << "; VEL:" << record.m_vel.x << ", y=" << record.m_vel.y
+        << ", z=" << record.m_vel.z << '\n';
+}
+
+void
+MobilityTracer::Dump (void)
+{
+  // oldest first
+  uint32_t first = (m_ringNext + m_ring.size () - m_ringUsed) % std::max (m_ring.size (), (size_t) 1);
+  for (uint32_t i = 0; i < m_ringUsed; i++)
+    {
+      Write (m_ring[(first + i) % m_ring.size ()]);
+    }
+  m_ringUsed = 0;
+}
+
+/**
+ * \brief Streaming mean and variance of a series of samples (Welford).
+ */
+class RunningStat
+{
+public:
+  RunningStat ();
+  void Add (double x);
+  uint64_t GetCount (void) const;
+  double GetMean (void) const;
+  double GetVariance (void) const;
+
+private:
+  uint64_t m_n;
+  double m_mean;
+  double m_m2;
+};
+
+RunningStat::RunningStat ()
+  : m_n (0),
+    m_mean (0.0),
+    m_m2 (0.0)
+{
+}
+
+void
+RunningStat::Add (double x)
+{
+  m_n++;
+  double delta = x - m_mean;
+  m_mean += delta / m_n;
+  m_m2 += delta * (x - m_mean);
+}
+
+uint64_t
+RunningStat::GetCount (void) const
+{
+  return m_n;
+}
+
+double
+RunningStat::GetMean (void) const
+{
+  return m_mean;
+}
+
+double
+RunningStat::GetVariance (void) const
+{
+  return (m_n > 1) ? m_m2 / (m_n - 1) : 0.0;
+}
+
+/**
+ * \brief BSM delivery statistics of one experiment.
+ *
+ * Counts the BSMs sent and received in the current interval, and the
+ * receptions expected within the safety range and actually received
+ * there since the start, overall, per sending node and per distance
+ * bin.  Everything is a counter or a running mean, updated in constant
+ * time per event.
+ */
+class BsmStatistics
+{
+public:
+  BsmStatistics ();
+  void Setup (uint32_t nNodes, double range, double binWidth);
+  // only counts the BSMs sent from within area, its lower bounds
+  // included and its upper bounds excluded
+  void SetArea (const Rectangle &area);
+
+  void NotifySent (uint32_t txId, const Vector &txPos);
+  void NotifyExpected (uint32_t txId, double distSq);
+  void NotifyReceived (void);
+  void NotifyInCoverage (uint32_t txId, double distSq);
+  // closes the current interval: adds its PDR to the running
+  // statistics and resets the per-interval counters
+  void EndInterval (void);
+
+  uint64_t GetIntervalSent (void) const;
+  uint64_t GetIntervalReceived (void) const;
+  uint64_t GetSent (void) const;
+  uint64_t GetExpected (void) const;
+  uint64_t GetInCoverage (void) const;
+  // received in coverage / expected, since the start
+  double GetPdr (void) const;
+
+  // per distance bin, then per node: expected, received, PDR
+  void Write (std::ostream &os) const;
+
+private:
+  uint32_t GetBin (double distSq) const;
+
+  double m_binWidth;
+  bool m_hasArea;
+  Rectangle m_area;
+  uint64_t m_intervalSent;
+  uint64_t m_intervalReceived;
+  uint64_t m_sent;
+  uint64_t m_expected;
+  uint64_t m_inCoverage;
+  std::vector<bool> m_nodeCounted; // whether the last BSM of the node counts
+  std::vector<uint64_t> m_nodeSent;
+  std::vector<uint64_t> m_nodeExpected;
+  std::vector<uint64_t> m_nodeInCoverage;
+  std::vector<uint64_t> m_binExpected;
+  std::vector<uint64_t> m_binInCoverage;
+  RunningStat m_intervalPdr; // received / sent, per interval with BSMs sent
+  RunningStat m_rxDistance; // of the receptions in coverage
+};
+
+BsmStatistics::BsmStatistics ()
+  : m_binWidth (1.0),
+    m_hasArea (false),
+    m_intervalSent (0),
+    m_intervalReceived (0),
+    m_sent (0),
+    m_expected (0),
+    m_inCoverage (0)
+{
+}
+
+void
+BsmStatistics::Setup (uint32_t nNodes, double range, double binWidth)
+{
+  m_binWidth = binWidth;
+  m_nodeCounted.assign (nNodes, true);
+  m_nodeSent.assign (nNodes, 0);
+  m_nodeExpected.assign (nNodes, 0);
+  m_nodeInCoverage.assign (nNodes, 0);
+  uint32_t nBins = std::max ((uint32_t) std::ceil (range / binWidth), (uint32_t) 1);
+  m_binExpected.assign (nBins, 0);
+  m_binInCoverage.assign (nBins, 0);
+}
+
+inline uint32_t
+BsmStatistics::GetBin (double distSq) const
+{
+  uint32_t bin = (uint32_t) (std::sqrt (distSq) / m_binWidth);
+  return std::min (bin, (uint32_t) m_binExpected.size () - 1);
+}
+
+void
+BsmStatistics::SetArea (const Rectangle &area)
+{
+  m_hasArea = true;
+  m_area = area;
+}
+
+void
+BsmStatistics::NotifySent (uint32_t txId, const Vector &txPos)
+{
+  // the receptions of a BSM all happen before the next one is sent
+  m_nodeCounted[txId] = !m_hasArea
+    || (txPos.x >= m_area.xMin && txPos.x < m_area.xMax && txPos.y >= m_area.yMin && txPos.y < m_area.yMax);
+  if (!m_nodeCounted[txId])
+    {
+      return;
+    }
+  m_intervalSent++;
+  m_sent++;
+  m_nodeSent[txId]++;
+}
+
+void
+BsmStatistics::NotifyExpected (uint32_t txId, double distSq)
+{
+  if (!m_nodeCounted[txId])
+    {
+      return;
+    }
+  m_expected++;
+  m_nodeExpected[txId]++;
+  m_binExpected[GetBin (distSq)]++;
+}
+
+void
+BsmStatistics::NotifyReceived (void)
+{
+  m_intervalReceived++;
+}
+
+void
+BsmStatistics::NotifyInCoverage (uint32_t txId, double distSq)
+{
+  if (!m_nodeCounted[txId])
+    {
+      return;
+    }
+  m_inCoverage++;
+  m_nodeInCoverage[txId]++;
+  m_binInCoverage[GetBin (distSq)]++;
+  m_rxDistance.Add (std::sqrt (distSq));
+}
+
+void
+BsmStatistics::EndInterval (void)
+{
+  if (m_intervalSent > 0)
+    {
+      m_intervalPdr.Add ((double) m_intervalReceived / (double) m_intervalSent);
+    }
+  m_intervalSent = 0;
+  m_intervalReceived = 0;
+}
+
+uint64_t
+BsmStatistics::GetIntervalSent (void) const
+{
+  return m_intervalSent;
+}
+
+uint64_t
+BsmStatistics::GetIntervalReceived (void) const
+{
+  return m_intervalReceived;
+}
+
+uint64_t
+BsmStatistics::GetSent (void) const
+{
+  return m_sent;
+}
+
+uint64_t
+BsmStatistics::GetExpected (void) const
+{
+  return m_expected;
+}
+
+uint64_t
+BsmStatistics::GetInCoverage (void) const
+{
+  return m_inCoverage;
+}
+
+double
+BsmStatistics::GetPdr (void) const
+{
+  return (m_expected > 0) ? (double) m_inCoverage / (double) m_expected : 0.0;
+}
+
+void
+BsmStatistics::Write (std::ostream &os) const
+{
+  os << "IntervalPdrMean," << m_intervalPdr.GetMean () << "\n"
+     << "IntervalPdrVariance," << m_intervalPdr.GetVariance () << "\n"
+     << "RxDistanceMean," << m_rxDistance.GetMean () << "\n"
+     << "RxDistanceVariance," << m_rxDistance.GetVariance () << "\n";
+  os << "DistanceFrom,Expected,Received,PDR\n";
+  for (uint32_t i = 0; i < m_binExpected.size (); i++)
+    {
+      double pdr = (m_binExpected[i] > 0) ? (double) m_binInCoverage[i] / (double) m_binExpected[i] : 0.0;
+      os << i * m_binWidth << "," << m_binExpected[i] << "," << m_binInCoverage[i] << "," << pdr << "\n";
+    }
+  os << "Node,Sent,Expected,Received,PDR\n";
+  for (uint32_t i = 0; i < m_nodeExpected.size (); i++)
+    {
+      double pdr = (m_nodeExpected[i] > 0) ? (double) m_nodeInCoverage[i] / (double) m_nodeExpected[i] : 0.0;
+      os << i << "," << m_nodeSent[i] << "," << m_nodeExpected[i] << "," << m_nodeInCoverage[i]
+         << "," << pdr << "\n";
+    }
+}
+
+/**
+ * \brief Recycles the BSM packets once the stack is done with them.
+ *
+ * The packets are handed out in a ring.  When the pool holds the only
+ * reference left to the oldest one, the stack is done with it: the
+ * headers and tags it may have added to it, rather than to a copy, are
+ * stripped and it is handed out again, with its buffer.  A packet is
+ * only created while the oldest one is still in use, so the ring
+ * settles at the number of BSMs in flight and the application then
+ * no longer allocates packets.  Recycled packets keep their uid.
+ */
+class BsmPacketPool
+{
+public:
+  BsmPacketPool ();
+  void Setup (uint32_t pktSize);
+  // a packet of pktSize bytes, which the stack no longer uses
+  Ptr<Packet> Get (void);
+  uint64_t GetNCreated (void) const;
+  uint64_t GetNRecycled (void) const;
+
+private:
+  uint32_t m_pktSize;
+  std::vector<Ptr<Packet> > m_packets;
+  size_t m_next; // oldest packet handed out
+  uint64_t m_nCreated;
+  uint64_t m_nRecycled;
+};
+
+BsmPacketPool::BsmPacketPool ()
+  : m_pktSize (0),
+    m_next (0),
+    m_nCreated (0),
+    m_nRecycled (0)
+{
+}
+
+void
+BsmPacketPool::Setup (uint32_t pktSize)
+{
+  m_pktSize = pktSize;
+  m_packets.clear ();
+  m_next = 0;
+}
+
+Ptr<Packet>
+BsmPacketPool::Get (void)
+{
+  if (!m_packets.empty () && m_packets[m_next]->GetReferenceCount () == 1)
+    {
+      Ptr<Packet> packet = m_packets[m_next];
+      // the stack only adds headers in front of the packets it sends
+      NS_ASSERT (packet->GetSize () >= m_pktSize);
+      packet->RemoveAllPacketTags ();
+      packet->RemoveAllByteTags ();
+      packet->RemoveAtStart (packet->GetSize () - m_pktSize);
+      m_next = (m_next + 1) % m_packets.size ();
+      m_nRecycled++;
+      return packet;
+    }
+  // the oldest packet is still in flight: the newest one is inserted
+  // right before it
+  Ptr<Packet> packet = Create<Packet> (m_pktSize);
+  m_packets.insert (m_packets.begin () + m_next, packet);
+  m_next = (m_next + 1) % m_packets.size ();
+  m_nCreated++;
+  return packet;
+}
+
+uint64_t
+BsmPacketPool::GetNCreated (void) const
+{
+  return m_nCreated;
+}
+
+uint64_t
+BsmPacketPool::GetNRecycled (void) const
+{
+  return m_nRecycled;
+}
+
+/**
+ * \brief Row-oriented metrics file kept open for the whole run.
+ *
+ * Rows are formatted into a large stream buffer and only written out
+ * when it fills up, every flushRows rows, or on Flush/Close.  In text
+ * mode a row is the same comma-separated line an std::ostream would
+ * print; in binary mode each numeric field is a native double and each
+ * string a uint32_t length followed by its bytes.
+ */
+class MetricsWriter
+{
+public:
+  MetricsWriter ();
+  ~MetricsWriter ();
+  void Open (const std::string &fileName, bool binary, uint32_t flushRows);
+  bool IsOpen () const;
+  template <typename T>
+  void Add (const T &value);
+  void Add (const std::string &value);
+  void EndRow ();
+  void Flush ();
+  void Close ();
+
+private:
+  void Separate ();
+
+  std::ofstream m_out;
+  std::vector<char> m_buffer;
+  bool m_binary;
+  bool m_rowStarted;
+  uint32_t m_flushRows;
+  uint32_t m_pendingRows;
+};
+
+MetricsWriter::MetricsWriter ()
+  : m_buffer (1 << 16),
+    m_binary (false),
+    m_rowStarted (false),
+    m_flushRows (0),
+    m_pendingRows (0)
+{
+}
+
+MetricsWriter::~MetricsWriter ()
+{
+  Close ();
+}
+
+void
+MetricsWriter::Open (const std::string &fileName, bool binary, uint32_t flushRows)
+{
+  Close ();
+  m_binary = binary;
+  m_flushRows = flushRows;
+  // must be set before opening to be used
+  m_out.rdbuf ()->pubsetbuf (&m_buffer[0], m_buffer.size ());
+  std::ios::openmode mode = std::ios::app;
+  if (binary)
+    {
+      mode |= std::ios::binary;
+    }
+  m_out.open (fileName.c_str (), mode);
+}
+
+bool
+MetricsWriter::IsOpen () const
+{
+  return m_out.is_open ();
+}
+
+void
+MetricsWriter::Separate ()
+{
+  if (m_rowStarted && !m_binary)
+    {
+      m_out << ',';
+    }
+  m_rowStarted = true;
+}
+
+template <typename T>
+void
+MetricsWriter::Add (const T &value)
+{
+  Separate ();
+  if (m_binary)
+    {
+      double v = value;
+      m_out.write (reinterpret_cast<const char *> (&v), sizeof (v));
+    }
+  else
+    {
+      m_out << value;
+    }
+}
+
+void
+MetricsWriter::Add (const std::string &value)
+{
+  Separate ();
+  if (m_binary)
+    {
+      uint32_t len = value.size ();
+      m_out.write (reinterpret_cast<const char *> (&len), sizeof (len));
+    }
+  m_out << value;
+}
+
+void
+MetricsWriter::EndRow ()
+{
+  if (!m_binary)
+    {
+      m_out << '\n';
+    }
+  m_rowStarted = false;
+  if (m_flushRows > 0 && ++m_pendingRows >= m_flushRows)
+    {
+      Flush ();
+    }
+}
+
+void
+MetricsWriter::Flush ()
+{
+  if (m_out.is_open ())
+    {
+      m_out.flush ();
+    }
+  m_pendingRows = 0;
+}
+
+void
+MetricsWriter::Close ()
+{
+  if (m_out.is_open ())
+    {
+      m_out.close ();
+    }
+  m_pendingRows = 0;
+  m_rowStarted = false;
+}
+
+/**
+ * \brief The default map scheduler, counting the events it dequeues.
+ *
+ * Installed by the benchmark to report events per second.  Cancelled
+ * events are dequeued, and so counted, too.
+ */
+class CountingScheduler : public MapScheduler
+{
+public:
+  static TypeId GetTypeId (void);
+  static uint64_t GetNEvents (void);
+  virtual Scheduler::Event RemoveNext (void);
+
+private:
+  static uint64_t m_nEvents;
+};
+
+uint64_t CountingScheduler::m_nEvents = 0;
+
+TypeId
+CountingScheduler::GetTypeId (void)
+{
+  static TypeId tid = TypeId ("ns3::CountingScheduler")
+    .SetParent<MapScheduler> ()
+    .AddConstructor<CountingScheduler> ()
+  ;
+  return tid;
+}
+
+uint64_t
+CountingScheduler::GetNEvents (void)
+{
+  return m_nEvents;
+}
+
+Scheduler::Event
+CountingScheduler::RemoveNext (void)
+{
+  m_nEvents++;
+  return MapScheduler::RemoveNext ();
+}
+
+class VanetRoutingExperiment
+{
+public:
+  VanetRoutingExperiment ();
+  void Run ();
+  void CommandSetup (int argc, char **argv);
+  bool IsSweep () const;
+  int RunSweep (int argc, char **argv);
+  bool IsBenchmark () const;
+  int RunBenchmark (int argc, char **argv);
+  bool IsPartitioned () const;
+  int RunPartitions (int argc, char **argv);
+
+  static NodeContainer m_adhocTxNodes;
+  static double m_txSafetyRange;
+  static double m_txSafetyRangeSq;
+
+private:
+  Ptr<Socket> SetupPacketReceive (Ipv4Address addr, Ptr<Node> node);
+  void ReceivePacket (Ptr<Socket> socket);
+  void ReceiveWavePacket (Ptr<Socket> socket);
+  void CheckThroughput ();
+  void SetupLogFile ();
+  void SetupLogging ();
+  void ConfigureDefaults ();
+  void SetupMobilityTracing ();
+  void SetupAdhocMobilityNodes ();
+  void SetupAdhocDevices ();
+  void SetupRouting ();
+  void AssignIpAddresses ();
+  void SetupWaveMessages ();
+  void SetupRoutingMessages ();
+  void SetupScenario ();
+  void WriteCsvHeader ();
+  void SetupOutputNames ();
+  static bool ParseSweep (const std::string &sweep,
+                          std::vector<std::string> &names,
+                          std::vector<std::vector<std::string> > &values);
+  static std::string AddSuffix (const std::string &fileName, const std::string &suffix);
+  static void GetCombinations (const std::vector<std::vector<std::string> > &values,
+                               std::vector<std::vector<std::string> > &combinations);
+  // Forks n children, jobs at a time.  Returns the index of the child
+  // in each child, and -1 in the parent once all of them have exited.
+  int32_t ForkChildren (uint32_t n, uint32_t jobs, std::vector<bool> &succeeded);
+  // Returns true in each variant's child, which goes on with the run,
+  // and false in the parent once all of them have finished.
+  bool ForkVariants ();
+  static void CopyFile (const std::string &from, const std::string &to);
+  void RunMicroBenchmarks (std::ostream &os);
+  static void WriteBenchmark (std::ostream &os, const std::string &benchmark,
+                              const std::string &name, const std::string &metric, double value);
+  // Parses "xMin,xMax,yMin,yMax"
+  static bool ParseRectangle (const std::string &value, Rectangle &area);
+  // Adds the shape of each <poly> of a SUMO polygon file to obstacles
+  static bool LoadBuildings (const std::string &fileName, ObstacleIndex &obstacles);
+
+  uint32_t port;
+  uint32_t bytesTotal;
+  uint32_t totalBytesTotal;
+  uint32_t packetsReceived;
+  uint32_t totalPacketsReceived;
+
+  std::string m_CSVfileName;
+  std::string m_CSVfileName2;
+  int m_nSinks;
+  std::string m_protocolName;
+  double m_txp;
+  bool m_traceMobility;
+  uint32_t m_protocol;
+
+  uint32_t m_lossModel;
+  std::string m_lossModelName;
+
+  std::string m_phyMode;
+  uint32_t m_80211mode;
+
+  std::string m_traceFile;
+  std::string m_logFile;
+  uint32_t m_mobility;
+  uint32_t m_nNodes;
+  double m_TotalTime;
+  std::string m_rate;
+  std::string m_phyMode_b;
+  std::string m_tr_name;
+  int m_nodeSpeed; //in m/s
+  int m_nodePause; //in s
+  uint32_t m_wavePacketSize; // bytes
+  uint32_t m_numWavePackets;
+  double m_waveInterval; // seconds
+  int m_verbose;
+  std::ofstream m_os;
+  std::vector<char> m_osBuffer;
+  MetricsWriter m_csvWriter;
+  NetDeviceContainer m_adhocTxDevices;
+  Ipv4InterfaceContainer m_adhocTxInterfaces;
+  uint32_t m_adhocTxFirstAddress; // address of interface 0, as an integer
+  std::vector<Ptr<Node> > m_adhocTxAddressNodes; // node of each interface, by address offset
+  uint32_t m_scenario;
+  int m_flowmon;
+  double m_gpsAccuracyNs;
+  int m_routing_tables;
+  int m_ascii_trace;
+  int m_pcap;
+  int m_binaryTrace;
+  double m_mobilityWindow; // seconds
+  int m_waypointTable;
+  double m_traceStart; // seconds
+  double m_traceStop; // seconds, 0 for the whole trace
+  std::string m_traceArea;
+  std::string m_traceNodes;
+  uint32_t m_partitionsX;
+  uint32_t m_partitionsY;
+  double m_partitionHalo; // m, 0 for the line-of-sight carrier sense range
+  uint32_t m_partitionJobs;
+  std::string m_partitionCsvFile;
+  std::string m_partitionCore; // area whose BSMs this run counts
+  int m_lossStats;
+  int m_csvBinary;
+  MobilityTracer m_mobilityTracer;
+  uint32_t m_mobilityTraceEvery;
+  double m_mobilityTraceInterval; // seconds
+  uint32_t m_mobilityTraceRing;
+  BsmStatistics m_bsmStats;
+  BsmPacketPool m_bsmPackets;
+  MobilitySnapshot m_mobilitySnapshot;
+  NeighborGrid m_neighborGrid;
+  int m_bsmStatsFile;
+  double m_bsmStatsBinWidth; // m
+  Ptr<ItuR1411LosPropagationLossModel> m_ituLossModel; // 0 unless lossModel=2
+  double m_hybridCoreRadius; // 0 for the full loss model at every distance
+  uint32_t m_linkCacheSize;  // 0 to test every link against the buildings
+  std::string m_sweep;
+  uint32_t m_sweepJobs; // 0 = one per processor
+  std::string m_sweepCsvFile;
+  std::string m_outputSuffix;
+  std::string m_forkVariants;
+  double m_checkpointTime; // when > 0, the variants are forked at that time
+  int m_benchmark;
+  std::string m_benchmarkScenarios;
+  std::string m_benchmarkCsvFile;
+  uint32_t m_benchmarkOps; // operations per micro-benchmark
+  double m_loadSeconds; // wall time of the last run's phases
+  double m_installSeconds;
+  double m_runSeconds;
+
+  int m_loadBuildings;
+  std::string m_buildingsFile; // SUMO polygons, empty for the scenario's
+  ObstacleIndex m_obstacles;   // the buildings, for lossModel=2
+};
+
+NodeContainer VanetRoutingExperiment::m_adhocTxNodes;
+double VanetRoutingExperiment::m_txSafetyRange = 145.0;
+double VanetRoutingExperiment::m_txSafetyRangeSq = 145.0 * 145.0;
+
+VanetRoutingExperiment::VanetRoutingExperiment ()
+  : port (9),
+    bytesTotal (0),
+    totalBytesTotal (0),
+    packetsReceived (0),
+    totalPacketsReceived (0),
+    m_CSVfileName ("vanet-routing.output.csv"),
+    m_CSVfileName2 ("vanet-routing.output2.csv"),
+    m_nSinks (10),
+    m_protocolName ("protocol"),
+    m_txp (7.5),
+    m_traceMobility (false),
+    m_protocol (2), // AODV
+    m_lossModel (2), // ITU R-1441
+    m_lossModelName (""),
+    m_phyMode ("OfdmRate6MbpsBW10MHz"),
+    m_80211mode (1),  // 1=802.11p
+    m_traceFile ("./scratch/low_ct-unterstrass-1day.filt.5.adj.mov"),
+    m_logFile ("low_ct-unterstrass-1day.filt.5.adj.log"),
+    m_mobility (1),
+    m_nNodes (156),
+    m_TotalTime(300.01),
+    m_rate ("2048bps"),
+    m_phyMode_b ("DsssRate11Mbps"),
+    m_tr_name ("vanet-routing-compare"),
+    m_nodeSpeed (20),
+    m_nodePause (0),
+    m_wavePacketSize (200),
+    m_numWavePackets (1),
+    m_waveInterval (0.1),
+    m_verbose (0),
+    m_adhocTxFirstAddress (0),
+    m_scenario (1),
+    m_flowmon (1),
+    m_gpsAccuracyNs (10000),
+    m_routing_tables (0),
+    m_ascii_trace (0),
+    m_pcap (0),
+    m_binaryTrace (0),
+    m_mobilityWindow (0.0),
+    m_waypointTable (0),
+    m_traceStart (0.0),
+    m_traceStop (0.0),
+    m_traceArea (""),
+    m_traceNodes (""),
+    m_partitionsX (1),
+    m_partitionsY (1),
+    m_partitionHalo (0.0),
+    m_partitionJobs (0),
+    m_partitionCsvFile ("vanet-routing-partitions.csv"),
+    m_partitionCore (""),
+    m_lossStats (0),
+    m_csvBinary (0),
+    m_mobilityTraceEvery (1),
+    m_mobilityTraceInterval (0.0),
+    m_mobilityTraceRing (0),
+    m_bsmStatsFile (0),
+    m_bsmStatsBinWidth (10.0),
+    m_hybridCoreRadius (0.0),
+    m_linkCacheSize (0),
+    m_sweep (""),
+    m_sweepJobs (0),
+    m_sweepCsvFile ("vanet-routing-sweep.csv"),
+    m_outputSuffix (""),
+    m_forkVariants (""),
+    m_checkpointTime (0.0),
+    m_benchmark (0),
+    m_benchmarkScenarios ("1,2,3,4,5"),
+    m_benchmarkCsvFile ("vanet-routing-benchmark.csv"),
+    m_benchmarkOps (1000000),
+    m_loadSeconds (0.0),
+    m_installSeconds (0.0),
+    m_runSeconds (0.0),
+    m_loadBuildings (0),
+    m_buildingsFile ("")
+{
+}
+
+
+static inline std::string
+PrintReceivedPacket (Ptr<Socket> socket, Ptr<Packet> packet)
+{
+  SocketAddressTag tag;
+  bool found;
+  found = packet->PeekPacketTag (tag);
+  std::ostringstream oss;
+
+  oss << Simulator::Now ().GetSeconds () << " " << socket->GetNode ()->GetId ();
+
+  if (found)
+    {
+      InetSocketAddress addr = InetSocketAddress::ConvertFrom (tag.GetAddress ());
+      oss << " received one packet from " << addr.GetIpv4 ();
+    }
+  else
+    {
+      oss << " received one packet!";
+    }
+  return oss.str ();
+}
+
+void
+VanetRoutingExperiment::ReceivePacket (Ptr<Socket> socket)
+{
+  Ptr<Packet> packet;
+  while ((packet = socket->Recv ()))
+    {
+      bytesTotal += packet->GetSize ();
+      totalBytesTotal += packet->GetSize ();
+      packetsReceived += 1;
+      totalPacketsReceived += 1;
+      NS_LOG_UNCOND ("ROUT  " + PrintReceivedPacket (socket, packet));
+    }
+}
+
+void VanetRoutingExperiment::ReceiveWavePacket (Ptr<Socket> socket)
+{
+  NS_PROFILE_SCOPE ("ReceiveWavePacket");
+  Ptr<Packet> packet;
+  while ((packet = socket->Recv ()))
+    {
+      m_bsmStats.NotifyReceived ();
+      uint32_t rxNodeId = socket->GetNode ()->GetId ();
+      MobilitySnapshot &snapshot = m_mobilitySnapshot;
+
+      // confirm that the receiving node 
+      // has also started moving in the scenario
+      // if it has not started moving, then
+      // it is not a candidate to receive a packet
+      if (snapshot.IsMoving (rxNodeId))
+        {
+        SocketAddressTag tag;
+        bool found;
+        found = packet->PeekPacketTag (tag);
+
+        if (found)
+          {
+            InetSocketAddress addr = InetSocketAddress::ConvertFrom (tag.GetAddress ());
+            // interfaces have consecutive addresses (see AssignIpAddresses)
+            uint32_t txIndex = addr.GetIpv4 ().Get () - m_adhocTxFirstAddress;
+            if (txIndex < m_adhocTxAddressNodes.size ())
+              {
+                uint32_t txNodeId = m_adhocTxAddressNodes[txIndex]->GetId ();
+
+                double rxDistSq = snapshot.GetDistSq (rxNodeId, txNodeId);
+                if (rxDistSq <= VanetRoutingExperiment::m_txSafetyRangeSq)
+                  {
+                    m_bsmStats.NotifyInCoverage (txNodeId, rxDistSq);
+                  }
+              }
+          }
+        }
+    }
+}
+
+/**
+ * \brief Sends a BSM from its node every interval while the node moves.
+ *
+ * Transmissions happen at start + k * interval + jitter, for k below
+ * the number of packets, with a jitter drawn anew for every period so
+ * that neighbours started together do not stay synchronized.  While the
+ * node is stationary no timer runs at all: a CourseChange to a non-zero
+ * velocity resumes it at the next of these instants.  The scheduler
+ * load thus follows the vehicles actually moving.
+ *
+ * The application is not given the first and last movement of its
+ * node in the trace: it starts and stops at the same times for all the
+ * nodes, and this suppression while stationary, which covers the time
+ * before the first movement and after the last one, replaces per-node
+ * start and stop times.
+ */
+class BsmApplication : public Application
+{
+public:
+  BsmApplication ();
+  virtual ~BsmApplication ();
+
+  /**
+   * \param socket the broadcast socket to send on, closed at the end
+   * \param pktSize the BSM size in bytes
+   * \param nPackets the number of transmission instants
+   * \param interval the time between two transmission instants
+   * \param jitter the largest delay added to each transmission instant
+   * \param stats where to count the BSMs sent and their expected receivers
+   * \param packets where to take the BSMs from, pktSize bytes each
+   * \param snapshot the positions of the nodes
+   * \param grid the index of snapshot finding the expected receivers
+   */
+  void Setup (Ptr<Socket> socket, uint32_t nPackets, Time interval, Time jitter,
+              BsmStatistics *stats, BsmPacketPool *packets,
+              MobilitySnapshot *snapshot, NeighborGrid *grid);
+
+private:
+  virtual void StartApplication (void);
+  virtual void StopApplication (void);
+  virtual void DoDispose (void);
+
+  void Send (void);
+  void ScheduleNext (void);
+  Time GetTxTime (uint32_t k);
+  void Resume (void);
+  void Finish (void);
+  void CourseChanged (Ptr<const MobilityModel> mobility);
+
+  Ptr<Socket> m_socket;
+  BsmStatistics *m_stats;
+  BsmPacketPool *m_packets;
+  MobilitySnapshot *m_snapshot;
+  NeighborGrid *m_grid;
+  std::vector<uint32_t> m_neighbors; // kept to avoid reallocation on every BSM
+  uint32_t m_nPackets;
+  Time m_interval;
+  Time m_jitter;
+  Ptr<UniformRandomVariable> m_jitterVariable;
+  Time m_firstTx;
+  uint32_t m_next; // index of the next transmission instant
+  EventId m_sendEvent;
+  EventId m_finishEvent;
+  bool m_resumePending; // a Resume event is scheduled in the node's context
+  bool m_running;
+};
+
+BsmApplication::BsmApplication ()
+  : m_stats (0),
+    m_packets (0),
+    m_snapshot (0),
+    m_grid (0),
+    m_nPackets (0),
+    m_next (0),
+    m_resumePending (false),
+    m_running (false)
+{
+}
+
+BsmApplication::~BsmApplication ()
+{
+}
+
+void
+BsmApplication::Setup (Ptr<Socket> socket, uint32_t nPackets, Time interval, Time jitter,
+                       BsmStatistics *stats, BsmPacketPool *packets,
+                       MobilitySnapshot *snapshot, NeighborGrid *grid)
+{
+  m_socket = socket;
+  m_stats = stats;
+  m_packets = packets;
+  m_snapshot = snapshot;
+  m_grid = grid;
+  m_nPackets = nPackets;
+  m_interval = interval;
+  m_jitter = jitter;
+  m_jitterVariable = CreateObject<UniformRandomVariable> ();
+}
+
+void
+BsmApplication::DoDispose (void)
+{
+  m_socket = 0;
+  Application::DoDispose ();
+}
+
+void
+BsmApplication::StartApplication (void)
+{
+  m_running = true;
+  m_firstTx = Simulator::Now ();
+  m_next = 0;
+  GetNode ()->GetObject<MobilityModel> ()->TraceConnectWithoutContext (
+    "CourseChange", MakeCallback (&BsmApplication::CourseChanged, this));
+  // the socket is closed one interval after the last transmission instant
+  m_finishEvent = Simulator::Schedule (TimeStep (m_nPackets * m_interval.GetTimeStep ()),
+                                       &BsmApplication::Finish, this);
+  if (m_nPackets > 0)
+    {
+      Send ();
+    }
+}
+
+void
+BsmApplication::StopApplication (void)
+{
+  m_running = false;
+  Simulator::Cancel (m_sendEvent);
+  Simulator::Cancel (m_finishEvent);
+}
+
+void
+BsmApplication::Finish (void)
+{
+  m_running = false;
+  Simulator::Cancel (m_sendEvent);
+  m_socket->Close ();
+}
+
+void
+BsmApplication::CourseChanged (Ptr<const MobilityModel> mobility)
+{
+  if (!m_running || m_sendEvent.IsRunning () || m_resumePending || m_next >= m_nPackets)
+    {
+      return;
+    }
+  Vector vel = mobility->GetVelocity ();
+  if (vel.x == 0.0 && vel.y == 0.0)
+    {
+      return;
+    }
+  // resume at the first transmission instant not in the past
+  int64_t elapsed = (Simulator::Now () - m_firstTx).GetTimeStep ();
+  int64_t step = m_interval.GetTimeStep ();
+  if (elapsed > 0)
+    {
+      m_next = std::max (m_next, (uint32_t) ((elapsed + step - 1) / step));
+    }
+  if (m_next >= m_nPackets)
+    {
+      return;
+    }
+  // course changes do not run in the node's context
+  Time at = GetTxTime (m_next);
+  m_resumePending = true;
+  Simulator::ScheduleWithContext (GetNode ()->GetId (), at - Simulator::Now (),
+                                  &BsmApplication::Resume, this);
+}
+
+void
+BsmApplication::Resume (void)
+{
+  m_resumePending = false;
+  if (m_running)
+    {
+      Send ();
+    }
+}
+
+void
+BsmApplication::ScheduleNext (void)
+{
+  if (m_next >= m_nPackets)
+    {
+      return;
+    }
+  Time at = GetTxTime (m_next);
+  m_sendEvent = Simulator::Schedule (at - Simulator::Now (), &BsmApplication::Send, this);
+}
+
+Time
+BsmApplication::GetTxTime (uint32_t k)
+{
+  // the jitter of a period does not shift the later ones
+  int64_t jitter = 0;
+  if (k > 0 && m_jitter.IsStrictlyPositive ())
+    {
+      jitter = (int64_t) m_jitterVariable->GetValue (0, m_jitter.GetTimeStep ());
+    }
+  return m_firstTx + TimeStep (k * m_interval.GetTimeStep () + jitter);
+}
+
+void
+BsmApplication::Send (void)
+{
+  NS_PROFILE_SCOPE ("BsmApplication::Send");
+  // first, we make sure this node is moving
+  // if not, then wait for it to move again
+  int txNodeId = GetNode ()->GetId ();
+  MobilitySnapshot &snapshot = *m_snapshot;
+  if (!snapshot.IsMoving (txNodeId))
+    {
+      m_next++;
+      return;
+    }
+
+  m_socket->Send (m_packets->Get ());
+
+  m_stats->NotifySent (txNodeId, snapshot.GetPosition (txNodeId));
+  if ((m_stats->GetIntervalSent () % 1000) == 0)
+    {
+      NS_LOG_UNCOND ("Sending WAVE pkt # " << m_stats->GetIntervalSent () );
+    }
+
+  // find other nodes close to this one
+  m_grid->GetNodesWithin (snapshot.GetPosition (txNodeId), VanetRoutingExperiment::m_txSafetyRange,
+                          m_neighbors);
+  for (std::vector<uint32_t>::const_iterator j = m_neighbors.begin ();
+       j != m_neighbors.end (); ++j)
+    {
+      int rxNodeId = *j;
+
+      // confirm that the receiving node 
+      // has also started moving in the scenario
+      // if it has not started moving, then
+      // it is not a candidate to receive a packet
+      if (rxNodeId != txNodeId && snapshot.IsMoving (rxNodeId))
+        {
+          // the grid only returns nodes within the safety range
+          m_stats->NotifyExpected (txNodeId, snapshot.GetDistSq (txNodeId, rxNodeId));
+        }
+    }
+
+  m_next++;
+  ScheduleNext ();
+}
+
+void
+VanetRoutingExperiment::CheckThroughput ()
+{
+  NS_PROFILE_SCOPE ("CheckThroughput");
+  double kbs = (bytesTotal * 8.0) / 1000;
+  double wavePDR = 0.0;
+  if (m_bsmStats.GetIntervalSent () > 0) {
+    wavePDR = (double) m_bsmStats.GetIntervalReceived () / (double) m_bsmStats.GetIntervalSent ();
+    }
+
+  double wavePDR2 = m_bsmStats.GetPdr ();
+
+  bytesTotal = 0;
+  if (!m_csvWriter.IsOpen ())
+    {
+      if (m_csvBinary != 0)
+        {
+          m_csvWriter.Open (m_CSVfileName + ".bin", true, 60);
+        }
+      else
+        {
+          m_csvWriter.Open (m_CSVfileName, false, 60);
+        }
+    }
+
+  NS_LOG_UNCOND ("CheckThroughput at " << (Simulator::Now ()).GetSeconds () << " Rx=" << m_bsmStats.GetInCoverage () << " of Tx=" <<  m_bsmStats.GetExpected () << " PDR=" << wavePDR2);
+
+  m_csvWriter.Add ((Simulator::Now ()).GetSeconds ());
+  m_csvWriter.Add (kbs);
+  m_csvWriter.Add (packetsReceived);
+  m_csvWriter.Add (m_nSinks);
+  m_csvWriter.Add (m_protocolName);
+  m_csvWriter.Add (m_txp);
+  m_csvWriter.Add (m_bsmStats.GetIntervalReceived ());
+  m_csvWriter.Add (m_bsmStats.GetIntervalSent ());
+  m_csvWriter.Add (wavePDR);
+  m_csvWriter.Add (m_bsmStats.GetExpected ());
+  m_csvWriter.Add (m_bsmStats.GetInCoverage ());
+  m_csvWriter.Add (wavePDR2);
+  m_csvWriter.EndRow ();
+  packetsReceived = 0;
+  m_bsmStats.EndInterval ();
+
+  Simulator::Schedule (Seconds (1.0), &VanetRoutingExperiment::CheckThroughput, this);
+}
+
+Ptr<Socket>
+VanetRoutingExperiment::SetupPacketReceive (Ipv4Address addr, Ptr<Node> node)
+{
+  TypeId tid = TypeId::LookupByName ("ns3::UdpSocketFactory");
   Ptr<Socket> sink = Socket::CreateSocket (node, tid);
   InetSocketAddress local = InetSocketAddress (addr, port);
   sink->Bind (local);
@@ -508,7 +1858,7 @@ void
 VanetRoutingExperiment::CommandSetup (int argc, char **argv)
 {
   CommandLine cmd;
-  double txDist = 145.0;
+  double txDist = m_txSafetyRange;
   cmd.AddValue ("CSVfileName", "The name of the CSV output file name", m_CSVfileName);
   cmd.AddValue ("CSVfileName2", "The name of the CSV output file name2", m_CSVfileName2);
   cmd.AddValue ("totaltime", "Simulation end time", m_TotalTime);
@@ -516,6 +1866,9 @@ VanetRoutingExperiment::CommandSetup (int argc, char **argv)
   cmd.AddValue ("sinks", "Number of routing sinks", m_nSinks);
   cmd.AddValue ("txp", "Transmit power (dB), e.g. txp=7.5", m_txp);
   cmd.AddValue ("traceMobility", "Enable mobility tracing", m_traceMobility);
+  cmd.AddValue ("mobilityTraceEvery", "Log only every Nth course change", m_mobilityTraceEvery);
+  cmd.AddValue ("mobilityTraceInterval", "Log at most one course change per node in this many seconds (0=all)", m_mobilityTraceInterval);
+  cmd.AddValue ("mobilityTraceRing", "Keep only the last N course changes, written to the log at the end (0=write all)", m_mobilityTraceRing);
   cmd.AddValue ("protocol", "1=OLSR;2=AODV;3=DSDV;4=DSR", m_protocol);
   cmd.AddValue ("lossModel", "1=Friis;2=ItuR1411Los;3=TwoRayGround;4=LogDistance", m_lossModel);
   cmd.AddValue ("phyMode", "Wifi Phy mode", m_phyMode);
@@ -538,8 +1891,44 @@ VanetRoutingExperiment::CommandSetup (int argc, char **argv)
   cmd.AddValue ("ascii_trace", "Dump ASCII Trace data", m_ascii_trace);
   cmd.AddValue ("pcap", "Create PCAP files for all nodes", m_pcap);
   cmd.AddValue ("buildings", "Load building (obstacles)", m_loadBuildings);
+  cmd.AddValue ("buildingsFile", "SUMO polygon file of the buildings, instead of the scenario's", m_buildingsFile);
+  cmd.AddValue ("mobilityWindow", "Schedule trace movements this many seconds ahead (0=all at start)", m_mobilityWindow);
+  cmd.AddValue ("waypointTable", "Play the trace back from per-node waypoint tables, without mobility events (0=no;1=yes)", m_waypointTable);
+  cmd.AddValue ("traceStart", "Trace time played at simulation time 0, when traceStop is set", m_traceStart);
+  cmd.AddValue ("traceStop", "Trace time after which the trace is ignored (0=whole trace)", m_traceStop);
+  cmd.AddValue ("traceArea", "Only the nodes entering this area of the trace, e.g. \"0,1000,0,1000\" for xMin,xMax,yMin,yMax", m_traceArea);
+  cmd.AddValue ("traceNodes", "Only these node ids of the trace, e.g. \"0,4,7\"", m_traceNodes);
+  cmd.AddValue ("partitionsX", "Split the trace area into this many columns, each run in its own process", m_partitionsX);
+  cmd.AddValue ("partitionsY", "Split the trace area into this many rows, each run in its own process", m_partitionsY);
+  cmd.AddValue ("partitionHalo", "Margin around each partition whose vehicles are simulated too, in m (0=line-of-sight carrier sense range, lossModel=2 only)", m_partitionHalo);
+  cmd.AddValue ("partitionJobs", "Partitions run at a time (0=one per processor)", m_partitionJobs);
+  cmd.AddValue ("partitionCsv", "BSM counts of each partition and their total", m_partitionCsvFile);
+  cmd.AddValue ("partitionCore", "Only count the BSMs sent from this area, xMin,xMax,yMin,yMax (set for each partition)", m_partitionCore);
+  cmd.AddValue ("binaryTrace", "Load the trace file from its binary form (<traceFile>.bin, created if missing)", m_binaryTrace);
+  cmd.AddValue ("csvBinary", "Write the per-second statistics as native doubles to <CSVfileName>.bin", m_csvBinary);
+  cmd.AddValue ("bsmStats", "Write BSM PDR per distance bin and per node to <tr_name>.bsm.csv (0=no;1=yes)", m_bsmStatsFile);
+  cmd.AddValue ("bsmStatsBin", "Distance bin width of the BSM statistics, m", m_bsmStatsBinWidth);
+  cmd.AddValue ("lossStats", "Print ItuR1411Los loss statistics at the end (0=no;1=yes)", m_lossStats);
+  cmd.AddValue ("hybridCore", "With lossModel=2, distance in m beyond which frame delivery is drawn "
+                "from a table calibrated on the full loss model (0=full model everywhere)", m_hybridCoreRadius);
+  cmd.AddValue ("linkCache", "With lossModel=2 and buildings, number of slots remembering the unobstructed "
+                "links until their nodes move (0=test every link)", m_linkCacheSize);
+  cmd.AddValue ("sweep", "Run every combination of parameter values, e.g. \"protocol=1,2;txp=7.5,20\"", m_sweep);
+  cmd.AddValue ("jobs", "Number of sweep runs in parallel (0=one per processor)", m_sweepJobs);
+  cmd.AddValue ("sweepCsv", "File merging the final statistics of all sweep runs", m_sweepCsvFile);
+  cmd.AddValue ("outputSuffix", "Suffix added to all output file names", m_outputSuffix);
+  cmd.AddValue ("forkVariants", "Set up nodes, mobility and devices once, then fork a process for each "
+                "combination of these routing stage values, e.g. \"protocol=1,2,3,4;bsm=200,400\"; "
+                "not RngRun nor RngSeed", m_forkVariants);
+  cmd.AddValue ("checkpointTime", "If greater than 0, simulation time in s at which the forkVariants "
+                "are forked, after a shared warmup; they can then only vary totaltime", m_checkpointTime);
+  cmd.AddValue ("benchmark", "Time the benchmark scenarios and micro-benchmarks (0=no;1=yes)", m_benchmark);
+  cmd.AddValue ("benchmarkScenarios", "Scenarios timed by the benchmark, e.g. \"1,2,3,4,5\"", m_benchmarkScenarios);
+  cmd.AddValue ("benchmarkCsv", "File the benchmark results are written to", m_benchmarkCsvFile);
+  cmd.AddValue ("benchmarkOps", "Number of operations timed by each micro-benchmark", m_benchmarkOps);
   cmd.Parse (argc, argv);
 
+  VanetRoutingExperiment::m_txSafetyRange = txDist;
   VanetRoutingExperiment::m_txSafetyRangeSq = txDist * txDist;
 }
 
@@ -547,6 +1936,9 @@ void
 VanetRoutingExperiment::SetupLogFile () 
 {
   // open log file for output
+  // the course change log is written in large blocks
+  m_osBuffer.resize (1 << 20);
+  m_os.rdbuf ()->pubsetbuf (&m_osBuffer[0], m_osBuffer.size ());
   m_os.open (m_logFile.c_str ());
 }
 
@@ -567,10 +1959,22 @@ VanetRoutingExperiment::ConfigureDefaults ()
  
   //Set Non-unicastMode rate to unicast mode
   Config::SetDefault ("ns3::WifiRemoteStationManager::NonUnicastMode",StringValue (m_phyMode_b));
+}
 
-  // Configure callback for logging
-  Config::Connect ("/NodeList/*/$ns3::MobilityModel/CourseChange",
-                   MakeBoundCallback (&CourseChange, &m_os));
+void
+VanetRoutingExperiment::SetupMobilityTracing ()
+{
+  if (!m_traceMobility)
+    {
+      return;
+    }
+
+  // log course changes, now that the nodes exist
+  m_mobilityTracer.Setup (m_adhocTxNodes, &m_os, m_mobilityTraceEvery,
+                          Seconds (m_mobilityTraceInterval), m_mobilityTraceRing);
+
+  AsciiTraceHelper ascii;
+  MobilityHelper::EnableAsciiAll (ascii.CreateFileStream (m_tr_name + ".mob"));
 }
 
 void
@@ -578,8 +1982,62 @@ VanetRoutingExperiment::SetupAdhocMobilityNodes ()
 {
   if (m_mobility == 1)
     {
+    std::string traceFile = m_traceFile;
+    if (m_binaryTrace != 0)
+      {
+        // the binary trace is converted once and then shared
+        // by all runs using the same trace file
+        traceFile = m_traceFile + ".bin";
+        std::ifstream binaryFile (traceFile.c_str ());
+        if (!binaryFile.is_open () && !Ns2MobilityHelper::ConvertToBinary (m_traceFile, traceFile))
+          {
+            NS_FATAL_ERROR ("Could not convert trace file " << m_traceFile);
+          }
+      }
+
     // Create Ns2MobilityHelper with the specified trace log file as parameter
-    Ns2MobilityHelper ns2 = Ns2MobilityHelper (m_traceFile);
+    Ns2MobilityHelper ns2 = Ns2MobilityHelper (traceFile);
+    ns2.SetScheduleWindow (Seconds (m_mobilityWindow));
+    if (m_waypointTable != 0)
+      {
+        // the BSM applications and the neighbor grid rely on course
+        // changes being notified on time
+        Config::SetDefault ("ns3::WaypointTableMobilityModel::CourseChangeEvents", BooleanValue (true));
+        ns2.SetWaypointTable (true);
+      }
+    if (m_traceStop > 0)
+      {
+        ns2.SetTimeWindow (Seconds (m_traceStart), Seconds (m_traceStop));
+      }
+    if (!m_traceArea.empty ())
+      {
+        Rectangle area;
+        if (!ParseRectangle (m_traceArea, area))
+          {
+            NS_FATAL_ERROR ("traceArea must be xMin,xMax,yMin,yMax: " << m_traceArea);
+          }
+        ns2.SetArea (area);
+      }
+    if (!m_traceNodes.empty ())
+      {
+        std::vector<uint32_t> ids;
+        std::istringstream list (m_traceNodes);
+        std::string value;
+        while (std::getline (list, value, ','))
+          {
+            if (!value.empty ())
+              {
+                ids.push_back (std::atoi (value.c_str ()));
+              }
+          }
+        ns2.SetNodeFilter (ids);
+      }
+    if (m_traceStop > 0 || !m_traceArea.empty () || !m_traceNodes.empty ())
+      {
+        // only the nodes selected are created, numbered densely
+        m_nNodes = ns2.GetNNodes ();
+        NS_LOG_UNCOND ("Selected " << m_nNodes << " nodes of trace " << traceFile);
+      }
 
     VanetRoutingExperiment::m_adhocTxNodes.Create (m_nNodes);
 
@@ -652,10 +2110,46 @@ VanetRoutingExperiment::SetupAdhocDevices ()
   // Setup propagation models 
   YansWifiChannelHelper wifiChannel;
   wifiChannel.SetPropagationDelay ("ns3::ConstantSpeedPropagationDelayModel");
-  wifiChannel.AddPropagationLoss (m_lossModelName, "Frequency", DoubleValue (freq));
+  if (m_lossModel != 2)
+    {
+      wifiChannel.AddPropagationLoss (m_lossModelName, "Frequency", DoubleValue (freq));
+    }
+  Ptr<YansWifiChannel> channel = wifiChannel.Create ();
+  if (m_lossModel == 2)
+    {
+      // created here rather than by the helper to read its statistics
+      // at the end.  It skips the obstacle loss towards the vehicles
+      // that could neither receive nor sense the signal even in line of
+      // sight: -96 dBm is the default YansWifiPhy EnergyDetectionThreshold
+      // and -99 dBm its CcaMode1Threshold
+      m_ituLossModel = CreateObject<ItuR1411LosPropagationLossModel> ();
+      m_ituLossModel->SetAttribute ("Frequency", DoubleValue (freq));
+      m_ituLossModel->SetAttribute ("RxSensitivity", DoubleValue (-96.0));
+      m_ituLossModel->SetAttribute ("CcaThreshold", DoubleValue (-99.0));
+      m_ituLossModel->SetAttribute ("EnableStatistics", BooleanValue (m_lossStats != 0));
+      m_ituLossModel->SetAttribute ("HybridCoreRadius", DoubleValue (m_hybridCoreRadius));
+      m_ituLossModel->SetAttribute ("LinkCacheSize", UintegerValue (m_linkCacheSize));
+      if (m_loadBuildings != 0 && !m_buildingsFile.empty ())
+        {
+          // indexed once: every link is then tested against the few
+          // buildings along it
+          if (!LoadBuildings (m_buildingsFile, m_obstacles))
+            {
+              NS_FATAL_ERROR ("Could not read buildings file " << m_buildingsFile);
+            }
+          m_obstacles.Build ();
+          m_ituLossModel->SetObstacleIndex (&m_obstacles);
+          NS_LOG_UNCOND ("Loaded " << m_obstacles.GetNObstacles () << " buildings from " << m_buildingsFile);
+        }
+      channel->SetPropagationLossModel (m_ituLossModel);
+    }
+  else if (m_loadBuildings != 0)
+    {
+      NS_LOG_UNCOND ("Buildings are only used by lossModel=2, ignoring them");
+    }
   // The below set of helpers will help us to put together the wifi NICs we want
   YansWifiPhyHelper wifiPhy =  YansWifiPhyHelper::Default ();
-  wifiPhy.SetChannel (wifiChannel.Create ());
+  wifiPhy.SetChannel (channel);
   // ns-3 supports generate a pcap trace
   wifiPhy.SetPcapDataLinkType (YansWifiPhyHelper::DLT_IEEE802_11);
 
@@ -781,6 +2275,16 @@ VanetRoutingExperiment::AssignIpAddresses ()
   Ipv4AddressHelper addressAdhoc;
   addressAdhoc.SetBase ("10.1.0.0", "255.255.0.0");
   m_adhocTxInterfaces = addressAdhoc.Assign (m_adhocTxDevices);
+
+  // addresses are allocated consecutively, so the node sending
+  // a packet is found directly from its source address
+  m_adhocTxFirstAddress = m_adhocTxInterfaces.GetAddress (0).Get ();
+  m_adhocTxAddressNodes.clear ();
+  for (uint32_t i = 0; i < m_adhocTxInterfaces.GetN (); i++)
+    {
+      NS_ASSERT (m_adhocTxInterfaces.GetAddress (i).Get () == m_adhocTxFirstAddress + i);
+      m_adhocTxAddressNodes.push_back (m_adhocTxInterfaces.Get (i).first->GetObject<Node> ());
+    }
 }
 
 void
@@ -798,6 +2302,23 @@ VanetRoutingExperiment::SetupWaveMessages ()
   // total WAVE packets needing to be sent
   m_numWavePackets = (uint32_t) (totalTxTime / m_waveInterval);
 
+  m_bsmStats.Setup (m_nNodes, VanetRoutingExperiment::m_txSafetyRange, m_bsmStatsBinWidth);
+  m_bsmPackets.Setup (m_wavePacketSize);
+  if (!m_partitionCore.empty ())
+    {
+      Rectangle core;
+      if (!ParseRectangle (m_partitionCore, core))
+        {
+          NS_FATAL_ERROR ("partitionCore must be xMin,xMax,yMin,yMax: " << m_partitionCore);
+        }
+      m_bsmStats.SetArea (core);
+    }
+
+  // index node positions for counting the expected receivers of each BSM
+  m_mobilitySnapshot.Setup (VanetRoutingExperiment::m_adhocTxNodes);
+  m_neighborGrid.Setup (VanetRoutingExperiment::m_adhocTxNodes, &m_mobilitySnapshot,
+                        VanetRoutingExperiment::m_txSafetyRange, waveInterPacketInterval);
+
   // first node received WAVE BSM from all others
   TypeId tid = TypeId::LookupByName ("ns3::UdpSocketFactory");
 
@@ -817,11 +2338,15 @@ VanetRoutingExperiment::SetupWaveMessages ()
     UniformVariable n(1, m_gpsAccuracyNs);   
     int t=n.GetValue();       
 
-    Time time = Seconds(startTime + (double) t / 1000000.0);
+    // gpsaccurcy is in ns, as for the jitter of every later period
+    Time time = Seconds (startTime) + NanoSeconds (t);
 
-    Simulator::ScheduleWithContext (recvSink->GetNode ()->GetId (),
-                                    time, &GenerateWaveTraffic,
-                                    recvSink, m_wavePacketSize, m_numWavePackets, waveInterPacketInterval);
+    Ptr<BsmApplication> bsm = CreateObject<BsmApplication> ();
+    bsm->Setup (recvSink, m_numWavePackets, waveInterPacketInterval,
+                NanoSeconds (m_gpsAccuracyNs), &m_bsmStats, &m_bsmPackets,
+                &m_mobilitySnapshot, &m_neighborGrid);
+    bsm->SetStartTime (time);
+    VanetRoutingExperiment::m_adhocTxNodes.Get (i)->AddApplication (bsm);
     }
 }
 
@@ -879,10 +2404,9 @@ VanetRoutingExperiment::SetupScenario()
       {
         m_TotalTime = 10.0;
       }
-    if (m_loadBuildings != 0) 
+    if (m_loadBuildings != 0 && m_buildingsFile.empty ())
       {
-        std::string bldgFile = "scratch/highway.buildings.xml";
-        // future Topology::LoadBuildings(bldgFile);
+        m_buildingsFile = "scratch/highway.buildings.xml";
       }
     }
   else if (m_scenario == 2) 
@@ -941,11 +2465,11 @@ VanetRoutingExperiment::SetupScenario()
     m_CSVfileName = "centennial2_2.csv";
     // WAVE BSM only
     m_protocol = 0;
+    m_txSafetyRange = 145.0;
     m_txSafetyRangeSq = 145.0 * 145.0;
-    if (m_loadBuildings != 0) 
+    if (m_loadBuildings != 0 && m_buildingsFile.empty ())
       {
-        std::string bldgFile = "scratch/centennial1.buildings.xml";
-        // future:  Topology::LoadBuildings(bldgFile);
+        m_buildingsFile = "scratch/centennial1.buildings.xml";
       }
     }
   if (m_txp == 7.5)
@@ -957,21 +2481,39 @@ VanetRoutingExperiment::SetupScenario()
 void
 VanetRoutingExperiment::Run ()
 {
-  WriteCsvHeader();
+  if (m_outputSuffix.empty ())
+    {
+      WriteCsvHeader();
+    }
   SetupScenario();
+  if (!m_outputSuffix.empty ())
+    {
+      SetupOutputNames ();
+      WriteCsvHeader ();
+    }
   SetupLogFile ();
   SetupLogging ();
   ConfigureDefaults ();
+
+  SystemWallClockMs phaseClock;
+  phaseClock.Start ();
   SetupAdhocMobilityNodes ();
+  m_loadSeconds = phaseClock.End () / 1000.0;
+
+  phaseClock.Start ();
+  SetupMobilityTracing ();
   SetupAdhocDevices();
+  if (!m_forkVariants.empty () && m_checkpointTime <= 0 && !ForkVariants ())
+    {
+      Simulator::Destroy ();
+      m_os.close ();
+      return;
+    }
   SetupRouting ();
   AssignIpAddresses ();
   SetupWaveMessages ();
   SetupRoutingMessages ();
 
-  AsciiTraceHelper ascii;
-  MobilityHelper::EnableAsciiAll (ascii.CreateFileStream (m_tr_name + ".mob"));
-
   // Enable flowmon capture
   Ptr<FlowMonitor> flowmon;
   Ptr<FlowMonitor> monitor;
@@ -982,13 +2524,33 @@ VanetRoutingExperiment::Run ()
     monitor = flowmon; //.GetMonitor();
     //monitor->CheckForLostPackets();
     }
+  m_installSeconds = phaseClock.End () / 1000.0;
 
   NS_LOG_INFO ("Run Simulation.");
 
   CheckThroughput ();
 
-  Simulator::Stop (Seconds (m_TotalTime));
+  phaseClock.Start ();
+  if (!m_forkVariants.empty () && m_checkpointTime > 0)
+    {
+      if (m_checkpointTime >= m_TotalTime)
+        {
+          NS_FATAL_ERROR ("checkpointTime must be below totaltime");
+        }
+      Simulator::Stop (Seconds (m_checkpointTime));
+      Simulator::Run ();
+      if (!ForkVariants ())
+        {
+          Simulator::Destroy ();
+          m_os.close ();
+          return;
+        }
+      // the variant's own share of the run
+      phaseClock.Start ();
+    }
+  Simulator::Stop (Seconds (std::max (m_TotalTime - Simulator::Now ().GetSeconds (), 0.0)));
   Simulator::Run ();
+  m_runSeconds = phaseClock.End () / 1000.0;
 
   Time totalDelaySum;
   int totalRxPackets = 0;
@@ -1021,10 +2583,7 @@ VanetRoutingExperiment::Run ()
     }
 
   // calculate and output final results
-  double bsm_pdr = 0.0;
-  if (VanetRoutingExperiment::wavePktExpectedReceiveCount > 0) {
-    bsm_pdr = (double) VanetRoutingExperiment::wavePktInCoverageReceiveCount / (double) VanetRoutingExperiment::wavePktExpectedReceiveCount;
-    }
+  double bsm_pdr = m_bsmStats.GetPdr ();
 
   double meanDelay = 0.0;
   if (totalRxPackets > 0)
@@ -1079,9 +2638,27 @@ VanetRoutingExperiment::Run ()
 
   out.close ();
 
+  if (m_bsmStatsFile != 0)
+    {
+      std::ofstream bsmOut ((m_tr_name + ".bsm.csv").c_str ());
+      m_bsmStats.Write (bsmOut);
+    }
+
+  if (m_lossStats != 0 && m_ituLossModel != 0)
+    {
+      m_ituLossModel->PrintStatistics (std::cout);
+    }
+
+  if (PhaseProfiler::IsEnabled ())
+    {
+      std::ofstream profileOut ((m_tr_name + ".profile.csv").c_str ());
+      PhaseProfiler::WriteCsv (profileOut);
+    }
 
   Simulator::Destroy ();
 
+  m_csvWriter.Close ();
+  m_mobilityTracer.Dump ();
   m_os.close (); // close log file
 }
 
@@ -1118,11 +2695,910 @@ VanetRoutingExperiment::WriteCsvHeader ()
   out2.close ();
 }
 
+void
+VanetRoutingExperiment::SetupOutputNames ()
+{
+  m_CSVfileName = AddSuffix (m_CSVfileName, m_outputSuffix);
+  m_CSVfileName2 = AddSuffix (m_CSVfileName2, m_outputSuffix);
+  if (!m_logFile.empty ())
+    {
+      m_logFile = AddSuffix (m_logFile, m_outputSuffix);
+    }
+  m_tr_name = m_tr_name + m_outputSuffix;
+}
+
+std::string
+VanetRoutingExperiment::AddSuffix (const std::string &fileName, const std::string &suffix)
+{
+  // before the extension, if any
+  std::string::size_type dot = fileName.rfind ('.');
+  std::string::size_type slash = fileName.rfind ('/');
+  if (dot == std::string::npos || (slash != std::string::npos && dot < slash))
+    {
+      return fileName + suffix;
+    }
+  return fileName.substr (0, dot) + suffix + fileName.substr (dot);
+}
+
+bool
+VanetRoutingExperiment::IsSweep () const
+{
+  return !m_sweep.empty ();
+}
+
+bool
+VanetRoutingExperiment::ParseSweep (const std::string &sweep,
+                                    std::vector<std::string> &names,
+                                    std::vector<std::vector<std::string> > &values)
+{
+  // name=v1,v2,...;name=v1,...
+  std::istringstream params (sweep);
+  std::string param;
+  while (std::getline (params, param, ';'))
+    {
+      if (param.empty ())
+        {
+          continue;
+        }
+      std::string::size_type eq = param.find ('=');
+      if (eq == std::string::npos || eq == 0)
+        {
+          return false;
+        }
+      names.push_back (param.substr (0, eq));
+      values.push_back (std::vector<std::string> ());
+      std::istringstream list (param.substr (eq + 1));
+      std::string value;
+      while (std::getline (list, value, ','))
+        {
+          values.back ().push_back (value);
+        }
+      if (values.back ().empty ())
+        {
+          return false;
+        }
+    }
+  return !names.empty ();
+}
+
+void
+VanetRoutingExperiment::GetCombinations (const std::vector<std::vector<std::string> > &values,
+                                         std::vector<std::vector<std::string> > &combinations)
+{
+  // the last parameter varies fastest
+  uint32_t n = 1;
+  for (uint32_t i = 0; i < values.size (); i++)
+    {
+      n *= values[i].size ();
+    }
+  combinations.assign (n, std::vector<std::string> (values.size ()));
+  for (uint32_t c = 0; c < n; c++)
+    {
+      uint32_t k = c;
+      for (uint32_t i = values.size (); i-- > 0; )
+        {
+          combinations[c][i] = values[i][k % values[i].size ()];
+          k /= values[i].size ();
+        }
+    }
+}
+
+int32_t
+VanetRoutingExperiment::ForkChildren (uint32_t n, uint32_t jobs, std::vector<bool> &succeeded)
+{
+  if (jobs == 0)
+    {
+      long nCpus = sysconf (_SC_NPROCESSORS_ONLN);
+      jobs = (nCpus > 0) ? nCpus : 1;
+    }
+  std::map<pid_t, uint32_t> running;
+  succeeded.assign (n, false);
+  uint32_t next = 0;
+  while (next < n || !running.empty ())
+    {
+      if (next < n && running.size () < jobs)
+        {
+          // nothing buffered may be written twice
+          std::cout.flush ();
+          m_os.flush ();
+          m_csvWriter.Flush ();
+          pid_t pid = fork ();
+          if (pid < 0)
+            {
+              NS_FATAL_ERROR ("Could not fork child " << next);
+            }
+          if (pid == 0)
+            {
+              return next;
+            }
+          running[pid] = next++;
+          continue;
+        }
+
+      int status;
+      pid_t pid = wait (&status);
+      if (pid < 0)
+        {
+          break;
+        }
+      std::map<pid_t, uint32_t>::iterator it = running.find (pid);
+      if (it == running.end ())
+        {
+          continue;
+        }
+      succeeded[it->second] = WIFEXITED (status) && WEXITSTATUS (status) == 0;
+      if (!succeeded[it->second])
+        {
+          NS_LOG_UNCOND ("Child " << it->second << " failed");
+        }
+      running.erase (it);
+    }
+  return -1;
+}
+
+int
+VanetRoutingExperiment::RunSweep (int argc, char **argv)
+{
+  std::vector<std::string> names;
+  std::vector<std::vector<std::string> > values;
+  if (!ParseSweep (m_sweep, names, values))
+    {
+      NS_LOG_UNCOND ("Invalid sweep \"" << m_sweep << "\"");
+      return 1;
+    }
+  std::vector<std::vector<std::string> > runValues;
+  GetCombinations (values, runValues);
+  uint32_t nRuns = runValues.size ();
+  NS_LOG_UNCOND ("Sweep of " << nRuns << " runs");
+
+  std::vector<bool> succeeded;
+  int32_t run = ForkChildren (nRuns, m_sweepJobs, succeeded);
+  if (run >= 0)
+    {
+      // same command line, then this run's values, which win
+      std::vector<std::string> args (argv, argv + argc);
+      for (uint32_t i = 0; i < names.size (); i++)
+        {
+          args.push_back ("--" + names[i] + "=" + runValues[run][i]);
+        }
+      std::ostringstream suffix;
+      suffix << "-run" << run;
+      args.push_back ("--outputSuffix=" + suffix.str ());
+      std::vector<char *> cargs;
+      for (uint32_t i = 0; i < args.size (); i++)
+        {
+          cargs.push_back (const_cast<char *> (args[i].c_str ()));
+        }
+      cargs.push_back (0);
+
+      VanetRoutingExperiment experiment;
+      experiment.CommandSetup (args.size (), &cargs[0]);
+      // the run itself is not a sweep; CommandLine does not take an
+      // empty value, so the parent's --sweep is cleared here instead
+      experiment.m_sweep = "";
+      experiment.Run ();
+      std::ostringstream result;
+      result << m_sweepCsvFile << ".run" << run;
+      int ret = std::rename (experiment.m_CSVfileName2.c_str (), result.str ().c_str ());
+      std::exit (ret == 0 ? 0 : 1);
+    }
+
+  // merge the final statistics: parameters, then the run's own columns
+  std::ofstream out (m_sweepCsvFile.c_str ());
+  bool headerDone = false;
+  int ret = 0;
+  for (uint32_t run = 0; run < nRuns; run++)
+    {
+      if (!succeeded[run])
+        {
+          ret = 1;
+          continue;
+        }
+      std::ostringstream result;
+      result << m_sweepCsvFile << ".run" << run;
+      std::ifstream in (result.str ().c_str ());
+      std::string line;
+      if (std::getline (in, line) && !headerDone)
+        {
+          out << "Run";
+          for (uint32_t i = 0; i < names.size (); i++)
+            {
+              out << "," << names[i];
+            }
+          out << "," << line << "\n";
+          headerDone = true;
+        }
+      while (std::getline (in, line))
+        {
+          out << run;
+          for (uint32_t i = 0; i < names.size (); i++)
+            {
+              out << "," << runValues[run][i];
+            }
+          out << "," << line << "\n";
+        }
+      in.close ();
+      std::remove (result.str ().c_str ());
+    }
+  out.close ();
+  return ret;
+}
+
+bool
+VanetRoutingExperiment::ForkVariants ()
+{
+  std::vector<std::string> names;
+  std::vector<std::vector<std::string> > values;
+  if (!ParseSweep (m_forkVariants, names, values))
+    {
+      NS_FATAL_ERROR ("Invalid forkVariants \"" << m_forkVariants << "\"");
+    }
+  for (uint32_t i = 0; i < names.size (); i++)
+    {
+      // setting them in the child would not re-seed the streams the
+      // setup already drew from
+      if (names[i] == "RngRun" || names[i] == "RngSeed")
+        {
+          NS_FATAL_ERROR ("forkVariants cannot vary " << names[i] << ", use --sweep instead");
+        }
+      if (m_checkpointTime <= 0)
+        {
+          continue;
+        }
+      // after the warmup, the whole scenario, applications included, is
+      // set up and scheduled: only the end of the run can still change,
+      // and not past the stop times the applications were given
+      if (names[i] != "totaltime")
+        {
+          NS_FATAL_ERROR ("With checkpointTime, forkVariants can only vary totaltime, not " << names[i]);
+        }
+      for (uint32_t j = 0; j < values[i].size (); j++)
+        {
+          double totalTime = std::strtod (values[i][j].c_str (), 0);
+          if (totalTime <= m_checkpointTime || totalTime > m_TotalTime)
+            {
+              NS_FATAL_ERROR ("With checkpointTime, the totaltime variants must be between "
+                              "checkpointTime and totaltime: " << values[i][j]);
+            }
+        }
+    }
+  std::vector<std::vector<std::string> > variantValues;
+  GetCombinations (values, variantValues);
+  if (m_checkpointTime > 0)
+    {
+      NS_LOG_UNCOND ("Forking " << variantValues.size () << " variants at "
+                                << Simulator::Now ().GetSeconds () << " s");
+    }
+  else
+    {
+      NS_LOG_UNCOND ("Forking " << variantValues.size () << " variants after setup");
+    }
+
+  std::string csvFileName = m_CSVfileName;
+  std::string csvFileName2 = m_CSVfileName2;
+  std::string logFile = m_logFile;
+  std::vector<bool> succeeded;
+  int32_t variant = ForkChildren (variantValues.size (), m_sweepJobs, succeeded);
+  if (variant >= 0)
+    {
+      // only this variant's values: everything else already took
+      // effect during the setup shared with the parent
+      std::vector<std::string> args (1, "vanet-routing-compare");
+      for (uint32_t i = 0; i < names.size (); i++)
+        {
+          args.push_back ("--" + names[i] + "=" + variantValues[variant][i]);
+        }
+      std::vector<char *> cargs;
+      for (uint32_t i = 0; i < args.size (); i++)
+        {
+          cargs.push_back (const_cast<char *> (args[i].c_str ()));
+        }
+      cargs.push_back (0);
+      CommandSetup (args.size (), &cargs[0]);
+
+      std::ostringstream suffix;
+      suffix << "-v" << variant;
+      m_forkVariants = "";
+      m_outputSuffix = suffix.str ();
+      SetupOutputNames ();
+      WriteCsvHeader ();
+      if (m_csvWriter.IsOpen ())
+        {
+          // the rows of the warmup are the parent's, flushed before the
+          // fork: continue from a copy of them
+          m_csvWriter.Close ();
+          std::string extension = (m_csvBinary != 0) ? ".bin" : "";
+          CopyFile (csvFileName + extension, m_CSVfileName + extension);
+        }
+      if (!logFile.empty ())
+        {
+          // the setup part of the log is the parent's, continue from a copy of it
+          m_os.close ();
+          CopyFile (logFile, m_logFile);
+          m_os.open (m_logFile.c_str (), std::ios::app);
+        }
+      return true;
+    }
+
+  // the parent keeps the final statistics of all the variants, in order
+  std::ofstream out (csvFileName2.c_str (), std::ios::app);
+  for (uint32_t v = 0; v < variantValues.size (); v++)
+    {
+      if (!succeeded[v])
+        {
+          continue;
+        }
+      std::ostringstream name;
+      name << "-v" << v;
+      std::ifstream in (AddSuffix (csvFileName2, name.str ()).c_str ());
+      std::string line;
+      std::getline (in, line); // header
+      while (std::getline (in, line))
+        {
+          out << line << "\n";
+        }
+    }
+  return false;
+}
+
+void
+VanetRoutingExperiment::CopyFile (const std::string &from, const std::string &to)
+{
+  std::ifstream in (from.c_str (), std::ios::binary);
+  std::ofstream out (to.c_str (), std::ios::binary);
+  out << in.rdbuf ();
+}
+
+bool
+VanetRoutingExperiment::IsBenchmark () const
+{
+  return m_benchmark != 0;
+}
+
+void
+VanetRoutingExperiment::WriteBenchmark (std::ostream &os, const std::string &benchmark,
+                                        const std::string &name, const std::string &metric, double value)
+{
+  // event counts and RSS must not be rounded
+  os.precision (15);
+  os << benchmark << "," << name << "," << metric << "," << value << "\n";
+}
+
+int
+VanetRoutingExperiment::RunBenchmark (int argc, char **argv)
+{
+  static const char *scenarioNames[] = { "", "rwp-highway", "low99", "med210", "high370", "centennial" };
+  std::vector<uint32_t> scenarios;
+  std::istringstream list (m_benchmarkScenarios);
+  std::string value;
+  while (std::getline (list, value, ','))
+    {
+      if (!value.empty ())
+        {
+          scenarios.push_back (std::atoi (value.c_str ()));
+        }
+    }
+  std::vector<std::string> names;
+  for (uint32_t i = 0; i < scenarios.size (); i++)
+    {
+      std::ostringstream name;
+      if (scenarios[i] >= 1 && scenarios[i] <= 5)
+        {
+          name << scenarioNames[scenarios[i]];
+        }
+      else
+        {
+          name << "scenario" << scenarios[i];
+        }
+      names.push_back (name.str ());
+    }
+
+  // one scenario at a time, so that they do not compete for the
+  // processors and the memory bandwidth
+  std::vector<bool> succeeded;
+  int32_t run = ForkChildren (scenarios.size (), 1, succeeded);
+  if (run >= 0)
+    {
+      // same command line, then the scenario and fixed seeds, which win
+      std::vector<std::string> args (argv, argv + argc);
+      std::ostringstream scenario;
+      scenario << "--scenario=" << scenarios[run];
+      std::ostringstream suffix;
+      suffix << "--outputSuffix=-bench" << run;
+      args.push_back ("--benchmark=0");
+      args.push_back (scenario.str ());
+      args.push_back ("--RngSeed=1");
+      args.push_back ("--RngRun=1");
+      args.push_back (suffix.str ());
+      std::vector<char *> cargs;
+      for (uint32_t i = 0; i < args.size (); i++)
+        {
+          cargs.push_back (const_cast<char *> (args[i].c_str ()));
+        }
+      cargs.push_back (0);
+
+      ObjectFactory scheduler;
+      scheduler.SetTypeId (CountingScheduler::GetTypeId ());
+      Simulator::SetScheduler (scheduler);
+
+      VanetRoutingExperiment experiment;
+      experiment.CommandSetup (args.size (), &cargs[0]);
+      // one plain run of the scenario: CommandLine does not take an empty
+      // value, so the parent's --sweep and --forkVariants are cleared here
+      experiment.m_sweep = "";
+      experiment.m_forkVariants = "";
+      experiment.Run ();
+
+      struct rusage usage;
+      getrusage (RUSAGE_SELF, &usage);
+      uint64_t nEvents = CountingScheduler::GetNEvents ();
+      std::ostringstream result;
+      result << m_benchmarkCsvFile << ".run" << run;
+      std::ofstream out (result.str ().c_str ());
+      const std::string &name = names[run];
+      WriteBenchmark (out, "Scenario", name, "Nodes", experiment.m_nNodes);
+      WriteBenchmark (out, "Scenario", name, "SimulatedSeconds", experiment.m_TotalTime);
+      WriteBenchmark (out, "Scenario", name, "LoadSeconds", experiment.m_loadSeconds);
+      WriteBenchmark (out, "Scenario", name, "InstallSeconds", experiment.m_installSeconds);
+      WriteBenchmark (out, "Scenario", name, "RunSeconds", experiment.m_runSeconds);
+      WriteBenchmark (out, "Scenario", name, "Events", nEvents);
+      WriteBenchmark (out, "Scenario", name, "EventsPerSecond",
+                      experiment.m_runSeconds > 0.0 ? nEvents / experiment.m_runSeconds : 0.0);
+      WriteBenchmark (out, "Scenario", name, "PeakRssKiB", usage.ru_maxrss);
+      WriteBenchmark (out, "Scenario", name, "BsmPacketsCreated", experiment.m_bsmPackets.GetNCreated ());
+      WriteBenchmark (out, "Scenario", name, "BsmPacketsRecycled", experiment.m_bsmPackets.GetNRecycled ());
+      out.close ();
+      std::exit (out.fail () ? 1 : 0);
+    }
+
+  std::ofstream out (m_benchmarkCsvFile.c_str ());
+  out << "Benchmark,Case,Metric,Value\n";
+  int ret = 0;
+  for (uint32_t run = 0; run < scenarios.size (); run++)
+    {
+      if (!succeeded[run])
+        {
+          WriteBenchmark (out, "Scenario", names[run], "Failed", 1);
+          ret = 1;
+          continue;
+        }
+      std::ostringstream result;
+      result << m_benchmarkCsvFile << ".run" << run;
+      std::ifstream in (result.str ().c_str ());
+      out << in.rdbuf ();
+      in.close ();
+      std::remove (result.str ().c_str ());
+    }
+  RunMicroBenchmarks (out);
+  out.close ();
+  NS_LOG_UNCOND ("Benchmark results written to " << m_benchmarkCsvFile);
+  return ret;
+}
+
+bool
+VanetRoutingExperiment::ParseRectangle (const std::string &value, Rectangle &area)
+{
+  std::vector<double> bounds;
+  std::istringstream list (value);
+  std::string bound;
+  while (std::getline (list, bound, ','))
+    {
+      // strtod also reads inf and -inf
+      bounds.push_back (std::strtod (bound.c_str (), 0));
+    }
+  if (bounds.size () != 4)
+    {
+      return false;
+    }
+  area = Rectangle (bounds[0], bounds[1], bounds[2], bounds[3]);
+  return true;
+}
+
+bool
+VanetRoutingExperiment::LoadBuildings (const std::string &fileName, ObstacleIndex &obstacles)
+{
+  std::ifstream file (fileName.c_str ());
+  if (!file.is_open ())
+    {
+      return false;
+    }
+  std::string xml ((std::istreambuf_iterator<char> (file)), std::istreambuf_iterator<char> ());
+  for (size_t poly = xml.find ("<poly"); poly != std::string::npos; poly = xml.find ("<poly", poly + 1))
+    {
+      size_t end = xml.find ('>', poly);
+      size_t shape = xml.find (" shape=\"", poly);
+      if (end == std::string::npos || shape == std::string::npos || shape > end)
+        {
+          continue;
+        }
+      shape += 8;
+      // "x1,y1 x2,y2 ...", the first point usually repeated at the end
+      std::istringstream points (xml.substr (shape, xml.find ('"', shape) - shape));
+      std::vector<Vector> vertices;
+      std::string point;
+      while (points >> point)
+        {
+          size_t comma = point.find (',');
+          if (comma != std::string::npos)
+            {
+              vertices.push_back (Vector (std::strtod (point.c_str (), 0),
+                                          std::strtod (point.c_str () + comma + 1, 0), 0.0));
+            }
+        }
+      if (vertices.size () > 1 && vertices.front ().x == vertices.back ().x
+          && vertices.front ().y == vertices.back ().y)
+        {
+          vertices.pop_back ();
+        }
+      if (vertices.size () >= 3)
+        {
+          obstacles.AddObstacle (vertices);
+        }
+    }
+  return true;
+}
+
+bool
+VanetRoutingExperiment::IsPartitioned () const
+{
+  return m_partitionsX * m_partitionsY > 1;
+}
+
+int
+VanetRoutingExperiment::RunPartitions (int argc, char **argv)
+{
+  SetupScenario ();
+  if (m_mobility != 1)
+    {
+      NS_LOG_UNCOND ("Partitions need an ns-2 trace (mobility=1)");
+      return 1;
+    }
+
+  // The partitions are a grid over the area of the trace, whose outer
+  // cells extend to infinity.  Each one runs with the vehicles that come
+  // within the halo of it at some time, so that all the senders that can
+  // reach its own vehicles are simulated.  Vehicles moving across
+  // partitions are simulated in each of them, for the whole run, and
+  // their BSMs are counted by the partition they are sent from.
+  Ns2MobilityHelper ns2 (m_traceFile);
+  if (m_traceStop > 0)
+    {
+      ns2.SetTimeWindow (Seconds (m_traceStart), Seconds (m_traceStop));
+    }
+  Rectangle bounds = ns2.GetBounds ();
+  double halo = m_partitionHalo;
+  if (halo <= 0)
+    {
+      // the range at which a sender still reaches the -99 dBm default
+      // YansWifiPhy CcaMode1Threshold in line of sight: farther senders
+      // neither deliver nor defer the partition's own vehicles.  The
+      // obstacles only shorten it.  Only known for the ITU-R 1411 model
+      if (m_lossModel != 2)
+        {
+          NS_FATAL_ERROR ("--partitionHalo must be given unless --lossModel=2");
+        }
+      Ptr<ItuR1411LosPropagationLossModel> los = CreateObject<ItuR1411LosPropagationLossModel> ();
+      los->SetAttribute ("Frequency", DoubleValue (m_80211mode == 1 ? 5.9e9 : 2.4e9));
+      halo = los->GetMaxRange (m_txp, -99.0);
+    }
+  uint32_t nPartitions = m_partitionsX * m_partitionsY;
+  double width = (bounds.xMax - bounds.xMin) / m_partitionsX;
+  double height = (bounds.yMax - bounds.yMin) / m_partitionsY;
+  double inf = std::numeric_limits<double>::infinity ();
+  std::vector<Rectangle> cores;
+  for (uint32_t k = 0; k < nPartitions; k++)
+    {
+      uint32_t i = k % m_partitionsX;
+      uint32_t j = k / m_partitionsX;
+      cores.push_back (Rectangle (i == 0 ? -inf : bounds.xMin + i * width,
+                                  i + 1 == m_partitionsX ? inf : bounds.xMin + (i + 1) * width,
+                                  j == 0 ? -inf : bounds.yMin + j * height,
+                                  j + 1 == m_partitionsY ? inf : bounds.yMin + (j + 1) * height));
+    }
+  NS_LOG_UNCOND (nPartitions << " partitions of " << width << " m x " << height << " m, with a "
+                             << halo << " m halo");
+
+  std::vector<bool> succeeded;
+  int32_t part = ForkChildren (nPartitions, m_partitionJobs, succeeded);
+  if (part >= 0)
+    {
+      // same command line, then the partition, which wins
+      const Rectangle &core = cores[part];
+      std::ostringstream area;
+      area.precision (17);
+      area << "--traceArea=" << core.xMin - halo << "," << core.xMax + halo << ","
+           << core.yMin - halo << "," << core.yMax + halo;
+      std::ostringstream coreArea;
+      coreArea.precision (17);
+      coreArea << "--partitionCore=" << core.xMin << "," << core.xMax << "," << core.yMin << "," << core.yMax;
+      std::ostringstream suffix;
+      suffix << "--outputSuffix=-part" << part;
+      std::vector<std::string> args (argv, argv + argc);
+      args.push_back ("--partitionsX=1");
+      args.push_back ("--partitionsY=1");
+      args.push_back (area.str ());
+      args.push_back (coreArea.str ());
+      args.push_back (suffix.str ());
+      std::vector<char *> cargs;
+      for (uint32_t i = 0; i < args.size (); i++)
+        {
+          cargs.push_back (const_cast<char *> (args[i].c_str ()));
+        }
+      cargs.push_back (0);
+
+      VanetRoutingExperiment experiment;
+      experiment.CommandSetup (args.size (), &cargs[0]);
+      experiment.Run ();
+      std::ostringstream result;
+      result << m_partitionCsvFile << ".part" << part;
+      std::ofstream out (result.str ().c_str ());
+      out << experiment.m_nNodes << "," << experiment.m_bsmStats.GetSent () << ","
+          << experiment.m_bsmStats.GetExpected () << "," << experiment.m_bsmStats.GetInCoverage () << ","
+          << experiment.m_runSeconds << "\n";
+      out.close ();
+      std::exit (out ? 0 : 1);
+    }
+
+  // the BSMs are counted once, by their sender's partition, so that
+  // the counts add up; the slowest partition bounds the wall time
+  std::ofstream out (m_partitionCsvFile.c_str ());
+  out.precision (15);
+  out << "Partition,XMin,XMax,YMin,YMax,Nodes,Sent,Expected,InCoverage,BSM_PDR,RunSeconds\n";
+  uint64_t nodes = 0;
+  uint64_t sent = 0;
+  uint64_t expected = 0;
+  uint64_t inCoverage = 0;
+  double runSeconds = 0;
+  int ret = 0;
+  for (uint32_t k = 0; k < nPartitions; k++)
+    {
+      std::ostringstream result;
+      result << m_partitionCsvFile << ".part" << k;
+      std::ifstream in (result.str ().c_str ());
+      uint64_t partNodes, partSent, partExpected, partInCoverage;
+      double partSeconds;
+      char comma;
+      if (!succeeded[k]
+          || !(in >> partNodes >> comma >> partSent >> comma >> partExpected >> comma
+               >> partInCoverage >> comma >> partSeconds))
+        {
+          NS_LOG_UNCOND ("Partition " << k << " failed");
+          ret = 1;
+          continue;
+        }
+      in.close ();
+      std::remove (result.str ().c_str ());
+      double pdr = partExpected > 0 ? (double) partInCoverage / (double) partExpected : 0.0;
+      out << k << "," << cores[k].xMin << "," << cores[k].xMax << "," << cores[k].yMin << "," << cores[k].yMax
+          << "," << partNodes << "," << partSent << "," << partExpected << "," << partInCoverage
+          << "," << pdr << "," << partSeconds << "\n";
+      nodes += partNodes;
+      sent += partSent;
+      expected += partExpected;
+      inCoverage += partInCoverage;
+      runSeconds = std::max (runSeconds, partSeconds);
+    }
+  double pdr = expected > 0 ? (double) inCoverage / (double) expected : 0.0;
+  out << "All," << bounds.xMin << "," << bounds.xMax << "," << bounds.yMin << "," << bounds.yMax
+      << "," << nodes << "," << sent << "," << expected << "," << inCoverage << "," << pdr
+      << "," << runSeconds << "\n";
+  out.close ();
+  return ret;
+}
+
+void
+VanetRoutingExperiment::RunMicroBenchmarks (std::ostream &os)
+{
+  uint32_t nOps = std::max (m_benchmarkOps, (uint32_t) 1);
+  SystemWallClockMs clock;
+
+  // trace parsing, repeated until nOps statements are read
+  const char *traces[] = { "./scratch/low99-ct-unterstrass-1day.filt.7.adj.mov",
+                           "./scratch/med210-ct-unterstrass-1day.filt.0.adj.mov",
+                           "./scratch/high370-ct-unterstrass-1day.filt.9.adj.mov" };
+  for (uint32_t i = 0; i < sizeof (traces) / sizeof (traces[0]); i++)
+    {
+      std::ifstream trace (traces[i]);
+      if (!trace.is_open ())
+        {
+          continue;
+        }
+      trace.close ();
+      std::string name = traces[i];
+      name = name.substr (name.rfind ('/') + 1);
+      uint64_t nStatements = 0;
+      uint32_t nReads = 0;
+      clock.Start ();
+      while (nStatements < nOps)
+        {
+          int64_t n = Ns2MobilityHelper::CountStatements (traces[i]);
+          if (n <= 0)
+            {
+              break;
+            }
+          nStatements += n;
+          nReads++;
+        }
+      double ms = clock.End ();
+      WriteBenchmark (os, "ParseNs2Line", name, "Statements", nStatements);
+      WriteBenchmark (os, "ParseNs2Line", name, "Reads", nReads);
+      WriteBenchmark (os, "ParseNs2Line", name, "NsPerStatement", nStatements > 0 ? ms * 1e6 / nStatements : 0.0);
+    }
+
+  // nodes at fixed pseudo-random positions of the synthetic highway
+  uint32_t nNodes = 370;
+  NodeContainer nodes;
+  nodes.Create (nNodes);
+  Ptr<UniformRandomVariable> random = CreateObject<UniformRandomVariable> ();
+  random->SetStream (1);
+  Ptr<ListPositionAllocator> positions = CreateObject<ListPositionAllocator> ();
+  for (uint32_t i = 0; i < nNodes; i++)
+    {
+      double x = random->GetValue (0.0, 1500.0);
+      double y = random->GetValue (0.0, 300.0);
+      positions->Add (Vector (x, y, 1.5));
+    }
+  MobilityHelper mobility;
+  mobility.SetPositionAllocator (positions);
+  mobility.SetMobilityModel ("ns3::ConstantPositionMobilityModel");
+  mobility.Install (nodes);
+  std::vector<Ptr<MobilityModel> > models (nNodes);
+  std::vector<Vector> nodePos (nNodes);
+  for (uint32_t i = 0; i < nNodes; i++)
+    {
+      models[i] = nodes.Get (i)->GetObject<MobilityModel> ();
+      nodePos[i] = models[i]->GetPosition ();
+    }
+
+  // ITU-R 1411 loss between changing pairs, so that nothing is reused
+  Ptr<ItuR1411LosPropagationLossModel> loss = CreateObject<ItuR1411LosPropagationLossModel> ();
+  loss->SetAttribute ("Frequency", DoubleValue (5.9e9));
+  double sum = 0.0;
+  clock.Start ();
+  for (uint32_t i = 0; i < nOps; i++)
+    {
+      // an offset of 1 to nNodes - 1: a node is never paired with itself
+      uint32_t peer = (i + 1 + (i / nNodes) % (nNodes - 1)) % nNodes;
+      sum += loss->GetLoss (models[i % nNodes], models[peer]);
+    }
+  double ms = clock.End ();
+  WriteBenchmark (os, "GetLoss", "los", "NsPerCall", ms * 1e6 / nOps);
+  WriteBenchmark (os, "GetLoss", "los", "MeanLoss", sum / nOps);
+
+  // the same links through a block grid of 40 m x 30 m buildings
+  ObstacleIndex obstacles;
+  for (double x = 5.0; x + 40.0 < 1500.0; x += 50.0)
+    {
+      for (double y = 5.0; y + 30.0 < 300.0; y += 45.0)
+        {
+          std::vector<Vector> building;
+          building.push_back (Vector (x, y, 0.0));
+          building.push_back (Vector (x + 40.0, y, 0.0));
+          building.push_back (Vector (x + 40.0, y + 30.0, 0.0));
+          building.push_back (Vector (x, y + 30.0, 0.0));
+          obstacles.AddObstacle (building);
+        }
+    }
+  obstacles.Build ();
+  Ptr<ItuR1411LosPropagationLossModel> obstacleLoss = CreateObject<ItuR1411LosPropagationLossModel> ();
+  obstacleLoss->SetAttribute ("Frequency", DoubleValue (5.9e9));
+  obstacleLoss->SetAttribute ("EnableStatistics", BooleanValue (true));
+  obstacleLoss->SetObstacleIndex (&obstacles);
+  sum = 0.0;
+  clock.Start ();
+  for (uint32_t i = 0; i < nOps; i++)
+    {
+      uint32_t peer = (i + 1 + (i / nNodes) % (nNodes - 1)) % nNodes;
+      sum += obstacleLoss->GetLoss (models[i % nNodes], models[peer]);
+    }
+  ms = clock.End ();
+  WriteBenchmark (os, "GetLoss", "los+obstacles", "NsPerCall", ms * 1e6 / nOps);
+  WriteBenchmark (os, "GetLoss", "los+obstacles", "MeanLoss", sum / nOps);
+  WriteBenchmark (os, "GetLoss", "los+obstacles", "Obstacles", obstacles.GetNObstacles ());
+  WriteBenchmark (os, "GetLoss", "los+obstacles", "ObstructedFraction",
+                  (double) obstacleLoss->GetNObstructed () / nOps);
+
+  // received power of a broadcast from each node in turn to all the
+  // others, in one batch and one receiver at a time; the receivers below
+  // the -99 dBm CCA threshold in line of sight skip the obstacles either
+  // way
+  obstacleLoss->SetAttribute ("RxSensitivity", DoubleValue (-96.0));
+  obstacleLoss->SetAttribute ("CcaThreshold", DoubleValue (-99.0));
+  uint32_t nTx = std::max (nOps / nNodes, (uint32_t) 1);
+  std::vector<double> rxPowers;
+  sum = 0.0;
+  clock.Start ();
+  for (uint32_t t = 0; t < nTx; t++)
+    {
+      obstacleLoss->CalcRxPowers (20.0, nodePos[t % nNodes], nodePos, rxPowers, -99.0);
+      sum += rxPowers[(t + 1) % nNodes];
+    }
+  ms = clock.End ();
+  WriteBenchmark (os, "RxPowers", "CalcRxPowers", "NsPerReceiver", ms * 1e6 / ((double) nTx * nNodes));
+  WriteBenchmark (os, "RxPowers", "CalcRxPowers", "MeanRxPower", sum / nTx);
+  sum = 0.0;
+  clock.Start ();
+  for (uint32_t t = 0; t < nTx; t++)
+    {
+      for (uint32_t r = 0; r < nNodes; r++)
+        {
+          double rxPower = obstacleLoss->CalcRxPower (20.0, models[t % nNodes], models[r]);
+          if (r == (t + 1) % nNodes)
+            {
+              sum += rxPower;
+            }
+        }
+    }
+  ms = clock.End ();
+  WriteBenchmark (os, "RxPowers", "DoCalcRxPower", "NsPerReceiver", ms * 1e6 / ((double) nTx * nNodes));
+  WriteBenchmark (os, "RxPowers", "DoCalcRxPower", "MeanRxPower", sum / nTx);
+
+  // validity radius of the ItuR1411Los link cache for the same links:
+  // the distance a node can move before its link is tested again
+  double clearance = 0.0;
+  clock.Start ();
+  for (uint32_t i = 0; i < nOps; i++)
+    {
+      uint32_t peer = (i + 1 + (i / nNodes) % (nNodes - 1)) % nNodes;
+      clearance += obstacles.GetClearance (nodePos[i % nNodes], nodePos[peer], 50.0);
+    }
+  ms = clock.End ();
+  WriteBenchmark (os, "ObstacleIndex", "GetClearance", "NsPerCall", ms * 1e6 / nOps);
+  WriteBenchmark (os, "ObstacleIndex", "GetClearance", "MeanClearance", clearance / nOps);
+
+  // BSM receivers within range of each transmitter in turn, by
+  // exhaustive search and through the grid
+  MobilitySnapshot snapshot;
+  snapshot.Setup (nodes);
+  NeighborGrid grid;
+  grid.Setup (nodes, &snapshot, m_txSafetyRange, Seconds (m_waveInterval));
+  uint32_t nQueries = std::max (nOps / nNodes, (uint32_t) 1);
+  uint64_t nNeighbors = 0;
+  clock.Start ();
+  for (uint32_t q = 0; q < nQueries; q++)
+    {
+      uint32_t tx = q % nNodes;
+      for (uint32_t rx = 0; rx < nNodes; rx++)
+        {
+          nNeighbors += (rx != tx && snapshot.GetDistSq (tx, rx) <= m_txSafetyRangeSq);
+        }
+    }
+  ms = clock.End ();
+  WriteBenchmark (os, "NeighborCount", "GetDistSq", "NsPerQuery", ms * 1e6 / nQueries);
+  WriteBenchmark (os, "NeighborCount", "GetDistSq", "MeanNeighbors", (double) nNeighbors / nQueries);
+
+  std::vector<uint32_t> neighbors;
+  nNeighbors = 0;
+  clock.Start ();
+  for (uint32_t q = 0; q < nQueries; q++)
+    {
+      grid.GetNodesWithin (nodePos[q % nNodes], m_txSafetyRange, neighbors);
+      nNeighbors += neighbors.size () - 1;
+    }
+  ms = clock.End ();
+  WriteBenchmark (os, "NeighborCount", "NeighborGrid", "NsPerQuery", ms * 1e6 / nQueries);
+  WriteBenchmark (os, "NeighborCount", "NeighborGrid", "MeanNeighbors", (double) nNeighbors / nQueries);
+
+  Simulator::Destroy ();
+}
+
 int
 main (int argc, char *argv[])
 {
   VanetRoutingExperiment experiment;
   experiment.CommandSetup (argc,argv);
 
+  if (experiment.IsSweep ())
+    {
+      return experiment.RunSweep (argc, argv);
+    }
+  if (experiment.IsBenchmark ())
+    {
+      return experiment.RunBenchmark (argc, argv);
+    }
+  if (experiment.IsPartitioned ())
+    {
+      return experiment.RunPartitions (argc, argv);
+    }
   experiment.Run ();
 }
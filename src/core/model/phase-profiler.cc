@@ -0,0 +1,128 @@
+/* -*-  Mode: C++; c-file-style: "gnu"; indent-tabs-mode:nil; -*- */
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation;
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+#include "phase-profiler.h"
+#include <algorithm>
+#include <limits>
+#include <time.h>
+
+namespace ns3 {
+
+// Most durations kept per phase; then only every other one is kept
+#define PHASE_PROFILER_MAX_SAMPLES (1 << 16)
+
+std::vector<PhaseProfiler::Phase *> &
+PhaseProfiler::GetPhases (void)
+{
+  // never destroyed, so that phases outlive any static object timing
+  static std::vector<Phase *> *phases = new std::vector<Phase *> ();
+  return *phases;
+}
+
+PhaseProfiler::Phase *
+PhaseProfiler::GetPhase (const std::string &name)
+{
+  std::vector<Phase *> &phases = GetPhases ();
+  for (std::vector<Phase *>::const_iterator i = phases.begin (); i != phases.end (); ++i)
+    {
+      if ((*i)->m_name == name)
+        {
+          return *i;
+        }
+    }
+  Phase *phase = new Phase ();
+  phase->m_name = name;
+  phase->m_count = 0;
+  phase->m_totalNs = 0;
+  phase->m_sampleEvery = 1;
+  phase->m_untilSample = 1;
+  phases.push_back (phase);
+  return phase;
+}
+
+uint64_t
+PhaseProfiler::Now (void)
+{
+  struct timespec now;
+  clock_gettime (CLOCK_MONOTONIC, &now);
+  return (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+void
+PhaseProfiler::AddSample (Phase *phase, uint64_t ns)
+{
+  phase->m_samples.push_back (std::min (ns, (uint64_t) std::numeric_limits<uint32_t>::max ()));
+  if (phase->m_samples.size () >= PHASE_PROFILER_MAX_SAMPLES)
+    {
+      // keep every other sample, and sample half as often from now on
+      for (uint32_t i = 0; 2 * i + 1 < phase->m_samples.size (); i++)
+        {
+          phase->m_samples[i] = phase->m_samples[2 * i + 1];
+        }
+      phase->m_samples.resize (phase->m_samples.size () / 2);
+      phase->m_sampleEvery *= 2;
+    }
+  phase->m_untilSample = phase->m_sampleEvery;
+}
+
+void
+PhaseProfiler::WriteCsv (std::ostream &os)
+{
+  os << "Phase,Count,TotalSeconds,MeanNs,P50Ns,P99Ns,Samples\n";
+  std::vector<Phase *> &phases = GetPhases ();
+  for (std::vector<Phase *>::const_iterator i = phases.begin (); i != phases.end (); ++i)
+    {
+      const Phase *phase = *i;
+      if (phase->m_count == 0)
+        {
+          continue;
+        }
+      std::vector<uint32_t> samples (phase->m_samples);
+      uint32_t p50 = 0;
+      uint32_t p99 = 0;
+      if (!samples.empty ())
+        {
+          std::vector<uint32_t>::iterator median = samples.begin () + samples.size () / 2;
+          std::nth_element (samples.begin (), median, samples.end ());
+          p50 = *median;
+          std::vector<uint32_t>::iterator tail = samples.begin () + (samples.size () * 99) / 100;
+          std::nth_element (samples.begin (), tail, samples.end ());
+          p99 = *tail;
+        }
+      os << phase->m_name << ","
+         << phase->m_count << ","
+         << phase->m_totalNs / 1e9 << ","
+         << (double) phase->m_totalNs / phase->m_count << ","
+         << p50 << ","
+         << p99 << ","
+         << samples.size () << "\n";
+    }
+}
+
+void
+PhaseProfiler::Reset (void)
+{
+  std::vector<Phase *> &phases = GetPhases ();
+  for (std::vector<Phase *>::iterator i = phases.begin (); i != phases.end (); ++i)
+    {
+      (*i)->m_count = 0;
+      (*i)->m_totalNs = 0;
+      (*i)->m_sampleEvery = 1;
+      (*i)->m_untilSample = 1;
+      (*i)->m_samples.clear ();
+    }
+}
+
+} // namespace ns3
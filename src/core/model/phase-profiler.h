@@ -0,0 +1,178 @@
+/* -*-  Mode: C++; c-file-style: "gnu"; indent-tabs-mode:nil; -*- */
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation;
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef PHASE_PROFILER_H
+#define PHASE_PROFILER_H
+
+#include <string>
+#include <vector>
+#include <ostream>
+#include <stdint.h>
+
+/**
+ * \file
+ * \ingroup core
+ * Scoped timing of hot code paths, aggregated per named phase.
+ *
+ * NS_PROFILE_SCOPE (name) times the rest of the enclosing scope and
+ * adds it to the phase of that name.  It expands to nothing unless
+ * NS3_PHASE_PROFILER is defined (e.g. CXXFLAGS="-DNS3_PHASE_PROFILER"),
+ * so that instrumented code costs nothing in normal builds.
+ */
+
+#ifdef NS3_PHASE_PROFILER
+
+#define NS_PROFILE_CONCAT2(a, b) a ## b
+#define NS_PROFILE_CONCAT(a, b) NS_PROFILE_CONCAT2 (a, b)
+
+/**
+ * \ingroup core
+ * \param name the phase name, a string literal
+ *
+ * Time the rest of the enclosing scope.  Nested phases are inclusive:
+ * the time of an inner phase is also counted in the outer one.
+ */
+#define NS_PROFILE_SCOPE(name)                                          \
+  static ns3::PhaseProfiler::Phase *NS_PROFILE_CONCAT (ns3ProfilePhase, __LINE__) = \
+    ns3::PhaseProfiler::GetPhase (name);                                \
+  ns3::PhaseTimer NS_PROFILE_CONCAT (ns3ProfileTimer, __LINE__) (NS_PROFILE_CONCAT (ns3ProfilePhase, __LINE__))
+
+#else /* NS3_PHASE_PROFILER */
+
+#define NS_PROFILE_SCOPE(name)
+
+#endif /* NS3_PHASE_PROFILER */
+
+namespace ns3 {
+
+/**
+ * \ingroup core
+ * \brief Registry of the phases timed by NS_PROFILE_SCOPE.
+ *
+ * Each phase counts its calls and their total duration, read from the
+ * monotonic clock, and keeps a sample of the durations for the
+ * percentiles: every call until the sample is full, then every other
+ * sampled call, and so on, so that memory stays bounded and the whole
+ * run is represented evenly.
+ *
+ * Phases are not locked: they are meant to be entered from the
+ * simulation thread only.
+ */
+class PhaseProfiler
+{
+public:
+  /**
+   * \brief Aggregates of one phase
+   */
+  struct Phase
+  {
+    std::string m_name;
+    uint64_t m_count;                ///< number of calls
+    uint64_t m_totalNs;              ///< total duration of the calls, ns
+    uint32_t m_sampleEvery;          ///< one call in this many is sampled
+    uint32_t m_untilSample;          ///< calls left before the next sample
+    std::vector<uint32_t> m_samples; ///< sampled durations, ns
+  };
+
+  /**
+   * \param name the phase name
+   * \return the phase of that name, created on first use
+   */
+  static Phase *GetPhase (const std::string &name);
+
+  /**
+   * \return whether this build has NS3_PHASE_PROFILER defined
+   */
+  static bool IsEnabled (void);
+
+  /**
+   * \return the monotonic clock, ns
+   */
+  static uint64_t Now (void);
+
+  /**
+   * \param phase the phase to add a call to
+   * \param ns the duration of the call, ns
+   */
+  static void Record (Phase *phase, uint64_t ns);
+
+  /**
+   * Write one Phase,Count,TotalSeconds,MeanNs,P50Ns,P99Ns,Samples line
+   * per phase called at least once, after a header line.
+   *
+   * \param os the output stream
+   */
+  static void WriteCsv (std::ostream &os);
+
+  /**
+   * Clear the aggregates of all phases
+   */
+  static void Reset (void);
+
+private:
+  static std::vector<Phase *> &GetPhases (void);
+  static void AddSample (Phase *phase, uint64_t ns);
+};
+
+/**
+ * \ingroup core
+ * \brief Adds the time from its construction to its destruction to a phase.
+ */
+class PhaseTimer
+{
+public:
+  PhaseTimer (PhaseProfiler::Phase *phase)
+    : m_phase (phase),
+      m_start (PhaseProfiler::Now ())
+  {
+  }
+  ~PhaseTimer ()
+  {
+    PhaseProfiler::Record (m_phase, PhaseProfiler::Now () - m_start);
+  }
+
+private:
+  PhaseTimer (const PhaseTimer &);
+  PhaseTimer &operator = (const PhaseTimer &);
+
+  PhaseProfiler::Phase *m_phase;
+  uint64_t m_start;
+};
+
+inline bool
+PhaseProfiler::IsEnabled (void)
+{
+#ifdef NS3_PHASE_PROFILER
+  return true;
+#else
+  return false;
+#endif
+}
+
+inline void
+PhaseProfiler::Record (Phase *phase, uint64_t ns)
+{
+  phase->m_count++;
+  phase->m_totalNs += ns;
+  if (--phase->m_untilSample == 0)
+    {
+      AddSample (phase, ns);
+    }
+}
+
+} // namespace ns3
+
+#endif /* PHASE_PROFILER_H */
@@ -40,13 +40,34 @@
 
 #include <fstream>
 #include <sstream>
+#include <iterator>
+#include <vector>
+#include <cstring>
+#include <cstdlib>
+#include <cctype>
+#include <cmath>
+#include <cstdio>
+#include <algorithm>
+#include <limits>
 #include <map>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "ns3/core-config.h"
 #include "ns3/log.h"
-#include "ns3/unused.h"
 #include "ns3/simulator.h"
+#include "ns3/boolean.h"
+#include "ns3/simple-ref-count.h"
+#include "ns3/phase-profiler.h"
 #include "ns3/node-list.h"
 #include "ns3/node.h"
 #include "ns3/constant-velocity-mobility-model.h"
+#include "ns3/waypoint-table-mobility-model.h"
+#ifdef HAVE_PTHREAD_H
+#include "ns3/system-thread.h"
+#endif
 #include "ns2-mobility-helper.h"
 
 NS_LOG_COMPONENT_DEFINE ("Ns2MobilityHelper");
@@ -63,17 +84,108 @@ namespace ns3 {
 #define  NS2_NODEID   "$node_("
 #define  NS2_NS_SCH   "$ns_"
 
+// Longest valid line is $ns_ at 1 "$node_(0) setdest 2 3 4 " (9 tokens)
+#define  NS2_MAX_TOKENS 9
 
-// Type to maintain line parsed and its values
+// Longest numeric token that will be converted (longer ones are rejected)
+#define  NS2_MAX_NUMBER_LENGTH 63
+
+// Binary trace identification
+#define  NS2_BINARY_MAGIC   "NS2MOBB"
+#define  NS2_BINARY_VERSION 1
+
+// Smallest part of a text trace worth parsing on its own thread
+#define  NS2_MIN_CHUNK_SIZE (1 << 20)
+
+// Handle of no scheduled action
+#define  NS2_NO_ACTION 0xffffffff
+
+// Id of the nodes filtered out of a trace
+#define  NS2_NO_NODE 0xffffffff
+
+// Highest node id accepted: the per node tables are indexed by id, so
+// that a stray huge id would otherwise size them for as many nodes
+#define  NS2_MAX_NODE_ID ((1 << 20) - 1)
+
+// Most traces kept in the trace cache; the least recently used ones
+// are forgotten first
+#define  NS2_TRACE_CACHE_SIZE 4
+
+
+/**
+ * \brief Type to maintain line parsed and its values.  Tokens are not
+ * copied: they point into the trace buffer, so that parsing a line does
+ * not allocate any memory.
+ */
 struct ParseResult
 {
-  std::vector<std::string> tokens; // tokens from a line
-  std::vector<int> ivals;     // int values for each tokens
-  std::vector<bool> has_ival; // points if a tokens has an int value
-  std::vector<double> dvals;  // double values for each tokens
-  std::vector<bool> has_dval; // points if a tokens has a double value
-  std::vector<std::string> svals;  // string value for each token
+  uint32_t nTokens;                     // number of tokens in line
+  const char *tokens[NS2_MAX_TOKENS];   // start of each token
+  uint32_t lengths[NS2_MAX_TOKENS];     // length of each token
+};
+
+/**
+ * \brief Kind of statement found on a valid trace line
+ */
+enum Ns2EventType
+{
+  NS2_INITIAL_POS,   // $node_(0) set X_ 123
+  NS2_SCHED_SETDEST, // $ns_ at 1 "$node_(0) setdest 2 3 4"
+  NS2_SCHED_SET      // $ns_ at 1 "$node_(0) set X_ 2"
+};
+
+/**
+ * \brief One statement of the trace, decoded from a line.
+ */
+struct Ns2TraceEvent
+{
+  double m_at;       // Time of the event (unused for initial positions)
+  uint32_t m_nodeId; // Node the event applies to
+  uint8_t m_type;    // One of Ns2EventType
+  uint8_t m_coord;   // 0, 1 or 2 for X_, Y_ or Z_ (set statements only)
+  double m_x;        // Destination x, or coordinate value for set statements
+  double m_y;        // Destination y (setdest only)
+  double m_speed;    // Speed (setdest only)
+};
+
+/**
+ * \brief Header of a binary trace.  It is followed by one column per
+ * field of Ns2TraceEvent: m_at, m_x, m_y and m_speed (doubles), then
+ * m_nodeId (uint32_t), then m_type | m_coord << 2 (uint8_t).  Values are
+ * stored in host byte order; the version field doubles as a byte order
+ * check.
+ */
+struct Ns2BinaryTraceHeader
+{
+  char m_magic[8];      // NS2_BINARY_MAGIC
+  uint32_t m_version;   // NS2_BINARY_VERSION
+  uint32_t m_nNodes;    // Highest node id in the trace, plus one
+  uint64_t m_nEvents;   // Number of statements (length of each column)
+  double m_startTime;   // Time of the first scheduled statement
+  double m_stopTime;    // Time of the last scheduled statement
+};
+
+/**
+ * \brief Read-only view of a whole trace file.  The file is memory
+ * mapped when possible, so that simulations loading the same trace
+ * share its pages; otherwise it is read into memory in one go.
+ */
+class Ns2TraceBuffer
+{
+public:
+  Ns2TraceBuffer ();
+  ~Ns2TraceBuffer ();
+  bool Open (const std::string &filename);
+  const char * Begin (void) const;
+  const char * End (void) const;
+private:
+  Ns2TraceBuffer (const Ns2TraceBuffer &);
+  Ns2TraceBuffer & operator = (const Ns2TraceBuffer &);
+  void *m_map;              // mapped region, or 0 if not mapped
+  size_t m_size;            // size of the trace
+  std::vector<char> m_copy; // trace contents if the file could not be mapped
 };
+
 /**
  * \brief Keeps last movement schedule. If new movement occurs during
  * a current one, node stopping must be cancels (stored in a proper
@@ -86,575 +198,1977 @@ struct DestinationPoint
   Vector m_startPosition;     // Start position of last movement
   Vector m_speed;             // Speed of the last movement (needed to derive reached destination at next schedule = start + velocity * actuallyTravelled)
   Vector m_finalPosition;     // Final destination to be reached before next schedule. Replaced with actually reached if needed.
-  EventId m_stopEvent;        // Event scheduling node's stop. May be canceled if needed.
+  uint32_t m_stopAction;      // Action scheduling node's stop. May be canceled if needed.
   double m_travelStartTime;   // Travel start time is needed to calculate actually traveled time
   double m_targetArrivalTime; // When a station arrives to a destination
   DestinationPoint () :
     m_startPosition (Vector (0,0,0)),
     m_speed (Vector (0,0,0)),
     m_finalPosition (Vector (0,0,0)),
+    m_stopAction (NS2_NO_ACTION),
     m_travelStartTime (0),
     m_targetArrivalTime (0)
   {};
 };
 
+/**
+ * \brief Part of a trace to install: a time window, an area and a
+ * subset of the nodes.  The time and the node of a line are checked
+ * before the line is tokenized; the area needs the node movements.
+ */
+struct Ns2TraceFilter
+{
+  double m_start;            // Trace time played from
+  double m_stop;             // Statements after it are skipped, infinite if none
+  bool m_hasArea;            // Whether nodes must enter m_area
+  Rectangle m_area;
+  std::vector<bool> m_nodes; // Selected trace node ids, empty for all
+  Ns2TraceFilter ();
+  bool IsEnabled (void) const;
+  bool IsKept (uint32_t nodeId) const;
+  // Identifies the filter in the trace cache
+  std::string GetKey (void) const;
+};
+
+/**
+ * \brief Statements of a trace file, read once per process and shared
+ * by all the helpers installing the same file, for as long as the file
+ * keeps the same modification time and size.  The statements never
+ * change once read; the waypoint tables are derived from them on first
+ * use and never change either.  A filtered trace is stored apart from
+ * the whole one, with its nodes numbered densely.
+ *
+ * The stores, like the simulator, are only used from the thread running
+ * the simulations: their reference counts are not atomic.  The cache
+ * holds the stores of the last NS2_TRACE_CACHE_SIZE traces used.
+ */
+class Ns2TraceStore : public SimpleRefCount<Ns2TraceStore>
+{
+public:
+  Ns2TraceStore ();
+  // Returns the store of a trace file, or of the part of it selected by
+  // filter, read on up to nThreads threads unless cached and unchanged,
+  // or 0 if the file cannot be read
+  static Ptr<Ns2TraceStore> Get (const std::string &filename, uint32_t nThreads,
+                                 const Ns2TraceFilter &filter);
+  // Drops the cached stores; those still in use remain valid
+  static void Clear (void);
+  const std::vector<Ns2TraceEvent> &GetEvents (void) const;
+  // Highest node id in the trace, plus one
+  uint32_t GetNNodes (void) const;
+  bool IsInTrace (uint32_t id) const;
+  // Node id in the trace file of a node of this store
+  uint32_t GetTraceNodeId (uint32_t id) const;
+  // Bounds of the positions and destinations of the statements
+  Rectangle GetBounds (void) const;
+  // Whether the scheduled statements are in time order
+  bool IsTimeOrdered (void) const;
+  // Waypoint table of each node id, 0 for the ids not in the trace
+  const std::vector<Ptr<const WaypointTableMobilityModel::Table> > &GetTables (void);
+private:
+  typedef std::map<std::string, Ptr<Ns2TraceStore> > Cache;
+  static Cache &GetCache (void);
+  // Drops the least recently used stores beyond NS2_TRACE_CACHE_SIZE
+  static void Evict (void);
+  // Finds the nodes of the statements and the time of the last one
+  void Index (void);
+  // Selects the nodes and the statements of the filter, whose line
+  // conditions the statements of this store already meet
+  Ptr<Ns2TraceStore> Slice (const Ns2TraceFilter &filter);
+  std::vector<Ns2TraceEvent> m_events;
+  std::vector<bool> m_inTrace;     // By node id
+  std::vector<uint32_t> m_nodeIds; // Trace node id by node id, empty if the same
+  double m_lastTime;               // Time of the last scheduled statement
+  bool m_timeOrdered;              // Whether the scheduled statements are in time order
+  time_t m_mtime;                  // Modification time of the file read
+  off_t m_size;                    // Size of the file read
+  uint64_t m_lastUse;              // When the store was last taken from the cache
+  bool m_hasTables;
+  std::vector<Ptr<const WaypointTableMobilityModel::Table> > m_tables;
+};
+
+/**
+ * \brief Velocity and position changes derived from the trace, handed
+ * over to the simulator in time order, one window at a time, so that
+ * the event list only ever holds the changes of the next window.
+ *
+ * The changes are either all added before Start, or, when started on a
+ * trace store, derived from its statements as the simulation reaches
+ * them: the statements due within the next window are translated just
+ * before the window is scheduled, so that only the changes derived but
+ * not scheduled yet, such as the stop ending a movement under way, are
+ * held in memory.
+ */
+class Ns2MobilitySchedule : public SimpleRefCount<Ns2MobilitySchedule>
+{
+public:
+  Ns2MobilitySchedule ();
+  // Adds a velocity change and returns a handle to cancel it
+  uint32_t AddVelocity (Ptr<MobilityModel> model, double at, Vector velocity);
+  // Adds a position change and returns a handle to cancel it
+  uint32_t AddPosition (Ptr<MobilityModel> model, double at, Vector position);
+  // Cancels a change not scheduled yet; NS2_NO_ACTION is ignored
+  void Cancel (uint32_t handle);
+  // Starts scheduling; all changes are scheduled at once if window is zero
+  void Start (Time window);
+  // Starts scheduling the changes of the statements of trace, whose
+  // scheduled statements must be in time order, translating them window
+  // by window; models[id] is 0 for the ids whose statements are ignored
+  void Start (Ptr<Ns2TraceStore> trace, const std::vector<Ptr<MobilityModel> > &models, Time window);
+  // Hands all changes over to the tables of the models, which must be
+  // WaypointTableMobilityModels, instead of scheduling them; the tables
+  // count time from the start of the trace
+  void FillTables (void);
+private:
+  struct Action
+  {
+    Ptr<MobilityModel> m_model; // Model to change, 0 once scheduled
+    Vector m_value;             // New velocity or position
+    bool m_isPosition;          // Whether m_value is a position
+    bool m_canceled;            // Whether the change was canceled
+  };
+  struct Pending
+  {
+    double m_at;       // Time of the change, relative to Start
+    uint64_t m_seq;    // Order in which the change was added
+    uint32_t m_action; // Index of the change in m_actions
+  };
+  static bool IsLater (const Pending &a, const Pending &b);
+  static void SetVelocity (Ptr<MobilityModel> model, Vector velocity);
+  static void SetPosition (Ptr<MobilityModel> model, Vector position);
+  uint32_t Add (Ptr<MobilityModel> model, double at, Vector value, bool isPosition);
+  // Removes the earliest pending change and returns its index
+  uint32_t PopNext (void);
+  void Refill (void);
+  std::vector<Action> m_actions;  // Changes, the free ones listed in m_free
+  std::vector<uint32_t> m_free;
+  std::vector<Pending> m_pending; // Heap of the changes not scheduled, earliest first
+  uint64_t m_seq;                 // Number of changes added so far
+  Time m_origin;                  // Time at which Start was called
+  Time m_window;                  // How far ahead changes are scheduled
+  Ptr<Ns2TraceStore> m_trace;     // Statements translated window by window, if any
+  size_t m_nextEvent;             // First statement of m_trace not translated yet
+  std::vector<Ptr<MobilityModel> > m_models; // By node id
+  std::vector<DestinationPoint> m_points;    // Last movement, by node id
+  std::vector<Vector> m_positions;           // Position set by the statements, by node id
+};
+
 
-// Parses a line of ns2 mobility
-static ParseResult ParseNs2Line (const std::string& str);
+/**
+ * \brief Part of a text trace, made of whole lines, and the statements
+ * read from it.
+ */
+struct Ns2TraceChunk
+{
+  const char *m_begin;
+  const char *m_end;
+  const Ns2TraceFilter *m_filter;
+  std::vector<Ns2TraceEvent> m_events;
+  void Read (void);
+};
 
-// Put out blank spaces at the start and end of a line
-static std::string TrimNs2Line (const std::string& str);
 
-// Checks if a string represents a number or it has others characters than digits an point.
-static bool IsNumber (const std::string& s);
+// Reads every statement of a text or binary trace file, in file order,
+// parsing text traces on up to nThreads threads (0 for one per processor);
+// if filter is not 0, only the statements meeting its line conditions
+static bool ReadNs2Trace (const std::string &filename, uint32_t nThreads,
+                          const Ns2TraceFilter *filter, std::vector<Ns2TraceEvent> &events);
 
-// Check if s string represents a numeric value
-template<class T>
-static bool IsVal (const std::string& str, T& ret);
+// Reads every statement of a text trace, in file order, splitting it
+// into chunks of whole lines parsed on up to nThreads threads
+static void ReadTextTrace (const char *begin, const char *end, uint32_t nThreads,
+                           const Ns2TraceFilter *filter, std::vector<Ns2TraceEvent> &events);
 
-// Checks if the value between brackets is a correct nodeId number
-static bool HasNodeIdNumber (std::string str);
+// Reads every statement of a part of a text trace, in file order
+static void ReadTextChunk (const char *begin, const char *end, const Ns2TraceFilter *filter,
+                           std::vector<Ns2TraceEvent> &events);
 
-// Gets nodeId number in string format from the string like $node_(4)
-static std::string GetNodeIdFromToken (std::string str);
+// Whether the node or the time of a line, found without tokenizing the
+// whole line, are filtered out
+static bool IsSkippedLine (const char *line, const char *end, const Ns2TraceFilter &filter);
 
-// Get node id number in int format
-static int GetNodeIdInt (ParseResult pr);
+// Whether the node or the time of a statement are filtered out
+static bool IsSkippedEvent (const Ns2TraceEvent &ev, const Ns2TraceFilter &filter);
 
-// Get node id number in string format
-static std::string GetNodeIdString (ParseResult pr);
+// Whether a node following its waypoint table is inside area at some
+// time of [start, stop]; a movement never stopped is only followed up
+// to horizon
+static bool EntersArea (const WaypointTableMobilityModel::Table &table,
+                        double start, double stop, double horizon, const Rectangle &area);
 
-// Add one coord to a vector position
-static Vector SetOneInitialCoord (Vector actPos, std::string& coord, double value);
+// Whether the segment [a, b] crosses area, in x and y
+static bool CrossesArea (const Rectangle &area, const Vector &a, const Vector &b);
+
+// Adds the statements giving node nodeId, at time 0, the position and
+// the movement it has just before time start in its waypoint table; a
+// movement never stopped is stopped at horizon
+static void AddStartState (const WaypointTableMobilityModel::Table &table, double start,
+                           double horizon, uint32_t nodeId, std::vector<Ns2TraceEvent> &events);
+
+// Position at time at, in seconds, of a node following segment
+static Vector GetSegmentPosition (const WaypointTableMobilityModel::Segment &segment, double at);
+
+// Whether segment starts before time step
+static bool StartsBefore (const WaypointTableMobilityModel::Segment &segment, int64_t step);
 
-// Check if this corresponds to a line like this: $node_(0) set X_ 123
-static bool IsSetInitialPos (ParseResult pr);
+// Checks if a buffer holds a binary trace
+static bool IsBinaryTrace (const char *begin, const char *end);
 
-// Check if this corresponds to a line like this: $ns_ at 1 "$node_(0) setdest 2 3 4"
-static bool IsSchedSetPos (ParseResult pr);
+// Reads every statement of a binary trace.  Returns false if the
+// trace is corrupted or of an unsupported version.
+static bool ReadBinaryTrace (const char *begin, const char *end, std::vector<Ns2TraceEvent> &events);
 
-// Check if this corresponds to a line like this: $ns_ at 1 "$node_(0) set X_ 2"
-static bool IsSchedMobilityPos (ParseResult pr);
+// Parses a line of ns2 mobility into its tokens, ignoring comments and
+// surrounding blanks.  Returns false if the line has too many tokens.
+static bool ParseNs2Line (const char *line, const char *end, ParseResult &pr);
+
+// Decodes a tokenized line into a trace event.  Returns false (after
+// logging why) if the line is not one of the supported statements.
+static bool GetNs2Event (const ParseResult &pr, Ns2TraceEvent &ev);
+
+// Checks if a token is exactly the given string
+static bool IsToken (const ParseResult &pr, uint32_t i, const char *str);
+
+// Check if a token represents a numeric value, and return it
+static bool IsNumber (const char *s, uint32_t length, double &ret);
+
+// Gets nodeId number from the token like $node_(4), not above NS2_MAX_NODE_ID
+static bool GetNodeIdFromToken (const char *s, uint32_t length, uint32_t &id);
+
+// Gets coordinate index (0, 1, 2) from the token X_, Y_ or Z_
+static bool GetCoordFromToken (const ParseResult &pr, uint32_t i, uint8_t &coord);
+
+// Add one coord to a vector position
+static Vector SetOneInitialCoord (Vector actPos, uint8_t coord, double value);
+
+// Derives the velocity and position changes of every node from the
+// statements; models[id] is 0 for the ids whose statements are ignored
+static void ConfigMovements (const std::vector<Ns2TraceEvent> &events,
+                             const std::vector<Ptr<MobilityModel> > &models,
+                             Ns2MobilitySchedule &schedule);
+
+// Sets the initial positions of the nodes, wherever they appear in the
+// statements, starting from the current position of their model;
+// positions[id] is then the position of node id
+static void ConfigInitialPositions (const std::vector<Ns2TraceEvent> &events,
+                                    const std::vector<Ptr<MobilityModel> > &models,
+                                    std::vector<DestinationPoint> &points,
+                                    std::vector<Vector> &positions);
+
+// Derives the changes of a scheduled statement of a node, given its
+// last movement and the position its set statements gave it so far,
+// which a set statement also gives the model if setModel
+static void ConfigMovement (const Ns2TraceEvent &ev, Ptr<MobilityModel> model,
+                            DestinationPoint &point, Vector &position, bool setModel,
+                            Ns2MobilitySchedule &schedule);
 
 // Set waypoints and speed for movement.
-static DestinationPoint SetMovement (Ptr<ConstantVelocityMobilityModel> model, Vector lastPos, double at,
+static DestinationPoint SetMovement (Ns2MobilitySchedule &schedule, Ptr<MobilityModel> model,
+                                     Vector lastPos, double at,
                                      double xFinalPosition, double yFinalPosition, double speed);
 
 // Set initial position for a node
-static Vector SetInitialPosition (Ptr<ConstantVelocityMobilityModel> model, std::string coord, double coordVal);
+static Vector SetInitialPosition (Ptr<MobilityModel> model, Vector &position, uint8_t coord, double coordVal);
 
 // Schedule a set of position for a node
-static Vector SetSchedPosition (Ptr<ConstantVelocityMobilityModel> model, double at, std::string coord, double coordVal);
+static Vector SetSchedPosition (Ns2MobilitySchedule &schedule, Ptr<MobilityModel> model,
+                                Vector &position, double at, uint8_t coord, double coordVal);
 
 
-Ns2MobilityHelper::Ns2MobilityHelper (std::string filename)
-  : m_filename (filename)
+Ns2TraceBuffer::Ns2TraceBuffer ()
+  : m_map (0),
+    m_size (0)
 {
-  std::ifstream file (m_filename.c_str (), std::ios::in);
-  if (!(file.is_open ())) NS_FATAL_ERROR("Could not open trace file " << m_filename.c_str() << " for reading, aborting here \n"); 
 }
 
-Ptr<ConstantVelocityMobilityModel>
-Ns2MobilityHelper::GetMobilityModel (std::string idString, const ObjectStore &store) const
+Ns2TraceBuffer::~Ns2TraceBuffer ()
+{
+  if (m_map != 0)
+    {
+      munmap (m_map, m_size);
+    }
+}
+
+bool
+Ns2TraceBuffer::Open (const std::string &filename)
+{
+  int fd = open (filename.c_str (), O_RDONLY);
+  if (fd < 0)
+    {
+      return false;
+    }
+  struct stat st;
+  if (fstat (fd, &st) == 0 && S_ISREG (st.st_mode) && st.st_size > 0)
+    {
+      m_size = st.st_size;
+      void *map = mmap (0, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (map != MAP_FAILED)
+        {
+          m_map = map;
+#ifdef MADV_SEQUENTIAL
+          madvise (m_map, m_size, MADV_SEQUENTIAL);
+#endif
+          close (fd);
+          return true;
+        }
+    }
+  close (fd);
+
+  // Mapping is not possible (empty file, pipe, ...): read it instead
+  NS_LOG_LOGIC ("Trace file " << filename << " cannot be mapped, reading it");
+  std::ifstream file (filename.c_str (), std::ios::in | std::ios::binary);
+  if (!file.is_open ())
+    {
+      return false;
+    }
+  m_copy.assign (std::istreambuf_iterator<char> (file), std::istreambuf_iterator<char> ());
+  m_size = m_copy.size ();
+  return true;
+}
+
+const char *
+Ns2TraceBuffer::Begin (void) const
+{
+  if (m_map != 0)
+    {
+      return static_cast<const char *> (m_map);
+    }
+  return m_copy.empty () ? 0 : &m_copy[0];
+}
+
+const char *
+Ns2TraceBuffer::End (void) const
+{
+  return Begin () + m_size;
+}
+
+
+Ns2TraceFilter::Ns2TraceFilter ()
+  : m_start (0),
+    m_stop (std::numeric_limits<double>::infinity ()),
+    m_hasArea (false)
+{
+}
+
+bool
+Ns2TraceFilter::IsEnabled (void) const
+{
+  return m_start > 0 || m_stop < std::numeric_limits<double>::infinity () || m_hasArea || !m_nodes.empty ();
+}
+
+bool
+Ns2TraceFilter::IsKept (uint32_t nodeId) const
+{
+  return m_nodes.empty () || (nodeId < m_nodes.size () && m_nodes[nodeId]);
+}
+
+std::string
+Ns2TraceFilter::GetKey (void) const
+{
+  std::ostringstream key;
+  key.precision (17);
+  key << m_start << " " << m_stop;
+  if (m_hasArea)
+    {
+      key << " " << m_area.xMin << " " << m_area.xMax << " " << m_area.yMin << " " << m_area.yMax;
+    }
+  for (uint32_t id = 0; id < m_nodes.size (); id++)
+    {
+      if (m_nodes[id])
+        {
+          key << " " << id;
+        }
+    }
+  return key.str ();
+}
+
+
+Ns2TraceStore::Ns2TraceStore ()
+  : m_lastTime (0),
+    m_timeOrdered (true),
+    m_mtime (0),
+    m_size (0),
+    m_lastUse (0),
+    m_hasTables (false)
+{
+}
+
+Ns2TraceStore::Cache &
+Ns2TraceStore::GetCache (void)
+{
+  static Cache cache;
+  return cache;
+}
+
+void
+Ns2TraceStore::Evict (void)
+{
+  Cache &cache = GetCache ();
+  while (cache.size () > NS2_TRACE_CACHE_SIZE)
+    {
+      Cache::iterator oldest = cache.begin ();
+      for (Cache::iterator it = cache.begin (); it != cache.end (); ++it)
+        {
+          if (it->second->m_lastUse < oldest->second->m_lastUse)
+            {
+              oldest = it;
+            }
+        }
+      NS_LOG_DEBUG ("Forgetting the statements of " << oldest->first);
+      cache.erase (oldest);
+    }
+}
+
+Ptr<Ns2TraceStore>
+Ns2TraceStore::Get (const std::string &filename, uint32_t nThreads, const Ns2TraceFilter &filter)
+{
+  static uint64_t uses = 0;
+  struct stat st;
+  if (stat (filename.c_str (), &st) != 0)
+    {
+      return 0;
+    }
+  std::string key = filename;
+  if (filter.IsEnabled ())
+    {
+      key += "|" + filter.GetKey ();
+    }
+  Cache &cache = GetCache ();
+  Cache::iterator it = cache.find (key);
+  if (it != cache.end () && it->second->m_mtime == st.st_mtime && it->second->m_size == st.st_size)
+    {
+      NS_LOG_DEBUG ("Reusing the statements of " << key);
+      it->second->m_lastUse = ++uses;
+      return it->second;
+    }
+
+  Ptr<Ns2TraceStore> store = Create<Ns2TraceStore> ();
+  if (!ReadNs2Trace (filename, nThreads, filter.IsEnabled () ? &filter : 0, store->m_events))
+    {
+      return 0;
+    }
+  store->m_mtime = st.st_mtime;
+  store->m_size = st.st_size;
+  store->Index ();
+  if (filter.IsEnabled ())
+    {
+      store = store->Slice (filter);
+    }
+  store->m_lastUse = ++uses;
+  cache[key] = store;
+  Evict ();
+  return store;
+}
+
+void
+Ns2TraceStore::Clear (void)
+{
+  GetCache ().clear ();
+}
+
+void
+Ns2TraceStore::Index (void)
+{
+  uint32_t nNodes = 0;
+  m_lastTime = 0;
+  m_timeOrdered = true;
+  for (std::vector<Ns2TraceEvent>::const_iterator i = m_events.begin (); i != m_events.end (); ++i)
+    {
+      nNodes = std::max (nNodes, i->m_nodeId + 1);
+      if (i->m_type != NS2_INITIAL_POS)
+        {
+          m_timeOrdered = m_timeOrdered && i->m_at >= m_lastTime;
+        }
+      m_lastTime = std::max (m_lastTime, i->m_at);
+    }
+  m_inTrace.assign (nNodes, false);
+  for (std::vector<Ns2TraceEvent>::const_iterator i = m_events.begin (); i != m_events.end (); ++i)
+    {
+      m_inTrace[i->m_nodeId] = true;
+    }
+}
+
+Ptr<Ns2TraceStore>
+Ns2TraceStore::Slice (const Ns2TraceFilter &filter)
+{
+  // The movements are only played if the state of the nodes at the
+  // start of the window or their presence in the area are needed
+  bool shifted = filter.m_start > 0;
+  const std::vector<Ptr<const WaypointTableMobilityModel::Table> > *tables = 0;
+  if (shifted || filter.m_hasArea)
+    {
+      tables = &GetTables ();
+    }
+  // A node moving after the last statement without ever being stopped,
+  // which only a set during a movement leads to, is followed up to the
+  // stop of the window, or to the last statement
+  double horizon = std::max (std::min (filter.m_stop, m_lastTime), filter.m_start);
+
+  Ptr<Ns2TraceStore> slice = Create<Ns2TraceStore> ();
+  slice->m_mtime = m_mtime;
+  slice->m_size = m_size;
+  uint32_t nNodes = GetNNodes ();
+  std::vector<uint32_t> ids (nNodes, NS2_NO_NODE);
+  for (uint32_t id = 0; id < nNodes; id++)
+    {
+      if (!m_inTrace[id]
+          || (filter.m_hasArea && !EntersArea (*(*tables)[id], filter.m_start, filter.m_stop, horizon, filter.m_area)))
+        {
+          continue;
+        }
+      ids[id] = slice->m_nodeIds.size ();
+      slice->m_nodeIds.push_back (id);
+      if (shifted)
+        {
+          AddStartState (*(*tables)[id], filter.m_start, horizon, ids[id], slice->m_events);
+        }
+    }
+
+  // The statements of the selected nodes, from the start of the window
+  // on, which is played at time 0
+  for (std::vector<Ns2TraceEvent>::const_iterator i = m_events.begin (); i != m_events.end (); ++i)
+    {
+      if (ids[i->m_nodeId] == NS2_NO_NODE
+          || (shifted && (i->m_type == NS2_INITIAL_POS || i->m_at < filter.m_start)))
+        {
+          continue;
+        }
+      Ns2TraceEvent ev = *i;
+      ev.m_nodeId = ids[i->m_nodeId];
+      if (shifted)
+        {
+          ev.m_at -= filter.m_start;
+        }
+      slice->m_events.push_back (ev);
+    }
+  slice->Index ();
+  NS_LOG_DEBUG ("Selected " << slice->m_nodeIds.size () << " of " << nNodes << " nodes and "
+                            << slice->m_events.size () << " of " << m_events.size () << " statements");
+  return slice;
+}
+
+const std::vector<Ns2TraceEvent> &
+Ns2TraceStore::GetEvents (void) const
+{
+  return m_events;
+}
+
+uint32_t
+Ns2TraceStore::GetNNodes (void) const
+{
+  return m_inTrace.size ();
+}
+
+bool
+Ns2TraceStore::IsInTrace (uint32_t id) const
+{
+  return id < m_inTrace.size () && m_inTrace[id];
+}
+
+uint32_t
+Ns2TraceStore::GetTraceNodeId (uint32_t id) const
+{
+  return m_nodeIds.empty () ? id : m_nodeIds[id];
+}
+
+Rectangle
+Ns2TraceStore::GetBounds (void) const
+{
+  double inf = std::numeric_limits<double>::infinity ();
+  Rectangle bounds (inf, -inf, inf, -inf);
+  for (std::vector<Ns2TraceEvent>::const_iterator i = m_events.begin (); i != m_events.end (); ++i)
+    {
+      if (i->m_type == NS2_SCHED_SETDEST)
+        {
+          bounds.xMin = std::min (bounds.xMin, i->m_x);
+          bounds.xMax = std::max (bounds.xMax, i->m_x);
+          bounds.yMin = std::min (bounds.yMin, i->m_y);
+          bounds.yMax = std::max (bounds.yMax, i->m_y);
+        }
+      else if (i->m_coord == 0)
+        {
+          bounds.xMin = std::min (bounds.xMin, i->m_x);
+          bounds.xMax = std::max (bounds.xMax, i->m_x);
+        }
+      else if (i->m_coord == 1)
+        {
+          bounds.yMin = std::min (bounds.yMin, i->m_x);
+          bounds.yMax = std::max (bounds.yMax, i->m_x);
+        }
+    }
+  return bounds;
+}
+
+bool
+Ns2TraceStore::IsTimeOrdered (void) const
+{
+  return m_timeOrdered;
+}
+
+const std::vector<Ptr<const WaypointTableMobilityModel::Table> > &
+Ns2TraceStore::GetTables (void)
+{
+  if (m_hasTables)
+    {
+      return m_tables;
+    }
+  // Play the trace into models of its own, from their default initial
+  // position, and keep only their tables
+  uint32_t nNodes = GetNNodes ();
+  std::vector<Ptr<MobilityModel> > models (nNodes);
+  for (uint32_t id = 0; id < nNodes; id++)
+    {
+      if (m_inTrace[id])
+        {
+          Ptr<WaypointTableMobilityModel> model = CreateObject<WaypointTableMobilityModel> ();
+          model->SetAttribute ("CourseChangeEvents", BooleanValue (false));
+          models[id] = model;
+        }
+    }
+  Ns2MobilitySchedule schedule;
+  ConfigMovements (m_events, models, schedule);
+  schedule.FillTables ();
+  m_tables.assign (nNodes, 0);
+  for (uint32_t id = 0; id < nNodes; id++)
+    {
+      if (models[id] != 0)
+        {
+          m_tables[id] = StaticCast<WaypointTableMobilityModel> (models[id])->GetTable ();
+          models[id]->Dispose ();
+        }
+    }
+  m_hasTables = true;
+  return m_tables;
+}
+
+
+Ns2MobilitySchedule::Ns2MobilitySchedule ()
+  : m_seq (0),
+    m_nextEvent (0)
+{
+}
+
+uint32_t
+Ns2MobilitySchedule::AddVelocity (Ptr<MobilityModel> model, double at, Vector velocity)
+{
+  return Add (model, at, velocity, false);
+}
+
+uint32_t
+Ns2MobilitySchedule::AddPosition (Ptr<MobilityModel> model, double at, Vector position)
+{
+  return Add (model, at, position, true);
+}
+
+uint32_t
+Ns2MobilitySchedule::Add (Ptr<MobilityModel> model, double at, Vector value, bool isPosition)
+{
+  uint32_t handle;
+  if (m_free.empty ())
+    {
+      handle = m_actions.size ();
+      m_actions.push_back (Action ());
+    }
+  else
+    {
+      handle = m_free.back ();
+      m_free.pop_back ();
+    }
+  Action &action = m_actions[handle];
+  action.m_model = model;
+  action.m_value = value;
+  action.m_isPosition = isPosition;
+  action.m_canceled = false;
+  Pending pending;
+  pending.m_at = at;
+  pending.m_seq = m_seq++;
+  pending.m_action = handle;
+  m_pending.push_back (pending);
+  std::push_heap (m_pending.begin (), m_pending.end (), &Ns2MobilitySchedule::IsLater);
+  return handle;
+}
+
+void
+Ns2MobilitySchedule::Cancel (uint32_t handle)
+{
+  if (handle != NS2_NO_ACTION)
+    {
+      m_actions[handle].m_canceled = true;
+    }
+}
+
+bool
+Ns2MobilitySchedule::IsLater (const Pending &a, const Pending &b)
+{
+  // changes of the same time keep the order they were added in, which
+  // is the order the simulator would execute them in
+  return a.m_at > b.m_at || (a.m_at == b.m_at && a.m_seq > b.m_seq);
+}
+
+uint32_t
+Ns2MobilitySchedule::PopNext (void)
+{
+  uint32_t handle = m_pending.front ().m_action;
+  std::pop_heap (m_pending.begin (), m_pending.end (), &Ns2MobilitySchedule::IsLater);
+  m_pending.pop_back ();
+  m_free.push_back (handle);
+  return handle;
+}
+
+void
+Ns2MobilitySchedule::SetVelocity (Ptr<MobilityModel> model, Vector velocity)
+{
+  NS_PROFILE_SCOPE ("Ns2MobilityHelper::SetVelocity");
+  StaticCast<ConstantVelocityMobilityModel> (model)->SetVelocity (velocity);
+}
+
+void
+Ns2MobilitySchedule::SetPosition (Ptr<MobilityModel> model, Vector position)
+{
+  NS_PROFILE_SCOPE ("Ns2MobilityHelper::SetPosition");
+  model->SetPosition (position);
+}
+
+void
+Ns2MobilitySchedule::Start (Time window)
+{
+  m_origin = Simulator::Now ();
+  m_window = window;
+  Refill ();
+}
+
+void
+Ns2MobilitySchedule::Start (Ptr<Ns2TraceStore> trace, const std::vector<Ptr<MobilityModel> > &models,
+                            Time window)
+{
+  NS_ASSERT (trace->IsTimeOrdered () && !window.IsZero ());
+  m_trace = trace;
+  m_nextEvent = 0;
+  m_models = models;
+  m_points.assign (models.size (), DestinationPoint ());
+  m_positions.assign (models.size (), Vector ());
+  ConfigInitialPositions (trace->GetEvents (), models, m_points, m_positions);
+
+  // the translation of the whole trace leaves each model at the last
+  // position the set statements give it; so does this one, without
+  // translating them yet
+  std::vector<Vector> positions = m_positions;
+  std::vector<bool> isSet (models.size (), false);
+  const std::vector<Ns2TraceEvent> &events = trace->GetEvents ();
+  for (std::vector<Ns2TraceEvent>::const_iterator i = events.begin (); i != events.end (); ++i)
+    {
+      if (i->m_type == NS2_SCHED_SET && i->m_nodeId < models.size () && models[i->m_nodeId] != 0)
+        {
+          positions[i->m_nodeId] = SetOneInitialCoord (positions[i->m_nodeId], i->m_coord, i->m_x);
+          isSet[i->m_nodeId] = true;
+        }
+    }
+  for (uint32_t id = 0; id < models.size (); id++)
+    {
+      if (isSet[id])
+        {
+          models[id]->SetPosition (positions[id]);
+        }
+    }
+  Start (window);
+}
+
+void
+Ns2MobilitySchedule::FillTables (void)
+{
+  uint64_t nChanges = m_pending.size ();
+  while (!m_pending.empty ())
+    {
+      double at = m_pending.front ().m_at;
+      Action &action = m_actions[PopNext ()];
+      if (action.m_canceled)
+        {
+          continue;
+        }
+      Ptr<WaypointTableMobilityModel> model = StaticCast<WaypointTableMobilityModel> (action.m_model);
+      if (action.m_isPosition)
+        {
+          model->AddPosition (Seconds (at), action.m_value);
+        }
+      else
+        {
+          model->AddVelocity (Seconds (at), action.m_value);
+        }
+    }
+  NS_LOG_LOGIC ("Filled the waypoint tables with " << nChanges << " mobility changes");
+  m_actions.clear ();
+  m_free.clear ();
+}
+
+void
+Ns2MobilitySchedule::Refill (void)
+{
+  Time now = Simulator::Now ();
+  Time horizon = now + m_window;
+
+  // Translate the statements of the window first: the changes they
+  // cancel are never due before them, hence still pending
+  size_t nEvents = 0;
+  if (m_trace != 0)
+    {
+      const std::vector<Ns2TraceEvent> &events = m_trace->GetEvents ();
+      nEvents = events.size ();
+      for (; m_nextEvent < nEvents; m_nextEvent++)
+        {
+          const Ns2TraceEvent &ev = events[m_nextEvent];
+          if (ev.m_type == NS2_INITIAL_POS)
+            {
+              continue;
+            }
+          if (m_origin + Seconds (ev.m_at) >= horizon)
+            {
+              break;
+            }
+          uint32_t id = ev.m_nodeId;
+          if (id < m_models.size () && m_models[id] != 0)
+            {
+              ConfigMovement (ev, m_models[id], m_points[id], m_positions[id], false, *this);
+            }
+        }
+    }
+
+  while (!m_pending.empty ())
+    {
+      Time at = m_origin + Seconds (m_pending.front ().m_at);
+      if (!m_window.IsZero () && at >= horizon)
+        {
+          break;
+        }
+      Action &action = m_actions[PopNext ()];
+      if (!action.m_canceled)
+        {
+          if (action.m_isPosition)
+            {
+              Simulator::Schedule (at - now, &Ns2MobilitySchedule::SetPosition, action.m_model, action.m_value);
+            }
+          else
+            {
+              Simulator::Schedule (at - now, &Ns2MobilitySchedule::SetVelocity, action.m_model, action.m_value);
+            }
+        }
+      // the simulator now holds a reference to the model, if needed
+      action.m_model = 0;
+    }
+  NS_LOG_LOGIC ("Scheduled mobility changes up to " << horizon << ", " << m_pending.size ()
+                                                    << " left, and " << nEvents - m_nextEvent << " statements");
+  if (!m_pending.empty () || m_nextEvent < nEvents)
+    {
+      Simulator::Schedule (m_window, &Ns2MobilitySchedule::Refill, Ptr<Ns2MobilitySchedule> (this));
+    }
+  else
+    {
+      m_actions.clear ();
+      m_free.clear ();
+      m_trace = 0;
+      m_models.clear ();
+      m_points.clear ();
+      m_positions.clear ();
+    }
+}
+
+
+Ns2MobilityHelper::Ns2MobilityHelper (std::string filename)
+  : m_filename (filename),
+    m_scheduleWindow (Seconds (0)),
+    m_parseThreads (0),
+    m_waypointTable (false),
+    m_windowStart (Seconds (0)),
+    m_windowStop (Seconds (0)),
+    m_hasArea (false)
+{
+  std::ifstream file (m_filename.c_str (), std::ios::in);
+  if (!(file.is_open ())) NS_FATAL_ERROR("Could not open trace file " << m_filename.c_str() << " for reading, aborting here \n"); 
+}
+
+void
+Ns2MobilityHelper::SetScheduleWindow (Time window)
+{
+  NS_ASSERT (!window.IsStrictlyNegative ());
+  m_scheduleWindow = window;
+}
+
+void
+Ns2MobilityHelper::SetParseThreads (uint32_t nThreads)
+{
+  m_parseThreads = nThreads;
+}
+
+void
+Ns2MobilityHelper::SetWaypointTable (bool enable)
+{
+  m_waypointTable = enable;
+}
+
+void
+Ns2MobilityHelper::SetTimeWindow (Time start, Time stop)
+{
+  NS_ASSERT (!start.IsStrictlyNegative () && stop.IsStrictlyPositive () && stop >= start);
+  m_windowStart = start;
+  m_windowStop = stop;
+}
+
+void
+Ns2MobilityHelper::SetArea (Rectangle area)
+{
+  m_hasArea = true;
+  m_area = area;
+}
+
+void
+Ns2MobilityHelper::SetNodeFilter (const std::vector<uint32_t> &ids)
+{
+  m_nodeFilter = ids;
+}
+
+uint32_t
+Ns2MobilityHelper::GetNNodes (void) const
+{
+  Ptr<Ns2TraceStore> trace = GetTrace ();
+  if (trace == 0)
+    {
+      NS_LOG_ERROR ("Could not read trace file " << m_filename);
+      return 0;
+    }
+  return trace->GetNNodes ();
+}
+
+uint32_t
+Ns2MobilityHelper::GetTraceNodeId (uint32_t id) const
+{
+  Ptr<Ns2TraceStore> trace = GetTrace ();
+  NS_ASSERT (trace != 0 && id < trace->GetNNodes ());
+  return trace->GetTraceNodeId (id);
+}
+
+Rectangle
+Ns2MobilityHelper::GetBounds (void) const
+{
+  Ptr<Ns2TraceStore> trace = GetTrace ();
+  if (trace == 0)
+    {
+      NS_LOG_ERROR ("Could not read trace file " << m_filename);
+      return Rectangle ();
+    }
+  return trace->GetBounds ();
+}
+
+Ptr<Ns2TraceStore>
+Ns2MobilityHelper::GetTrace (void) const
+{
+  Ns2TraceFilter filter;
+  if (!m_windowStop.IsZero ())
+    {
+      filter.m_start = m_windowStart.GetSeconds ();
+      filter.m_stop = m_windowStop.GetSeconds ();
+    }
+  filter.m_hasArea = m_hasArea;
+  filter.m_area = m_area;
+  for (std::vector<uint32_t>::const_iterator i = m_nodeFilter.begin (); i != m_nodeFilter.end (); ++i)
+    {
+      if (*i >= filter.m_nodes.size ())
+        {
+          filter.m_nodes.resize (*i + 1, false);
+        }
+      filter.m_nodes[*i] = true;
+    }
+  // the statements of a trace are read only once per process
+  return Ns2TraceStore::Get (m_filename, m_parseThreads, filter);
+}
+
+Ptr<MobilityModel>
+Ns2MobilityHelper::GetMobilityModel (uint32_t id, const ObjectStore &store) const
+{
+  Ptr<Object> object = store.Get (id);
+  if (object == 0)
+    {
+      return 0;
+    }
+  if (m_waypointTable)
+    {
+      Ptr<WaypointTableMobilityModel> model = object->GetObject<WaypointTableMobilityModel> ();
+      if (model == 0)
+        {
+          model = CreateObject<WaypointTableMobilityModel> ();
+          object->AggregateObject (model);
+        }
+      return model;
+    }
+  Ptr<ConstantVelocityMobilityModel> model = object->GetObject<ConstantVelocityMobilityModel> ();
+  if (model == 0)
+    {
+      model = CreateObject<ConstantVelocityMobilityModel> ();
+      object->AggregateObject (model);
+    }
+  return model;
+}
+
+
+bool
+Ns2MobilityHelper::ConvertToBinary (std::string textFile, std::string binaryFile)
+{
+  Ns2TraceBuffer trace;
+  if (!trace.Open (textFile))
+    {
+      NS_LOG_ERROR ("Could not open trace file " << textFile);
+      return false;
+    }
+  if (IsBinaryTrace (trace.Begin (), trace.End ()))
+    {
+      NS_LOG_ERROR ("Trace file " << textFile << " is already a binary trace");
+      return false;
+    }
+  std::vector<Ns2TraceEvent> events;
+  ReadTextTrace (trace.Begin (), trace.End (), 0, 0, events);
+
+  Ns2BinaryTraceHeader header;
+  std::memset (&header, 0, sizeof (header));
+  std::memcpy (header.m_magic, NS2_BINARY_MAGIC, sizeof (header.m_magic));
+  header.m_version = NS2_BINARY_VERSION;
+  header.m_nEvents = events.size ();
+  bool hasTime = false;
+  for (std::vector<Ns2TraceEvent>::const_iterator i = events.begin (); i != events.end (); ++i)
+    {
+      header.m_nNodes = std::max (header.m_nNodes, i->m_nodeId + 1);
+      if (i->m_type != NS2_INITIAL_POS)
+        {
+          header.m_startTime = hasTime ? std::min (header.m_startTime, i->m_at) : i->m_at;
+          header.m_stopTime = hasTime ? std::max (header.m_stopTime, i->m_at) : i->m_at;
+          hasTime = true;
+        }
+    }
+
+  // Split the records into one column per field
+  size_t n = events.size ();
+  std::vector<double> at (n), x (n), y (n), speed (n);
+  std::vector<uint32_t> nodeId (n);
+  std::vector<uint8_t> kind (n);
+  for (size_t i = 0; i < n; i++)
+    {
+      at[i] = events[i].m_at;
+      x[i] = events[i].m_x;
+      y[i] = events[i].m_y;
+      speed[i] = events[i].m_speed;
+      nodeId[i] = events[i].m_nodeId;
+      kind[i] = events[i].m_type | (events[i].m_coord << 2);
+    }
+
+  // Write under a temporary name so that readers never see a partial
+  // file, even if several processes convert the same trace at once
+  std::ostringstream tmpName;
+  tmpName << binaryFile << ".tmp." << getpid ();
+  std::string tmpFile = tmpName.str ();
+  std::ofstream out (tmpFile.c_str (), std::ios::out | std::ios::binary | std::ios::trunc);
+  if (!out.is_open ())
+    {
+      NS_LOG_ERROR ("Could not open " << tmpFile << " for writing");
+      return false;
+    }
+  out.write (reinterpret_cast<const char *> (&header), sizeof (header));
+  if (n > 0)
+    {
+      out.write (reinterpret_cast<const char *> (&at[0]), n * sizeof (double));
+      out.write (reinterpret_cast<const char *> (&x[0]), n * sizeof (double));
+      out.write (reinterpret_cast<const char *> (&y[0]), n * sizeof (double));
+      out.write (reinterpret_cast<const char *> (&speed[0]), n * sizeof (double));
+      out.write (reinterpret_cast<const char *> (&nodeId[0]), n * sizeof (uint32_t));
+      out.write (reinterpret_cast<const char *> (&kind[0]), n * sizeof (uint8_t));
+    }
+  out.close ();
+  if (out.fail () || std::rename (tmpFile.c_str (), binaryFile.c_str ()) != 0)
+    {
+      NS_LOG_ERROR ("Could not write binary trace " << binaryFile);
+      std::remove (tmpFile.c_str ());
+      return false;
+    }
+  NS_LOG_INFO ("Converted " << textFile << " to " << binaryFile << ": " << n << " statements, "
+                            << header.m_nNodes << " nodes");
+  return true;
+}
+
+
+void
+Ns2MobilityHelper::ClearTraceCache (void)
+{
+  Ns2TraceStore::Clear ();
+}
+
+int64_t
+Ns2MobilityHelper::CountStatements (std::string filename, uint32_t nThreads)
+{
+  std::vector<Ns2TraceEvent> events;
+  if (!ReadNs2Trace (filename, nThreads, 0, events))
+    {
+      return -1;
+    }
+  return events.size ();
+}
+
+
+void
+Ns2MobilityHelper::ConfigNodesMovements (const ObjectStore &store) const
+{
+  Ptr<Ns2TraceStore> trace = GetTrace ();
+  if (trace == 0)
+    {
+      NS_LOG_ERROR ("Could not read trace file " << m_filename);
+      return;
+    }
+
+  //*****************************************************************
+  // Resolve the mobility model of every node of the trace once, into
+  // a table indexed by node id, as long as the nodes to configure: the
+  // statements of the ids beyond are ignored.
+  //*****************************************************************
+  uint32_t nNodes = std::min (trace->GetNNodes (), store.GetN ());
+  for (uint32_t id = nNodes; id < trace->GetNNodes (); id++)
+    {
+      if (trace->IsInTrace (id))
+        {
+          NS_LOG_ERROR ("Unknown node ID (corrupted file?): " << id << " and above, only "
+                                                                << store.GetN () << " nodes\n");
+          break;
+        }
+    }
+  std::vector<Ptr<MobilityModel> > models (nNodes);
+  for (uint32_t id = 0; id < nNodes; id++)
+    {
+      if (trace->IsInTrace (id))
+        {
+          models[id] = GetMobilityModel (id, store);
+          // if model not exists, the node's statements are ignored
+          if (models[id] == 0)
+            {
+              NS_LOG_ERROR ("Unknown node ID (corrupted file?): " << id << "\n");
+            }
+        }
+    }
+
+  if (m_waypointTable)
+    {
+      // the tables are shared too: each model only has a cursor
+      const std::vector<Ptr<const WaypointTableMobilityModel::Table> > &tables = trace->GetTables ();
+      Time now = Simulator::Now ();
+      for (uint32_t id = 0; id < nNodes; id++)
+        {
+          if (models[id] != 0)
+            {
+              StaticCast<WaypointTableMobilityModel> (models[id])->SetTable (tables[id], now);
+            }
+        }
+      return;
+    }
+
+  Ptr<Ns2MobilitySchedule> schedule = Create<Ns2MobilitySchedule> ();
+  if (!m_scheduleWindow.IsZero () && trace->IsTimeOrdered ())
+    {
+      // the statements are translated as the simulation reaches them
+      schedule->Start (trace, models, m_scheduleWindow);
+      return;
+    }
+  if (!m_scheduleWindow.IsZero ())
+    {
+      NS_LOG_INFO ("Trace file " << m_filename << " is not in time order: translating all its statements at once");
+    }
+  ConfigMovements (trace->GetEvents (), models, *schedule);
+  schedule->Start (m_scheduleWindow);
+}
+
+
+void
+ConfigMovements (const std::vector<Ns2TraceEvent> &events,
+                 const std::vector<Ptr<MobilityModel> > &models,
+                 Ns2MobilitySchedule &schedule)
+{
+  uint32_t nNodes = models.size ();
+  std::vector<DestinationPoint> last_pos (nNodes); // Stores previous movement scheduled for each node
+  std::vector<Vector> positions (nNodes);
+  ConfigInitialPositions (events, models, last_pos, positions);
+
+  //*****************************************************************
+  // Schedule the events now that all initial positions are known
+  //*****************************************************************
+  for (std::vector<Ns2TraceEvent>::const_iterator i = events.begin (); i != events.end (); ++i)
+    {
+      const Ns2TraceEvent &ev = *i;
+      if (ev.m_type == NS2_INITIAL_POS || ev.m_nodeId >= nNodes || models[ev.m_nodeId] == 0)
+        {
+          continue;
+        }
+      ConfigMovement (ev, models[ev.m_nodeId], last_pos[ev.m_nodeId], positions[ev.m_nodeId], true, schedule);
+    }
+}
+
+void
+ConfigInitialPositions (const std::vector<Ns2TraceEvent> &events,
+                        const std::vector<Ptr<MobilityModel> > &models,
+                        std::vector<DestinationPoint> &points,
+                        std::vector<Vector> &positions)
+{
+  uint32_t nNodes = models.size ();
+  for (uint32_t id = 0; id < nNodes; id++)
+    {
+      if (models[id] != 0)
+        {
+          positions[id] = models[id]->GetPosition ();
+        }
+    }
+
+  //*****************************************************************
+  // Set the initial node positions first, wherever they appear in
+  // the trace, to make this helper robust to handle trace files with
+  // the initial node positions at the end.
+  //*****************************************************************
+  for (std::vector<Ns2TraceEvent>::const_iterator i = events.begin (); i != events.end (); ++i)
+    {
+      const Ns2TraceEvent &ev = *i;
+      if (ev.m_type != NS2_INITIAL_POS || ev.m_nodeId >= nNodes || models[ev.m_nodeId] == 0)
+        {
+          continue;
+        }
+
+      /*
+       * In this case a initial position is being seted
+       * line like $node_(0) set X_ 151.05190721688197
+       */
+      DestinationPoint &point = points[ev.m_nodeId];
+      point = DestinationPoint ();
+      //                                                                               coord         coord value
+      point.m_finalPosition = SetInitialPosition (models[ev.m_nodeId], positions[ev.m_nodeId], ev.m_coord, ev.m_x);
+
+      // Log new position
+      NS_LOG_DEBUG ("Positions after parse for node " << ev.m_nodeId <<
+                    " position = " << point.m_finalPosition);
+    }
+}
+
+void
+ConfigMovement (const Ns2TraceEvent &ev, Ptr<MobilityModel> model,
+                DestinationPoint &point, Vector &position, bool setModel,
+                Ns2MobilitySchedule &schedule)
+{
+  uint32_t iNodeId = ev.m_nodeId;
+  double at = ev.m_at;
+
+  /*
+   * In this case a new waypoint is added
+   * line like $ns_ at 1 "$node_(0) setdest 2 3 4"
+   */
+  if (ev.m_type == NS2_SCHED_SETDEST)
+    {
+      if (point.m_targetArrivalTime > at)
+        {
+          NS_LOG_LOGIC ("Did not reach a destination! stoptime = " << point.m_targetArrivalTime << ", at = "<<  at);
+          double actuallytraveled = at - point.m_travelStartTime;
+          Vector reached = Vector (
+              point.m_startPosition.x + point.m_speed.x * actuallytraveled,
+              point.m_startPosition.y + point.m_speed.y * actuallytraveled,
+              0
+              );
+          NS_LOG_LOGIC ("Final point = " << point.m_finalPosition << ", actually reached = " << reached);
+          schedule.Cancel (point.m_stopAction);
+          point.m_finalPosition = reached;
+        }
+      //                                    last position         time  X coord  Y coord  velocity
+      point = SetMovement (schedule, model, point.m_finalPosition, at, ev.m_x, ev.m_y, ev.m_speed);
+
+      // Log new position
+      NS_LOG_DEBUG ("Positions after parse for node " << iNodeId << " position =" << point.m_finalPosition);
+    }
+
+  /*
+   * Scheduled set position
+   * line like $ns_ at 4.634906291962 "$node_(0) set X_ 28.675920486450"
+   */
+  else if (ev.m_type == NS2_SCHED_SET)
+    {
+      //                                                               time  coordinate   coord value
+      point.m_finalPosition = SetSchedPosition (schedule, model, position, at, ev.m_coord, ev.m_x);
+      if (setModel)
+        {
+          model->SetPosition (position);
+        }
+      if (point.m_targetArrivalTime > at)
+        {
+          schedule.Cancel (point.m_stopAction);
+        }
+      point.m_targetArrivalTime = at;
+      point.m_travelStartTime = at;
+      // Log new position
+      NS_LOG_DEBUG ("Positions after parse for node " << iNodeId <<
+                    " position =" << point.m_finalPosition);
+    }
+}
+
+
+bool
+ReadNs2Trace (const std::string &filename, uint32_t nThreads,
+              const Ns2TraceFilter *filter, std::vector<Ns2TraceEvent> &events)
+{
+  Ns2TraceBuffer trace;
+  if (!trace.Open (filename))
+    {
+      return false;
+    }
+  if (!IsBinaryTrace (trace.Begin (), trace.End ()))
+    {
+      ReadTextTrace (trace.Begin (), trace.End (), nThreads, filter, events);
+      return true;
+    }
+  if (!ReadBinaryTrace (trace.Begin (), trace.End (), events))
+    {
+      return false;
+    }
+  if (filter != 0)
+    {
+      // the binary statements are decoded at no cost, then filtered
+      size_t n = 0;
+      for (size_t i = 0; i < events.size (); i++)
+        {
+          if (!IsSkippedEvent (events[i], *filter))
+            {
+              events[n++] = events[i];
+            }
+        }
+      events.resize (n);
+    }
+  return true;
+}
+
+
+void
+ReadTextTrace (const char *begin, const char *end, uint32_t nThreads,
+               const Ns2TraceFilter *filter, std::vector<Ns2TraceEvent> &events)
 {
-  std::istringstream iss;
-  iss.str (idString);
-  uint32_t id (0);
-  iss >> id;
-  Ptr<Object> object = store.Get (id);
-  if (object == 0)
+#ifdef HAVE_PTHREAD_H
+  if (nThreads == 0)
     {
-      return 0;
+      long nProcessors = sysconf (_SC_NPROCESSORS_ONLN);
+      nThreads = nProcessors > 0 ? nProcessors : 1;
     }
-  Ptr<ConstantVelocityMobilityModel> model = object->GetObject<ConstantVelocityMobilityModel> ();
-  if (model == 0)
+  size_t size = end - begin;
+  nThreads = std::min<size_t> (nThreads, size / NS2_MIN_CHUNK_SIZE);
+#else
+  nThreads = 1;
+#endif
+  if (nThreads <= 1)
     {
-      model = CreateObject<ConstantVelocityMobilityModel> ();
-      object->AggregateObject (model);
+      ReadTextChunk (begin, end, filter, events);
+      return;
     }
-  return model;
+
+#ifdef HAVE_PTHREAD_H
+  // Cut the trace into chunks of about the same size, each ending
+  // just after a newline so that no line is split
+  std::vector<Ns2TraceChunk> chunks (nThreads);
+  const char *chunkBegin = begin;
+  for (uint32_t i = 0; i < nThreads; i++)
+    {
+      const char *chunkEnd = end;
+      if (i + 1 < nThreads)
+        {
+          chunkEnd = std::max (chunkBegin, begin + size / nThreads * (i + 1));
+          const char *eol = static_cast<const char *> (std::memchr (chunkEnd, '\n', end - chunkEnd));
+          chunkEnd = eol == 0 ? end : eol + 1;
+        }
+      chunks[i].m_begin = chunkBegin;
+      chunks[i].m_end = chunkEnd;
+      chunks[i].m_filter = filter;
+      chunkBegin = chunkEnd;
+    }
+
+  // The first chunk is read on this thread, while the others are read
+  // on their own threads into their own event lists
+  std::vector<Ptr<SystemThread> > threads;
+  for (uint32_t i = 1; i < nThreads; i++)
+    {
+      Ptr<SystemThread> thread = Create<SystemThread> (MakeCallback (&Ns2TraceChunk::Read, &chunks[i]));
+      thread->Start ();
+      threads.push_back (thread);
+    }
+  chunks[0].Read ();
+  for (uint32_t i = 0; i < threads.size (); i++)
+    {
+      threads[i]->Join ();
+    }
+
+  // The chunks follow each other in the file, so appending their events
+  // in chunk order gives the statements in file order, exactly as if
+  // the whole trace had been read at once
+  size_t nEvents = 0;
+  for (uint32_t i = 0; i < nThreads; i++)
+    {
+      nEvents += chunks[i].m_events.size ();
+    }
+  events.reserve (events.size () + nEvents);
+  for (uint32_t i = 0; i < nThreads; i++)
+    {
+      events.insert (events.end (), chunks[i].m_events.begin (), chunks[i].m_events.end ());
+      std::vector<Ns2TraceEvent> ().swap (chunks[i].m_events);
+    }
+  NS_LOG_DEBUG ("Read " << nEvents << " statements in " << nThreads << " chunks");
+#endif
 }
 
 
 void
-Ns2MobilityHelper::ConfigNodesMovements (const ObjectStore &store) const
+Ns2TraceChunk::Read (void)
 {
-  std::map<int, DestinationPoint> last_pos;    // Stores previous movement scheduled for each node
+  ReadTextChunk (m_begin, m_end, m_filter, m_events);
+}
 
-  //*****************************************************************
-  // Parse the file the first time to get the initial node positions.
-  //*****************************************************************
 
-  // Look through the whole the file for the the initial node
-  // positions to make this helper robust to handle trace files with
-  // the initial node positions at the end.
-  std::ifstream file (m_filename.c_str (), std::ios::in);
-  if (file.is_open ())
+void
+ReadTextChunk (const char *begin, const char *end, const Ns2TraceFilter *filter,
+               std::vector<Ns2TraceEvent> &events)
+{
+  // Size the event list once for the whole trace
+  size_t nLines = 0;
+  for (const char *p = begin; p != end && (p = static_cast<const char *> (std::memchr (p, '\n', end - p))) != 0; ++p)
     {
-      while (!file.eof () )
-        {
-          int         iNodeId = 0;
-          std::string nodeId;
-          std::string line;
-
-          getline (file, line);
-
-          // ignore empty lines
-          if (line.empty ())
-            {
-              continue;
-            }
-
-          ParseResult pr = ParseNs2Line (line); // Parse line and obtain tokens
+      nLines++;
+    }
+  events.reserve (events.size () + nLines + 1);
 
-          // Check if the line corresponds with setting the initial
-          // node positions
-          if (pr.tokens.size () != 4)
-            {
-              continue;
-            }
+  const char *line = begin;
+  while (line < end)
+    {
+      const char *eol = static_cast<const char *> (std::memchr (line, '\n', end - line));
+      if (eol == 0)
+        {
+          eol = end;
+        }
 
-          // Get the node Id
-          nodeId  = GetNodeIdString (pr);
-          iNodeId = GetNodeIdInt (pr);
-          if (iNodeId == -1)
-            {
-              NS_LOG_ERROR ("Node number couldn't be obtained (corrupted file?): " << line << "\n");
-              continue;
-            }
+      // the lines filtered out are not even tokenized
+      ParseResult pr;
+      Ns2TraceEvent ev;
+      if (filter != 0 && IsSkippedLine (line, eol, *filter))
+        {
+          NS_LOG_LOGIC ("Skipped line: " << std::string (line, eol));
+        }
+      else if (!ParseNs2Line (line, eol, pr))
+        {
+          NS_LOG_ERROR ("Line has not correct number of parameters (corrupted file?): " << std::string (line, eol) << "\n");
+        }
+      else if (pr.nTokens > 0 && GetNs2Event (pr, ev))
+        {
+          events.push_back (ev);
+        }
+      line = eol + 1;
+    }
+}
 
-          // get mobility model of node
-          Ptr<ConstantVelocityMobilityModel> model = GetMobilityModel (nodeId,store);
 
-          // if model not exists, continue
-          if (model == 0)
+bool
+IsSkippedLine (const char *line, const char *end, const Ns2TraceFilter &filter)
+{
+  // the node: the first word starting with $node_(
+  size_t length = std::strlen (NS2_NODEID);
+  for (const char *p = line; (p = static_cast<const char *> (std::memchr (p, '$', end - p))) != 0; ++p)
+    {
+      if (static_cast<size_t> (end - p) >= length && std::memcmp (p, NS2_NODEID, length) == 0)
+        {
+          const char *wordEnd = p;
+          while (wordEnd < end && !std::isspace (static_cast<unsigned char> (*wordEnd)))
             {
-              NS_LOG_ERROR ("Unknown node ID (corrupted file?): " << nodeId << "\n");
-              continue;
+              wordEnd++;
             }
-
-
-          /*
-           * In this case a initial position is being seted
-           * line like $node_(0) set X_ 151.05190721688197
-           */
-          if (IsSetInitialPos (pr))
+          uint32_t id;
+          if (GetNodeIdFromToken (p, wordEnd - p, id) && !filter.IsKept (id))
             {
-              DestinationPoint point;
-              //                                                    coord         coord value
-              point.m_finalPosition = SetInitialPosition (model, pr.tokens[2], pr.dvals[3]);
-              last_pos[iNodeId] = point;
-
-              // Log new position
-              NS_LOG_DEBUG ("Positions after parse for node " << iNodeId << " " << nodeId <<
-                            " position = " << last_pos[iNodeId].m_finalPosition);
+              return true;
             }
+          break;
         }
-      file.close ();
     }
 
-  //*****************************************************************
-  // Parse the file a second time to get the rest of its values
-  //*****************************************************************
-
-  // The reason the file is parsed again is to make this helper robust
-  // to handle trace files with the initial node positions at the end.
-  file.open (m_filename.c_str (), std::ios::in);
-  if (file.is_open ())
+  // the time: the third word of the lines starting with $ns_ at
+  if (filter.m_stop == std::numeric_limits<double>::infinity ())
+    {
+      return false;
+    }
+  ParseResult pr;
+  const char *p = line;
+  for (pr.nTokens = 0; pr.nTokens < 3; pr.nTokens++)
     {
-      while (!file.eof () )
+      while (p < end && std::isspace (static_cast<unsigned char> (*p)))
         {
-          int         iNodeId = 0;
-          std::string nodeId;
-          std::string line;
-
-          getline (file, line);
+          p++;
+        }
+      pr.tokens[pr.nTokens] = p;
+      while (p < end && !std::isspace (static_cast<unsigned char> (*p)))
+        {
+          p++;
+        }
+      pr.lengths[pr.nTokens] = p - pr.tokens[pr.nTokens];
+    }
+  double at;
+  return IsToken (pr, 0, NS2_NS_SCH) && IsToken (pr, 1, NS2_AT)
+         && IsNumber (pr.tokens[2], pr.lengths[2], at) && at > filter.m_stop;
+}
 
-          // ignore empty lines
-          if (line.empty ())
-            {
-              continue;
-            }
 
-          ParseResult pr = ParseNs2Line (line); // Parse line and obtain tokens
+bool
+IsSkippedEvent (const Ns2TraceEvent &ev, const Ns2TraceFilter &filter)
+{
+  return !filter.IsKept (ev.m_nodeId) || (ev.m_type != NS2_INITIAL_POS && ev.m_at > filter.m_stop);
+}
 
-          // Check if the line corresponds with one of the three types of line
-          if (pr.tokens.size () != 4 && pr.tokens.size () != 7 && pr.tokens.size () != 8)
-            {
-              NS_LOG_ERROR ("Line has not correct number of parameters (corrupted file?): " << line << "\n");
-              continue;
-            }
 
-          // Get the node Id
-          nodeId  = GetNodeIdString (pr);
-          iNodeId = GetNodeIdInt (pr);
-          if (iNodeId == -1)
-            {
-              NS_LOG_ERROR ("Node number couldn't be obtained (corrupted file?): " << line << "\n");
-              continue;
-            }
+Vector
+GetSegmentPosition (const WaypointTableMobilityModel::Segment &segment, double at)
+{
+  double t = at - TimeStep (segment.m_start).GetSeconds ();
+  return Vector (segment.m_position.x + segment.m_velocity.x * t,
+                 segment.m_position.y + segment.m_velocity.y * t,
+                 segment.m_position.z + segment.m_velocity.z * t);
+}
 
-          // get mobility model of node
-          Ptr<ConstantVelocityMobilityModel> model = GetMobilityModel (nodeId,store);
 
-          // if model not exists, continue
-          if (model == 0)
-            {
-              NS_LOG_ERROR ("Unknown node ID (corrupted file?): " << nodeId << "\n");
-              continue;
-            }
+bool
+EntersArea (const WaypointTableMobilityModel::Table &table, double start, double stop,
+            double horizon, const Rectangle &area)
+{
+  const std::vector<WaypointTableMobilityModel::Segment> &segments = table.m_segments;
 
+  // before its first segment, the node stays at its initial position
+  if ((segments.empty () || TimeStep (segments[0].m_start).GetSeconds () > start)
+      && area.IsInside (table.m_initialPosition))
+    {
+      return true;
+    }
+  for (size_t i = 0; i < segments.size (); i++)
+    {
+      double segmentStart = TimeStep (segments[i].m_start).GetSeconds ();
+      if (segmentStart > stop)
+        {
+          break;
+        }
+      double a = std::max (segmentStart, start);
+      double b = i + 1 < segments.size () ? TimeStep (segments[i + 1].m_start).GetSeconds () : std::max (horizon, a);
+      b = std::min (b, stop);
+      if (a <= b && CrossesArea (area, GetSegmentPosition (segments[i], a), GetSegmentPosition (segments[i], b)))
+        {
+          return true;
+        }
+    }
+  return false;
+}
 
-          /*
-           * In this case a initial position is being seted
-           * line like $node_(0) set X_ 151.05190721688197
-           */
-          if (IsSetInitialPos (pr))
-            {
-              // This is the second time this file has been parsed,
-              // and the initial node positions were already set the
-              // first time.  So, do nothing this time with this line.
-              continue;
-            }
 
-          else // NOW EVENTS TO BE SCHEDULED
+bool
+CrossesArea (const Rectangle &area, const Vector &a, const Vector &b)
+{
+  // clip the segment a + t (b - a), t in [0, 1], by each side in turn
+  double dx = b.x - a.x;
+  double dy = b.y - a.y;
+  double p[4] = { -dx, dx, -dy, dy };
+  double q[4] = { a.x - area.xMin, area.xMax - a.x, a.y - area.yMin, area.yMax - a.y };
+  double t0 = 0;
+  double t1 = 1;
+  for (uint32_t k = 0; k < 4; k++)
+    {
+      if (p[k] == 0)
+        {
+          // parallel to this side
+          if (q[k] < 0)
             {
-
-              // This is a scheduled event, so time at should be present
-              double at;
-
-              if (!IsNumber (pr.tokens[2]))
-                {
-                  NS_LOG_WARN ("Time is not a number: " << pr.tokens[2]);
-                  continue;
-                }
-
-              at = pr.dvals[2]; // set time at
-
-              if ( at < 0 )
-                {
-                  NS_LOG_WARN ("Time is less than cero: " << at);
-                  continue;
-                }
-
-
-
-              /*
-               * In this case a new waypoint is added
-               * line like $ns_ at 1 "$node_(0) setdest 2 3 4"
-               */
-              if (IsSchedMobilityPos (pr))
-                {
-                  if (last_pos[iNodeId].m_targetArrivalTime > at)
-                    {
-                      NS_LOG_LOGIC ("Did not reach a destination! stoptime = " << last_pos[iNodeId].m_targetArrivalTime << ", at = "<<  at);
-                      double actuallytraveled = at - last_pos[iNodeId].m_travelStartTime;
-                      Vector reached = Vector (
-                          last_pos[iNodeId].m_startPosition.x + last_pos[iNodeId].m_speed.x * actuallytraveled,
-                          last_pos[iNodeId].m_startPosition.y + last_pos[iNodeId].m_speed.y * actuallytraveled,
-                          0
-                          );
-                      NS_LOG_LOGIC ("Final point = " << last_pos[iNodeId].m_finalPosition << ", actually reached = " << reached);
-                      last_pos[iNodeId].m_stopEvent.Cancel ();
-                      last_pos[iNodeId].m_finalPosition = reached;
-                    }
-                  //                                     last position     time  X coord     Y coord      velocity
-                  last_pos[iNodeId] = SetMovement (model, last_pos[iNodeId].m_finalPosition, at, pr.dvals[5], pr.dvals[6], pr.dvals[7]);
-
-                  // Log new position
-                  NS_LOG_DEBUG ("Positions after parse for node " << iNodeId << " " << nodeId << " position =" << last_pos[iNodeId].m_finalPosition);
-                }
-
-
-              /*
-               * Scheduled set position
-               * line like $ns_ at 4.634906291962 "$node_(0) set X_ 28.675920486450"
-               */
-              else if (IsSchedSetPos (pr))
-                {
-                  //                                         time  coordinate   coord value
-                  last_pos[iNodeId].m_finalPosition = SetSchedPosition (model, at, pr.tokens[5], pr.dvals[6]);
-                  if (last_pos[iNodeId].m_targetArrivalTime > at)
-                    {
-                      last_pos[iNodeId].m_stopEvent.Cancel ();
-                    }
-                  last_pos[iNodeId].m_targetArrivalTime = at;
-                  last_pos[iNodeId].m_travelStartTime = at;
-                  // Log new position
-                  NS_LOG_DEBUG ("Positions after parse for node " << iNodeId << " " << nodeId <<
-                                " position =" << last_pos[iNodeId].m_finalPosition);
-                }
-              else
-                {
-                  NS_LOG_WARN ("Format Line is not correct: " << line << "\n");
-                }
+              return false;
             }
         }
-      file.close ();
+      else if (p[k] < 0)
+        {
+          t0 = std::max (t0, q[k] / p[k]);
+        }
+      else
+        {
+          t1 = std::min (t1, q[k] / p[k]);
+        }
     }
+  return t0 <= t1;
 }
 
 
-ParseResult
-ParseNs2Line (const std::string& str)
+bool
+StartsBefore (const WaypointTableMobilityModel::Segment &segment, int64_t step)
 {
-  ParseResult ret;
-  std::istringstream s;
-  std::string line;
+  return segment.m_start < step;
+}
 
-  // ignore comments (#)
-  size_t pos_sharp = str.find_first_of ('#');
-  if (pos_sharp != std::string::npos)
+
+void
+AddStartState (const WaypointTableMobilityModel::Table &table, double start,
+               double horizon, uint32_t nodeId, std::vector<Ns2TraceEvent> &events)
+{
+  // the last segment started before start: the statements at start
+  // itself are played again from the window
+  const std::vector<WaypointTableMobilityModel::Segment> &segments = table.m_segments;
+  std::vector<WaypointTableMobilityModel::Segment>::const_iterator next =
+    std::lower_bound (segments.begin (), segments.end (), Seconds (start).GetTimeStep (), &StartsBefore);
+  Vector position = table.m_initialPosition;
+  Vector velocity = Vector (0, 0, 0);
+  double end = horizon;
+  if (next != segments.begin ())
+    {
+      position = GetSegmentPosition (*(next - 1), start);
+      velocity = (next - 1)->m_velocity;
+      if (next != segments.end ())
+        {
+          end = TimeStep (next->m_start).GetSeconds ();
+        }
+    }
+
+  Ns2TraceEvent ev;
+  ev.m_at = 0;
+  ev.m_nodeId = nodeId;
+  ev.m_type = NS2_INITIAL_POS;
+  ev.m_y = 0;
+  ev.m_speed = 0;
+  double coords[3] = { position.x, position.y, position.z };
+  for (uint8_t coord = 0; coord < 3; coord++)
     {
-      line = str.substr (0, pos_sharp);
+      ev.m_coord = coord;
+      ev.m_x = coords[coord];
+      events.push_back (ev);
     }
-  else
+
+  // a movement under way goes on towards where the table takes it
+  double speed = std::sqrt (velocity.x * velocity.x + velocity.y * velocity.y);
+  if (speed > 0 && end > start)
     {
-      line = str;
+      ev.m_type = NS2_SCHED_SETDEST;
+      ev.m_coord = 0;
+      ev.m_x = position.x + velocity.x * (end - start);
+      ev.m_y = position.y + velocity.y * (end - start);
+      ev.m_speed = speed;
+      events.push_back (ev);
     }
+}
+
+
+bool
+IsBinaryTrace (const char *begin, const char *end)
+{
+  return static_cast<size_t> (end - begin) >= sizeof (Ns2BinaryTraceHeader)
+         && std::memcmp (begin, NS2_BINARY_MAGIC, sizeof (((Ns2BinaryTraceHeader *) 0)->m_magic)) == 0;
+}
 
-  line = TrimNs2Line (line);
 
-  // If line hasn't a correct node Id
-  if (!HasNodeIdNumber (line))
+bool
+ReadBinaryTrace (const char *begin, const char *end, std::vector<Ns2TraceEvent> &events)
+{
+  Ns2BinaryTraceHeader header;
+  std::memcpy (&header, begin, sizeof (header));
+  if (header.m_version != NS2_BINARY_VERSION)
     {
-      NS_LOG_WARN ("Line has no node Id: " << line);
-      return ret;
+      NS_LOG_ERROR ("Unsupported binary trace version " << header.m_version);
+      return false;
+    }
+  uint64_t n = header.m_nEvents;
+  uint64_t recordSize = 4 * sizeof (double) + sizeof (uint32_t) + sizeof (uint8_t);
+  if (n > (static_cast<uint64_t> (end - begin) - sizeof (header)) / recordSize
+      || sizeof (header) + n * recordSize != static_cast<uint64_t> (end - begin))
+    {
+      NS_LOG_ERROR ("Binary trace is truncated or corrupted");
+      return false;
     }
 
-  s.str (line);
-
-  while (!s.eof ())
+  // The columns are 8-byte aligned in the mapped file, so they can be
+  // read in place
+  const double *at = reinterpret_cast<const double *> (begin + sizeof (header));
+  const double *x = at + n;
+  const double *y = x + n;
+  const double *speed = y + n;
+  const uint32_t *nodeId = reinterpret_cast<const uint32_t *> (speed + n);
+  const uint8_t *kind = reinterpret_cast<const uint8_t *> (nodeId + n);
+
+  events.resize (n);
+  for (uint64_t i = 0; i < n; i++)
     {
-      std::string x;
-      s >> x;
-      if (x.length () == 0)
-        {
-          continue;
-        }
-      ret.tokens.push_back (x);
-      int ii (0);
-      double d (0);
-      if (HasNodeIdNumber (x))
+      Ns2TraceEvent &ev = events[i];
+      ev.m_at = at[i];
+      ev.m_x = x[i];
+      ev.m_y = y[i];
+      ev.m_speed = speed[i];
+      ev.m_nodeId = nodeId[i];
+      ev.m_type = kind[i] & 0x3;
+      ev.m_coord = kind[i] >> 2;
+      if (ev.m_type > NS2_SCHED_SET || ev.m_coord > 2 || ev.m_nodeId > NS2_MAX_NODE_ID)
         {
-          x = GetNodeIdFromToken (x);
+          NS_LOG_ERROR ("Binary trace is corrupted at record " << i);
+          events.clear ();
+          return false;
         }
-      ret.has_ival.push_back (IsVal<int> (x, ii));
-      ret.ivals.push_back (ii);
-      ret.has_dval.push_back (IsVal<double> (x, d));
-      ret.dvals.push_back (d);
-      ret.svals.push_back (x);
     }
+  NS_LOG_DEBUG ("Loaded binary trace: " << n << " statements, " << header.m_nNodes << " nodes, time ["
+                                        << header.m_startTime << ", " << header.m_stopTime << "]");
+  return true;
+}
 
-  size_t tokensLength   = ret.tokens.size ();                 // number of tokens in line
-  size_t lasTokenLength = ret.tokens[tokensLength - 1].size (); // length of the last token
 
-  // if it is a scheduled set _[XYZ] or a setdest I need to remove the last "
-  // and re-calculate values
-  if ( (tokensLength == 7 || tokensLength == 8)
-       && (ret.tokens[tokensLength - 1][lasTokenLength - 1] == '"') )
-    {
+bool
+ParseNs2Line (const char *line, const char *end, ParseResult &pr)
+{
+  pr.nTokens = 0;
 
-      // removes " from the last position
-      ret.tokens[tokensLength - 1] = ret.tokens[tokensLength - 1].substr (0,lasTokenLength - 1);
+  // ignore comments (#)
+  const char *sharp = static_cast<const char *> (std::memchr (line, '#', end - line));
+  if (sharp != 0)
+    {
+      end = sharp;
+    }
 
-      std::string x;
-      x = ret.tokens[tokensLength - 1];
+  // trim trailing blanks or semi-colon (;)
+  while (end > line && (std::isspace (static_cast<unsigned char> (end[-1])) || end[-1] == ';'))
+    {
+      end--;
+    }
 
-      if (HasNodeIdNumber (x))
+  const char *p = line;
+  while (p < end)
+    {
+      // skip blanks between tokens
+      while (p < end && std::isspace (static_cast<unsigned char> (*p)))
         {
-          x = GetNodeIdFromToken (x);
+          p++;
         }
+      if (p == end)
+        {
+          break;
+        }
+      const char *tokenStart = p;
+      while (p < end && !std::isspace (static_cast<unsigned char> (*p)))
+        {
+          p++;
+        }
+      if (pr.nTokens == NS2_MAX_TOKENS)
+        {
+          return false;
+        }
+      pr.tokens[pr.nTokens] = tokenStart;
+      pr.lengths[pr.nTokens] = p - tokenStart;
+      pr.nTokens++;
+    }
 
-      // Re calculate values
-      int ii (0);
-      double d (0);
-      ret.has_ival[tokensLength - 1] = IsVal<int> (x, ii);
-      ret.ivals[tokensLength - 1] = ii;
-      ret.has_dval[tokensLength - 1] = IsVal<double> (x, d);
-      ret.dvals[tokensLength - 1] = d;
-      ret.svals[tokensLength - 1] = x;
-
+  if (pr.nTokens == 0)
+    {
+      return true;
     }
-  else if ( (tokensLength == 9 && ret.tokens[tokensLength - 1] == "\"")
-            || (tokensLength == 8 && ret.tokens[tokensLength - 1] == "\""))
+
+  uint32_t last = pr.nTokens - 1;
+  if ((pr.nTokens == 9 || pr.nTokens == 8) && IsToken (pr, last, "\""))
     {
       // if the line has the " character in this way: $ns_ at 1 "$node_(0) setdest 2 2 1  "
       // or in this: $ns_ at 4 "$node_(0) set X_ 2  " we need to ignore this last token
+      pr.nTokens--;
+    }
+  else if ((pr.nTokens == 7 || pr.nTokens == 8) && pr.tokens[last][pr.lengths[last] - 1] == '"')
+    {
+      // if it is a scheduled set _[XYZ] or a setdest I need to remove the last "
+      pr.lengths[last]--;
+    }
+  return true;
+}
 
-      ret.tokens.erase (ret.tokens.begin () + tokensLength - 1);
-      ret.has_ival.erase (ret.has_ival.begin () + tokensLength - 1);
-      ret.ivals.erase (ret.ivals.begin () + tokensLength - 1);
-      ret.has_dval.erase (ret.has_dval.begin () + tokensLength - 1);
-      ret.dvals.erase (ret.dvals.begin () + tokensLength - 1);
-      ret.svals.erase (ret.svals.begin () + tokensLength - 1);
 
+bool
+GetNs2Event (const ParseResult &pr, Ns2TraceEvent &ev)
+{
+  const char *line = pr.tokens[0];
+  const char *lineEnd = pr.tokens[pr.nTokens - 1] + pr.lengths[pr.nTokens - 1];
+
+  // Check if the line corresponds with one of the three types of line
+  if (pr.nTokens != 4 && pr.nTokens != 7 && pr.nTokens != 8)
+    {
+      NS_LOG_ERROR ("Line has not correct number of parameters (corrupted file?): " << std::string (line, lineEnd) << "\n");
+      return false;
     }
 
+  // Get the node Id
+  uint32_t idToken = (pr.nTokens == 4) ? 0 : 3;
+  if (!GetNodeIdFromToken (pr.tokens[idToken], pr.lengths[idToken], ev.m_nodeId))
+    {
+      NS_LOG_WARN ("Line has no node Id, or one above " << NS2_MAX_NODE_ID << ": " << std::string (line, lineEnd));
+      return false;
+    }
 
+  ev.m_at = 0;
+  ev.m_coord = 0;
+  ev.m_x = 0;
+  ev.m_y = 0;
+  ev.m_speed = 0;
+
+  /*
+   * In this case a initial position is being seted
+   * line like $node_(0) set X_ 151.05190721688197
+   */
+  if (pr.nTokens == 4)
+    {
+      if (IsToken (pr, 1, NS2_SET) && GetCoordFromToken (pr, 2, ev.m_coord)
+          && IsNumber (pr.tokens[3], pr.lengths[3], ev.m_x))
+        {
+          ev.m_type = NS2_INITIAL_POS;
+          return true;
+        }
+      NS_LOG_WARN ("Format Line is not correct: " << std::string (line, lineEnd) << "\n");
+      return false;
+    }
 
-  return ret;
-}
+  // NOW EVENTS TO BE SCHEDULED
+  if (!IsToken (pr, 0, NS2_NS_SCH) || !IsToken (pr, 1, NS2_AT))
+    {
+      NS_LOG_WARN ("Format Line is not correct: " << std::string (line, lineEnd) << "\n");
+      return false;
+    }
 
+  // This is a scheduled event, so time at should be present
+  if (!IsNumber (pr.tokens[2], pr.lengths[2], ev.m_at))
+    {
+      NS_LOG_WARN ("Time is not a number: " << std::string (pr.tokens[2], pr.lengths[2]));
+      return false;
+    }
 
-std::string
-TrimNs2Line (const std::string& s)
-{
-  std::string ret = s;
+  if (ev.m_at < 0)
+    {
+      NS_LOG_WARN ("Time is less than cero: " << ev.m_at);
+      return false;
+    }
 
-  while (ret.size () > 0 && isblank (ret[0]))
+  /*
+   * In this case a new waypoint is added
+   * line like $ns_ at 1 "$node_(0) setdest 2 3 4"
+   */
+  if (pr.nTokens == 8 && IsToken (pr, 4, NS2_SETDEST)
+      && IsNumber (pr.tokens[5], pr.lengths[5], ev.m_x)
+      && IsNumber (pr.tokens[6], pr.lengths[6], ev.m_y)
+      && IsNumber (pr.tokens[7], pr.lengths[7], ev.m_speed))
     {
-      ret.erase (0, 1);    // Removes blank spaces at the begining of the line
+      ev.m_type = NS2_SCHED_SETDEST;
+      return true;
     }
 
-  // trim trailing blanks or semi-colon (;)
-  while (ret.size () > 0 && (isblank (ret[ret.size () - 1]) || (ret[ret.size () - 1] == ';')))
+  /*
+   * Scheduled set position
+   * line like $ns_ at 4.634906291962 "$node_(0) set X_ 28.675920486450"
+   */
+  if (pr.nTokens == 7 && IsToken (pr, 4, NS2_SET) && GetCoordFromToken (pr, 5, ev.m_coord)
+      && IsNumber (pr.tokens[6], pr.lengths[6], ev.m_x))
     {
-      ret.erase (ret.size () - 1, 1); // Removes blank spaces from at end of line
+      ev.m_type = NS2_SCHED_SET;
+      return true;
     }
 
-  return ret;
+  NS_LOG_WARN ("Format Line is not correct: " << std::string (line, lineEnd) << "\n");
+  return false;
 }
 
 
 bool
-IsNumber (const std::string& s)
+IsToken (const ParseResult &pr, uint32_t i, const char *str)
 {
-  char *endp;
-  double v = strtod (s.c_str (), &endp); // declared with warn_unused_result
-  NS_UNUSED (v); // suppress "set but not used" compiler warning
-  return endp == s.c_str () + s.size ();
+  uint32_t length = std::strlen (str);
+  return pr.lengths[i] == length && std::memcmp (pr.tokens[i], str, length) == 0;
 }
 
 
-template<class T>
-bool IsVal (const std::string& str, T& ret)
+bool
+IsNumber (const char *s, uint32_t length, double &ret)
 {
-  if (str.size () == 0)
+  if (length == 0 || length > NS2_MAX_NUMBER_LENGTH)
     {
       return false;
     }
-  else if (IsNumber (str))
-    {
-      std::string s2 = str;
-      std::istringstream s (s2);
-      s >> ret;
-      return true;
-    }
-  else
+  // strtod needs a terminated string, which the trace buffer is not
+  char buf[NS2_MAX_NUMBER_LENGTH + 1];
+  std::memcpy (buf, s, length);
+  buf[length] = '\0';
+  char *endp;
+  double v = std::strtod (buf, &endp);
+  if (endp != buf + length)
     {
       return false;
     }
+  ret = v;
+  return true;
 }
 
 
 bool
-HasNodeIdNumber (std::string str)
+GetNodeIdFromToken (const char *s, uint32_t length, uint32_t &id)
 {
-
   // find brackets
-  std::string::size_type startNodeId = str.find_first_of ("("); // index of left bracket
-  std::string::size_type endNodeId   = str.find_first_of (")"); // index of right bracket
+  const char *startNodeId = static_cast<const char *> (std::memchr (s, '(', length)); // left bracket
+  const char *endNodeId   = static_cast<const char *> (std::memchr (s, ')', length)); // right bracket
 
-  // Get de nodeId in a string and in a int value
-  std::string nodeId;     // node id
-
-  // if no brackets, continue!
-  if (startNodeId == std::string::npos || endNodeId == std::string::npos)
+  // if no brackets, or nothing between them
+  if (startNodeId == 0 || endNodeId == 0 || endNodeId <= startNodeId + 1)
     {
       return false;
     }
 
-  nodeId = str.substr (startNodeId + 1, endNodeId - (startNodeId + 1)); // set node id
-
-  //   is number              is integer                                       is not negative
-  if (IsNumber (nodeId) && (nodeId.find_first_of (".") == std::string::npos) && (nodeId[0] != '-'))
-    {
-      return true;
-    }
-  else
+  // node id must be a non negative integer
+  uint32_t value = 0;
+  for (const char *p = startNodeId + 1; p != endNodeId; ++p)
     {
-      return false;
+      if (!std::isdigit (static_cast<unsigned char> (*p)))
+        {
+          return false;
+        }
+      value = value * 10 + (*p - '0');
+      // checked on every digit, so that the value never overflows
+      if (value > NS2_MAX_NODE_ID)
+        {
+          return false;
+        }
     }
+  id = value;
+  return true;
 }
 
 
-std::string
-GetNodeIdFromToken (std::string str)
+bool
+GetCoordFromToken (const ParseResult &pr, uint32_t i, uint8_t &coord)
 {
-  if (HasNodeIdNumber (str))
+  if (IsToken (pr, i, NS2_X_COORD))
     {
-      // find brackets
-      std::string::size_type startNodeId = str.find_first_of ("(");     // index of left bracket
-      std::string::size_type endNodeId   = str.find_first_of (")");     // index of right bracket
-
-      return str.substr (startNodeId + 1, endNodeId - (startNodeId + 1)); // set node id
+      coord = 0;
     }
-  else
+  else if (IsToken (pr, i, NS2_Y_COORD))
     {
-      return "";
+      coord = 1;
     }
-}
-
-
-int
-GetNodeIdInt (ParseResult pr)
-{
-  int result = -1;
-  switch (pr.tokens.size ())
+  else if (IsToken (pr, i, NS2_Z_COORD))
     {
-    case 4:   // line like $node_(0) set X_ 11
-      result = pr.ivals[0];
-      break;
-    case 7:   // line like $ns_ at 4 "$node_(0) set X_ 28"
-      result = pr.ivals[3];
-      break;
-    case 8:   // line like $ns_ at 1 "$node_(0) setdest 2 3 4"
-      result = pr.ivals[3];
-      break;
-    default:
-      result = -1;
+      coord = 2;
     }
-  return result;
-}
-
-// Get node id number in string format
-std::string
-GetNodeIdString (ParseResult pr)
-{
-  switch (pr.tokens.size ())
+  else
     {
-    case 4:   // line like $node_(0) set X_ 11
-      return pr.svals[0];
-      break;
-    case 7:   // line like $ns_ at 4 "$node_(0) set X_ 28"
-      return pr.svals[3];
-      break;
-    case 8:   // line like $ns_ at 1 "$node_(0) setdest 2 3 4"
-      return pr.svals[3];
-      break;
-    default:
-      return "";
+      return false;
     }
+  return true;
 }
 
 
 Vector
-SetOneInitialCoord (Vector position, std::string& coord, double value)
+SetOneInitialCoord (Vector position, uint8_t coord, double value)
 {
 
   // set the position for the coord.
-  if (coord == NS2_X_COORD)
+  if (coord == 0)
     {
       position.x = value;
       NS_LOG_DEBUG ("X=" << value);
     }
-  else if (coord == NS2_Y_COORD)
+  else if (coord == 1)
     {
       position.y = value;
       NS_LOG_DEBUG ("Y=" << value);
     }
-  else if (coord == NS2_Z_COORD)
+  else if (coord == 2)
     {
       position.z = value;
       NS_LOG_DEBUG ("Z=" << value);
@@ -662,41 +2176,8 @@ SetOneInitialCoord (Vector position, std::string& coord, double value)
   return position;
 }
 
-
-bool
-IsSetInitialPos (ParseResult pr)
-{
-  //        number of tokens         has $node_( ?                        has "set"           has doble for position?
-  return pr.tokens.size () == 4 && HasNodeIdNumber (pr.tokens[0]) && pr.tokens[1] == NS2_SET && pr.has_dval[3]
-         // coord name is X_, Y_ or Z_ ?
-         && (pr.tokens[2] == NS2_X_COORD || pr.tokens[2] == NS2_Y_COORD || pr.tokens[2] == NS2_Z_COORD);
-
-}
-
-
-bool
-IsSchedSetPos (ParseResult pr)
-{
-  //      correct number of tokens,    has $ns_                   and at
-  return pr.tokens.size () == 7 && pr.tokens[0] == NS2_NS_SCH && pr.tokens[1] == NS2_AT
-         && pr.tokens[4] == NS2_SET && pr.has_dval[2] && pr.has_dval[3]   // has set and double value for time and nodeid
-         && ( pr.tokens[5] == NS2_X_COORD || pr.tokens[5] == NS2_Y_COORD || pr.tokens[5] == NS2_Z_COORD) // has X_, Y_ or Z_?
-         && pr.has_dval[2]; // time is a number
-}
-
-bool
-IsSchedMobilityPos (ParseResult pr)
-{
-  //     number of tokens      and    has $ns_                and    has at
-  return pr.tokens.size () == 8 && pr.tokens[0] == NS2_NS_SCH && pr.tokens[1] == NS2_AT
-         //    time             x coord          y coord          velocity are numbers?
-         && pr.has_dval[2] && pr.has_dval[5] && pr.has_dval[6] && pr.has_dval[7]
-         && pr.tokens[4] == NS2_SETDEST; // and has setdest
-
-}
-
 DestinationPoint
-SetMovement (Ptr<ConstantVelocityMobilityModel> model, Vector last_pos, double at,
+SetMovement (Ns2MobilitySchedule &schedule, Ptr<MobilityModel> model, Vector last_pos, double at,
              double xFinalPosition, double yFinalPosition, double speed)
 {
   DestinationPoint retval;
@@ -708,8 +2189,7 @@ SetMovement (Ptr<ConstantVelocityMobilityModel> model, Vector last_pos, double a
   if (speed == 0)
     {
       // We have to maintain last position, and stop the movement
-      retval.m_stopEvent = Simulator::Schedule (Seconds (at), &ConstantVelocityMobilityModel::SetVelocity, model,
-                                                Vector (0, 0, 0));
+      retval.m_stopAction = schedule.AddVelocity (model, at, Vector (0, 0, 0));
       return retval;
     }
   if (speed > 0)
@@ -732,8 +2212,8 @@ SetMovement (Ptr<ConstantVelocityMobilityModel> model, Vector last_pos, double a
       NS_LOG_DEBUG ("Calculated Speed: X=" << xSpeed << " Y=" << ySpeed << " Z=" << zSpeed);
 
       // Set the Values
-      Simulator::Schedule (Seconds (at), &ConstantVelocityMobilityModel::SetVelocity, model, Vector (xSpeed, ySpeed, zSpeed));
-      retval.m_stopEvent = Simulator::Schedule (Seconds (at + time), &ConstantVelocityMobilityModel::SetVelocity, model, Vector (0, 0, 0));
+      schedule.AddVelocity (model, at, Vector (xSpeed, ySpeed, zSpeed));
+      retval.m_stopAction = schedule.AddVelocity (model, at + time, Vector (0, 0, 0));
       retval.m_finalPosition.x += xSpeed * time;
       retval.m_finalPosition.y += ySpeed * time;
       retval.m_targetArrivalTime += time;
@@ -743,32 +2223,23 @@ SetMovement (Ptr<ConstantVelocityMobilityModel> model, Vector last_pos, double a
 
 
 Vector
-SetInitialPosition (Ptr<ConstantVelocityMobilityModel> model, std::string coord, double coordVal)
+SetInitialPosition (Ptr<MobilityModel> model, Vector &position, uint8_t coord, double coordVal)
 {
-  model->SetPosition (SetOneInitialCoord (model->GetPosition (), coord, coordVal));
-
-  Vector position;
-  position.x = model->GetPosition ().x;
-  position.y = model->GetPosition ().y;
-  position.z = model->GetPosition ().z;
-
+  position = SetOneInitialCoord (position, coord, coordVal);
+  model->SetPosition (position);
   return position;
 }
 
 // Schedule a set of position for a node
 Vector
-SetSchedPosition (Ptr<ConstantVelocityMobilityModel> model, double at, std::string coord, double coordVal)
+SetSchedPosition (Ns2MobilitySchedule &schedule, Ptr<MobilityModel> model,
+                  Vector &position, double at, uint8_t coord, double coordVal)
 {
   // update position
-  model->SetPosition (SetOneInitialCoord (model->GetPosition (), coord, coordVal));
-
-  Vector position;
-  position.x = model->GetPosition ().x;
-  position.y = model->GetPosition ().y;
-  position.z = model->GetPosition ().z;
+  position = SetOneInitialCoord (position, coord, coordVal);
 
   // Chedule next positions
-  Simulator::Schedule (Seconds (at), &ConstantVelocityMobilityModel::SetPosition, model,position);
+  schedule.AddPosition (model, at, position);
 
   return position;
 }
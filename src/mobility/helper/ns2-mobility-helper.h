@@ -0,0 +1,312 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/*
+ * Copyright (c) 2007 INRIA
+ *               2009,2010 Contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation;
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * Author: Mathieu Lacage <mathieu.lacage@sophia.inria.fr>
+ * Contributors: Thomas Waldecker <twaldecker@rocketmail.com>
+ *               Martín Giachino <martin.giachino@gmail.com>
+ */
+#ifndef NS2_MOBILITY_HELPER_H
+#define NS2_MOBILITY_HELPER_H
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include "ns3/ptr.h"
+#include "ns3/object.h"
+#include "ns3/nstime.h"
+#include "ns3/rectangle.h"
+
+namespace ns3 {
+
+class MobilityModel;
+class Ns2TraceStore;
+
+/**
+ * \ingroup mobility
+ * \brief Helper class which can read ns-2 movement files and configure nodes mobility.
+ *
+ * This implementation is based on the ns2 movement documentation of ns2
+ * as described in http://www.isi.edu/nsnam/ns/doc/node172.html
+ *
+ * Valid trace files use the following ns2 statements:
+   \verbatim
+   $node set X_ x1
+   $node set Y_ y1
+   $node set Z_ z1
+   $ns at $time $node setdest x2 y2 speed
+   $ns at $time $node set X_ x1
+   $ns at $time $node set Y_ Y1
+   $ns at $time $node set Z_ Z1
+   \endverbatim
+ *
+ * Note that initial position statements may also appear at the end of
+ * the mobility file like this:
+   \verbatim
+   $ns at $time $node setdest x2 y2 speed
+   $ns at $time $node set X_ x1
+   $ns at $time $node set Y_ Y1
+   $ns at $time $node set Z_ Z1
+   $node set X_ x1
+   $node set Y_ y1
+   $node set Z_ z1
+   \endverbatim
+ *
+ * The file may also be a binary trace produced by ConvertToBinary ();
+ * such files are recognized by their header and loaded without any
+ * text parsing.
+ *
+ * The following tools are known to support this format:
+ *  - BonnMotion http://net.cs.uni-bonn.de/wg/cs/applications/bonnmotion/
+ *  - SUMO http://sourceforge.net/apps/mediawiki/sumo/index.php?title=Main_Page
+ *  - TraNS http://trans.epfl.ch/
+ *
+ *  See usage example in examples/mobility/ns2-mobility-trace.cc
+ *
+ * \bug Rounding errors may cause movement to diverge from the mobility
+ * pattern in ns-2 (using the same trace).
+ * See https://www.nsnam.org/bugzilla/show_bug.cgi?id=1316
+ */
+class Ns2MobilityHelper
+{
+public:
+  /**
+   * \param filename filename of file which contains the
+   *        ns2 movement trace.
+   */
+  Ns2MobilityHelper (std::string filename);
+
+  /**
+   * Read the ns2 trace file and configure the movement
+   * patterns of all nodes contained in the global ns3::NodeList
+   * whose nodeId is matches the nodeId of the nodes in the trace
+   * file.
+   */
+  void Install (void) const;
+
+  /**
+   * \param begin an iterator which points to the start of the input
+   *        object array.
+   * \param end an iterator which points to the end of the input
+   *        object array.
+   *
+   * Read the ns2 trace file and configure the movement
+   * patterns of all input objects. Each input object
+   * is identified by a unique node id which reflects
+   * the index of the object in the input array.  The
+   * statements of node ids beyond the array are ignored;
+   * lines with a node id above 1048575 are rejected.
+   */
+  template <typename T>
+  void Install (T begin, T end) const;
+
+  /**
+   * \param textFile ns2 movement trace to convert
+   * \param binaryFile name of the binary trace to write
+   * \return true if the binary trace was written
+   *
+   * Convert an ns2 movement trace into the versioned binary trace
+   * format: a header holding the number of nodes and the time bounds
+   * of the trace, followed by one array per field (time, node id,
+   * destination x and y, speed) of every valid statement.  The binary
+   * file is written under a temporary name and renamed once complete,
+   * so that concurrent simulations can safely share it read-only.
+   */
+  static bool ConvertToBinary (std::string textFile, std::string binaryFile);
+
+  /**
+   * \param filename ns2 movement trace, text or binary
+   * \param nThreads the most threads a text trace is parsed on, as
+   *        for SetParseThreads ()
+   * \return the number of valid statements of the trace, or -1 if it
+   *         could not be read
+   *
+   * Read a trace without configuring any node, e.g. to check it or to
+   * time its parsing.
+   */
+  static int64_t CountStatements (std::string filename, uint32_t nThreads = 1);
+
+  /**
+   * The statements of a trace file are parsed once per process and
+   * kept, read-only, for all the helpers installing the same file:
+   * the repetitions of a scenario do not read it again, as long as
+   * its modification time and size are unchanged.  Only the last few
+   * traces used are kept.  Forget the traces read so far, e.g. to
+   * bound the memory of a long sweep.
+   *
+   * The traces are shared without locking: the helpers of a process
+   * must all be used from the thread running its simulations.
+   */
+  static void ClearTraceCache (void);
+
+  /**
+   * \param window how far ahead of the current simulation time
+   *        movements are scheduled; zero (the default) schedules
+   *        every movement of the trace at install time.
+   *
+   * With a non-zero window, only the movements due within the next
+   * window are scheduled; the rest are scheduled window by window as
+   * the simulation advances.  This bounds the size of the event list,
+   * however long the trace.  When the scheduled statements of the trace
+   * are in time order, as those written by SUMO or BonnMotion are, they
+   * are also translated into movements window by window, from the
+   * statements the trace cache already holds, so that the movements
+   * pending are bounded too.  Otherwise every movement is derived at
+   * install time and kept until scheduled.
+   */
+  void SetScheduleWindow (Time window);
+
+  /**
+   * \param nThreads the most threads a text trace is parsed on;
+   *        zero (the default) uses one per processor.
+   *
+   * Large text traces are cut at line boundaries into chunks of at
+   * least 1 MiB, parsed concurrently; the statements read are the
+   * same, and in the same order, as with a single thread.  Binary
+   * traces are not parsed and are unaffected.
+   */
+  void SetParseThreads (uint32_t nThreads);
+
+  /**
+   * \param enable whether to play the trace back from tables
+   *
+   * When enabled, the nodes are given a WaypointTableMobilityModel
+   * holding all their trace movements, instead of a
+   * ConstantVelocityMobilityModel driven by scheduled velocity and
+   * position changes: installing the trace schedules no event at all.
+   * The schedule window is then irrelevant.  The tables of a trace
+   * are built once and shared, read-only, by all the helpers that
+   * install it: each model only keeps its position in the table.
+   */
+  void SetWaypointTable (bool enable);
+
+  /**
+   * \param start trace time to play the trace from
+   * \param stop trace time after which the statements are ignored
+   *
+   * Only install the part [start, stop] of the trace.  The nodes are
+   * given the position and the movement they have at start, and trace
+   * time start is played at the time Install is called: seconds 100 to
+   * 200 of a trace become the first 100 s of the simulation.  The lines
+   * scheduled after stop are skipped before being tokenized.
+   */
+  void SetTimeWindow (Time start, Time stop);
+
+  /**
+   * \param area the region of interest, in the x and y coordinates of
+   *        the trace
+   *
+   * Only install the nodes which are inside area at some time of the
+   * time window, or of the whole trace if no window is set.  The nodes
+   * keep their whole movement, inside and outside the area.
+   */
+  void SetArea (Rectangle area);
+
+  /**
+   * \param ids the node ids of the trace to install
+   *
+   * Only install the nodes of the trace with these ids; the lines of
+   * the other nodes are skipped before being tokenized.
+   */
+  void SetNodeFilter (const std::vector<uint32_t> &ids);
+
+  /**
+   * \return the number of nodes the trace is installed on: the highest
+   *          node id of the trace plus one, or, when a time window, an
+   *          area or a node filter is set, the number of nodes selected
+   *
+   * The selected nodes are numbered densely, in the order of their
+   * trace ids, so that Install configures the first GetNNodes () nodes
+   * and no node has to be created for the nodes filtered out.  The
+   * trace is read, or taken from the trace cache, to find them.
+   */
+  uint32_t GetNNodes (void) const;
+
+  /**
+   * \param id the id of an installed node
+   * \return the id of the same node in the trace file
+   */
+  uint32_t GetTraceNodeId (uint32_t id) const;
+
+  /**
+   * \return the smallest rectangle holding, in x and y, the positions
+   *          and destinations the trace gives its nodes, once filtered
+   *
+   * The nodes move in straight lines between these points, so that
+   * they always stay within the rectangle.
+   */
+  Rectangle GetBounds (void) const;
+private:
+  class ObjectStore
+  {
+public:
+    virtual ~ObjectStore () {}
+    virtual Ptr<Object> Get (uint32_t i) const = 0;
+    virtual uint32_t GetN (void) const = 0;
+  };
+  void ConfigNodesMovements (const ObjectStore &store) const;
+  Ptr<MobilityModel> GetMobilityModel (uint32_t id, const ObjectStore &store) const;
+  Ptr<Ns2TraceStore> GetTrace (void) const;
+  std::string m_filename;
+  Time m_scheduleWindow;
+  uint32_t m_parseThreads;
+  bool m_waypointTable;
+  Time m_windowStart;
+  Time m_windowStop;          // zero if no window is set
+  bool m_hasArea;
+  Rectangle m_area;
+  std::vector<uint32_t> m_nodeFilter;
+};
+
+} // namespace ns3
+
+namespace ns3 {
+
+template <typename T>
+void
+Ns2MobilityHelper::Install (T begin, T end) const
+{
+  class MyObjectStore : public ObjectStore
+  {
+public:
+    MyObjectStore (T begin, T end)
+      : m_begin (begin),
+        m_end (end)
+    {}
+    virtual Ptr<Object> Get (uint32_t i) const {
+      T iterator = m_begin;
+      iterator += i;
+      if (iterator >= m_end)
+        {
+          return 0;
+        }
+      return *iterator;
+    }
+    virtual uint32_t GetN (void) const {
+      return m_end - m_begin;
+    }
+private:
+    T m_begin;
+    T m_end;
+  };
+  ConfigNodesMovements (MyObjectStore (begin, end));
+}
+
+
+} // namespace ns3
+
+#endif /* NS2_MOBILITY_HELPER_H */
@@ -0,0 +1,256 @@
+/* -*-  Mode: C++; c-file-style: "gnu"; indent-tabs-mode:nil; -*- */
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation;
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+#include "ns3/log.h"
+#include "ns3/assert.h"
+#include "ns3/boolean.h"
+#include "ns3/simulator.h"
+
+#include "waypoint-table-mobility-model.h"
+
+NS_LOG_COMPONENT_DEFINE ("WaypointTableMobilityModel");
+
+namespace ns3 {
+
+NS_OBJECT_ENSURE_REGISTERED (WaypointTableMobilityModel);
+
+TypeId
+WaypointTableMobilityModel::GetTypeId (void)
+{
+  static TypeId tid = TypeId ("ns3::WaypointTableMobilityModel")
+    .SetParent<MobilityModel> ()
+    .AddConstructor<WaypointTableMobilityModel> ()
+    .AddAttribute ("CourseChangeEvents",
+                   "Notify each course change at the start of its segment, from an event, "
+                   "rather than when the model is next queried.",
+                   BooleanValue (false),
+                   MakeBooleanAccessor (&WaypointTableMobilityModel::m_courseChangeEvents),
+                   MakeBooleanChecker ())
+  ;
+  return tid;
+}
+
+WaypointTableMobilityModel::WaypointTableMobilityModel ()
+  : m_table (Create<Table> ()),
+    m_shared (false),
+    m_origin (0),
+    m_started (0),
+    m_courseChangeEvents (false)
+{
+}
+
+WaypointTableMobilityModel::~WaypointTableMobilityModel ()
+{
+}
+
+void
+WaypointTableMobilityModel::DoDispose (void)
+{
+  m_event.Cancel ();
+  m_table = 0;
+  MobilityModel::DoDispose ();
+}
+
+WaypointTableMobilityModel::Table &
+WaypointTableMobilityModel::GetOwnTable (void)
+{
+  if (m_shared)
+    {
+      m_table = Create<Table> (*m_table);
+      m_shared = false;
+    }
+  return const_cast<Table &> (*m_table);
+}
+
+void
+WaypointTableMobilityModel::SetTable (Ptr<const Table> table, Time origin)
+{
+  NS_ASSERT (table != 0);
+  m_event.Cancel ();
+  m_table = table;
+  m_shared = true;
+  m_origin = origin.GetTimeStep ();
+  m_started = 0;
+  Update ();
+  NotifyCourseChange ();
+  if (m_courseChangeEvents)
+    {
+      ScheduleNext ();
+    }
+}
+
+Ptr<const WaypointTableMobilityModel::Table>
+WaypointTableMobilityModel::GetTable (void) const
+{
+  return m_table;
+}
+
+void
+WaypointTableMobilityModel::AddVelocity (Time at, const Vector &velocity)
+{
+  Vector position = m_table->m_initialPosition;
+  if (!m_table->m_segments.empty ())
+    {
+      position = GetPositionAt (m_table->m_segments.back (), at.GetTimeStep ());
+    }
+  Add (at, position, velocity);
+}
+
+void
+WaypointTableMobilityModel::AddPosition (Time at, const Vector &position)
+{
+  Vector velocity = Vector (0.0, 0.0, 0.0);
+  if (!m_table->m_segments.empty ())
+    {
+      velocity = m_table->m_segments.back ().m_velocity;
+    }
+  Add (at, position, velocity);
+}
+
+void
+WaypointTableMobilityModel::Add (Time at, const Vector &position, const Vector &velocity)
+{
+  std::vector<Segment> &segments = GetOwnTable ().m_segments;
+  int64_t start = at.GetTimeStep () - m_origin;
+  NS_ASSERT_MSG (segments.empty () || start >= segments.back ().m_start,
+                 "Changes must be added in time order");
+  if (!segments.empty () && start == segments.back ().m_start)
+    {
+      // several changes at once: only the last one is seen
+      segments.back ().m_position = position;
+      segments.back ().m_velocity = velocity;
+    }
+  else
+    {
+      Segment segment;
+      segment.m_start = start;
+      segment.m_position = position;
+      segment.m_velocity = velocity;
+      segments.push_back (segment);
+    }
+  if (m_courseChangeEvents && !m_event.IsRunning ())
+    {
+      ScheduleNext ();
+    }
+}
+
+uint32_t
+WaypointTableMobilityModel::GetNSegments (void) const
+{
+  return m_table->m_segments.size ();
+}
+
+Vector
+WaypointTableMobilityModel::GetPositionAt (const Segment &segment, int64_t step) const
+{
+  double t = TimeStep (step - m_origin - segment.m_start).GetSeconds ();
+  return Vector (segment.m_position.x + segment.m_velocity.x * t,
+                 segment.m_position.y + segment.m_velocity.y * t,
+                 segment.m_position.z + segment.m_velocity.z * t);
+}
+
+bool
+WaypointTableMobilityModel::Update (void) const
+{
+  // time only moves forward, and so does the cursor
+  const std::vector<Segment> &segments = m_table->m_segments;
+  int64_t now = Simulator::Now ().GetTimeStep () - m_origin;
+  uint32_t started = m_started;
+  while (m_started < segments.size () && segments[m_started].m_start <= now)
+    {
+      m_started++;
+    }
+  return m_started != started;
+}
+
+void
+WaypointTableMobilityModel::ScheduleNext (void)
+{
+  if (m_started < m_table->m_segments.size ())
+    {
+      Time at = TimeStep (m_origin + m_table->m_segments[m_started].m_start);
+      m_event = Simulator::Schedule (at - Simulator::Now (), &WaypointTableMobilityModel::CourseChange, this);
+    }
+}
+
+void
+WaypointTableMobilityModel::CourseChange (void)
+{
+  Update ();
+  NotifyCourseChange ();
+  ScheduleNext ();
+}
+
+Vector
+WaypointTableMobilityModel::DoGetPosition (void) const
+{
+  if (Update () && !m_courseChangeEvents)
+    {
+      NotifyCourseChange ();
+    }
+  if (m_started == 0)
+    {
+      return m_table->m_initialPosition;
+    }
+  return GetPositionAt (m_table->m_segments[m_started - 1], Simulator::Now ().GetTimeStep ());
+}
+
+Vector
+WaypointTableMobilityModel::DoGetVelocity (void) const
+{
+  if (Update () && !m_courseChangeEvents)
+    {
+      NotifyCourseChange ();
+    }
+  if (m_started == 0)
+    {
+      return Vector (0.0, 0.0, 0.0);
+    }
+  return m_table->m_segments[m_started - 1].m_velocity;
+}
+
+void
+WaypointTableMobilityModel::DoSetPosition (const Vector &position)
+{
+  // only the segment in effect is changed: the later ones keep their
+  // own positions, and the next course change is still due
+  Update ();
+  Table &table = GetOwnTable ();
+  if (m_started == 0)
+    {
+      table.m_initialPosition = position;
+    }
+  else
+    {
+      std::vector<Segment> &segments = table.m_segments;
+      int64_t now = Simulator::Now ().GetTimeStep () - m_origin;
+      if (segments[m_started - 1].m_start == now)
+        {
+          segments[m_started - 1].m_position = position;
+        }
+      else
+        {
+          Segment segment;
+          segment.m_start = now;
+          segment.m_position = position;
+          segment.m_velocity = segments[m_started - 1].m_velocity;
+          segments.insert (segments.begin () + m_started, segment);
+          m_started++;
+        }
+    }
+  NotifyCourseChange ();
+}
+
+} // namespace ns3
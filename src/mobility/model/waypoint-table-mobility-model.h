@@ -0,0 +1,141 @@
+/* -*-  Mode: C++; c-file-style: "gnu"; indent-tabs-mode:nil; -*- */
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation;
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef WAYPOINT_TABLE_MOBILITY_MODEL_H
+#define WAYPOINT_TABLE_MOBILITY_MODEL_H
+
+#include <vector>
+#include <stdint.h>
+#include "ns3/mobility-model.h"
+#include "ns3/nstime.h"
+#include "ns3/event-id.h"
+#include "ns3/simple-ref-count.h"
+
+namespace ns3 {
+
+/**
+ * \ingroup mobility
+ *
+ * \brief Mobility model playing back a table of constant velocity
+ * segments, without any event.
+ *
+ * The table is filled in time order, before or during the simulation,
+ * with the velocity and position changes a trace prescribes; each
+ * change starts a new segment.  The position and the velocity at the
+ * current time are computed from the segment in effect, found by a
+ * cursor which is only moved forward as time advances.
+ *
+ * Course changes are notified when the model is queried at or after
+ * the start of a later segment, once for all the segments crossed,
+ * rather than at the exact segment start.  With the CourseChangeEvents
+ * attribute set, they are notified on time instead, from a single
+ * event scheduled at the start of the next segment.
+ *
+ * Setting the position directly moves the node from there with the
+ * velocity in effect, until the start of the next segment: the later
+ * segments are kept, and played back from their own positions.
+ *
+ * The segments are kept in a Table, which several models, e.g. of the
+ * same trace node in successive simulations, can share read-only, each
+ * with its own cursor and time origin.  A model copies a shared table
+ * before changing it.
+ */
+class WaypointTableMobilityModel : public MobilityModel
+{
+public:
+  /**
+   * \brief Segment of constant velocity
+   */
+  struct Segment
+  {
+    int64_t m_start;   ///< time step at which the segment starts, from the table origin
+    Vector m_position; ///< position at m_start
+    Vector m_velocity; ///< velocity from m_start on
+  };
+
+  /**
+   * \brief Initial position and segments of a model, sorted by start
+   */
+  class Table : public SimpleRefCount<Table>
+  {
+public:
+    Vector m_initialPosition; ///< position before the first segment
+    std::vector<Segment> m_segments;
+  };
+
+  static TypeId GetTypeId (void);
+  WaypointTableMobilityModel ();
+  virtual ~WaypointTableMobilityModel ();
+
+  /**
+   * \param at when the velocity changes; not before the previous change
+   * \param velocity the new velocity
+   *
+   * The position at that time follows from the previous segments.
+   */
+  void AddVelocity (Time at, const Vector &velocity);
+
+  /**
+   * \param at when the node jumps; not before the previous change
+   * \param position the new position
+   *
+   * The velocity is kept, as with ConstantVelocityMobilityModel::SetPosition.
+   */
+  void AddPosition (Time at, const Vector &position);
+
+  /**
+   * \return the number of segments in the table
+   */
+  uint32_t GetNSegments (void) const;
+
+  /**
+   * \param table the table to play back; it must not be changed while
+   *        shared
+   * \param origin the time its segment starts are counted from
+   *
+   * The model starts over from the initial position of the table.
+   */
+  void SetTable (Ptr<const Table> table, Time origin);
+
+  /**
+   * \return the table played back
+   */
+  Ptr<const Table> GetTable (void) const;
+
+private:
+  Table &GetOwnTable (void);
+  void Add (Time at, const Vector &position, const Vector &velocity);
+  Vector GetPositionAt (const Segment &segment, int64_t step) const;
+  bool Update (void) const;
+  void ScheduleNext (void);
+  void CourseChange (void);
+
+  virtual Vector DoGetPosition (void) const;
+  virtual void DoSetPosition (const Vector &position);
+  virtual Vector DoGetVelocity (void) const;
+  virtual void DoDispose (void);
+
+  Ptr<const Table> m_table;
+  bool m_shared;              // whether m_table may be used by other models
+  int64_t m_origin;           // time step of the table origin
+  mutable uint32_t m_started; // number of segments started, the last of them in effect
+  bool m_courseChangeEvents;
+  EventId m_event;
+};
+
+} // namespace ns3
+
+#endif /* WAYPOINT_TABLE_MOBILITY_MODEL_H */
@@ -0,0 +1,240 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation;
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <fstream>
+#include <cstdio>
+#include <vector>
+#include "ns3/test.h"
+#include "ns3/simulator.h"
+#include "ns3/node-container.h"
+#include "ns3/waypoint-table-mobility-model.h"
+#include "ns3/ns2-mobility-helper.h"
+
+using namespace ns3;
+
+/**
+ * \brief Base of the trace reading tests: writes a synthetic trace
+ * and compares the waypoint tables installed from traces, which hold
+ * every movement the helper derived from their statements.
+ */
+class Ns2TraceTestCase : public TestCase
+{
+public:
+  Ns2TraceTestCase (std::string name);
+protected:
+  typedef std::vector<Ptr<const WaypointTableMobilityModel::Table> > Tables;
+  // Writes a text trace of nNodes nodes moving nSteps times each, with
+  // interrupted movements, scheduled sets, comments and initial
+  // positions at both ends of the file
+  void WriteTrace (std::string filename, uint32_t nNodes, uint32_t nSteps);
+  // Installs a trace on new nodes and returns their tables
+  Tables InstallTables (std::string filename, uint32_t nThreads);
+  void CheckSameTables (const Tables &expected, const Tables &actual);
+private:
+  double Draw (double min, double max);
+  uint32_t m_seed;
+};
+
+Ns2TraceTestCase::Ns2TraceTestCase (std::string name)
+  : TestCase (name),
+    m_seed (1)
+{
+}
+
+double
+Ns2TraceTestCase::Draw (double min, double max)
+{
+  // a fixed generator keeps the trace the same from run to run
+  m_seed = m_seed * 1103515245 + 12345;
+  return min + (max - min) * ((m_seed >> 8) & 0xffff) / 65536.0;
+}
+
+void
+Ns2TraceTestCase::WriteTrace (std::string filename, uint32_t nNodes, uint32_t nSteps)
+{
+  std::ofstream out (filename.c_str (), std::ios::out | std::ios::trunc);
+  out.precision (12);
+  out << "# synthetic trace, " << nNodes << " nodes\n";
+  for (uint32_t id = 0; id < nNodes / 2; id++)
+    {
+      out << "$node_(" << id << ") set X_ " << Draw (0, 1000) << "\n";
+      out << "$node_(" << id << ") set Y_ " << Draw (0, 1000) << "\n";
+      out << "$node_(" << id << ") set Z_ 0\n";
+    }
+  for (uint32_t step = 0; step < nSteps; step++)
+    {
+      for (uint32_t id = 0; id < nNodes; id++)
+        {
+          double at = step + Draw (0, 1);
+          if (step % 7 == 3)
+            {
+              out << "$ns_ at " << at << " \"$node_(" << id << ") set X_ " << Draw (0, 1000) << "\"\n";
+              continue;
+            }
+          // long movements, cut short by the next statement of the node
+          out << "$ns_ at " << at << " \"$node_(" << id << ") setdest "
+              << Draw (0, 1000) << " " << Draw (0, 1000) << " " << Draw (1, 40) << "\"\n";
+        }
+      if (step % 100 == 0)
+        {
+          out << "# step " << step << "\n";
+        }
+    }
+  for (uint32_t id = nNodes / 2; id < nNodes; id++)
+    {
+      out << "$node_(" << id << ") set X_ " << Draw (0, 1000) << "\n";
+      out << "$node_(" << id << ") set Y_ " << Draw (0, 1000) << "\n";
+    }
+  out.close ();
+}
+
+Ns2TraceTestCase::Tables
+Ns2TraceTestCase::InstallTables (std::string filename, uint32_t nThreads)
+{
+  Ns2MobilityHelper ns2 (filename);
+  ns2.SetWaypointTable (true);
+  ns2.SetParseThreads (nThreads);
+  NodeContainer nodes;
+  nodes.Create (ns2.GetNNodes ());
+  ns2.Install (nodes.Begin (), nodes.End ());
+  Tables tables;
+  for (NodeContainer::Iterator i = nodes.Begin (); i != nodes.End (); ++i)
+    {
+      tables.push_back ((*i)->GetObject<WaypointTableMobilityModel> ()->GetTable ());
+    }
+  return tables;
+}
+
+void
+Ns2TraceTestCase::CheckSameTables (const Tables &expected, const Tables &actual)
+{
+  NS_TEST_ASSERT_MSG_EQ (actual.size (), expected.size (), "Different number of nodes");
+  for (uint32_t id = 0; id < expected.size (); id++)
+    {
+      const WaypointTableMobilityModel::Table &a = *actual[id];
+      const WaypointTableMobilityModel::Table &e = *expected[id];
+      NS_TEST_EXPECT_MSG_EQ (a.m_initialPosition.x, e.m_initialPosition.x, "Initial x of node " << id);
+      NS_TEST_EXPECT_MSG_EQ (a.m_initialPosition.y, e.m_initialPosition.y, "Initial y of node " << id);
+      NS_TEST_ASSERT_MSG_EQ (a.m_segments.size (), e.m_segments.size (), "Movements of node " << id);
+      for (uint32_t i = 0; i < e.m_segments.size (); i++)
+        {
+          const WaypointTableMobilityModel::Segment &as = a.m_segments[i];
+          const WaypointTableMobilityModel::Segment &es = e.m_segments[i];
+          NS_TEST_EXPECT_MSG_EQ (as.m_start, es.m_start, "Start of movement " << i << " of node " << id);
+          NS_TEST_EXPECT_MSG_EQ (as.m_position.x, es.m_position.x, "Movement " << i << " of node " << id);
+          NS_TEST_EXPECT_MSG_EQ (as.m_position.y, es.m_position.y, "Movement " << i << " of node " << id);
+          NS_TEST_EXPECT_MSG_EQ (as.m_velocity.x, es.m_velocity.x, "Movement " << i << " of node " << id);
+          NS_TEST_EXPECT_MSG_EQ (as.m_velocity.y, es.m_velocity.y, "Movement " << i << " of node " << id);
+        }
+    }
+}
+
+
+/**
+ * \brief A binary trace converted from a text trace gives the nodes
+ * the same movements as the text trace.
+ */
+class Ns2BinaryTraceTestCase : public Ns2TraceTestCase
+{
+public:
+  Ns2BinaryTraceTestCase ();
+private:
+  virtual void DoRun (void);
+};
+
+Ns2BinaryTraceTestCase::Ns2BinaryTraceTestCase ()
+  : Ns2TraceTestCase ("Binary trace round trip")
+{
+}
+
+void
+Ns2BinaryTraceTestCase::DoRun (void)
+{
+  std::string textFile = CreateTempDirFilename ("ns2-binary-test.tcl");
+  std::string binaryFile = CreateTempDirFilename ("ns2-binary-test.bin");
+  WriteTrace (textFile, 20, 200);
+  NS_TEST_ASSERT_MSG_EQ (Ns2MobilityHelper::ConvertToBinary (textFile, binaryFile), true,
+                         "Could not convert the trace");
+  NS_TEST_ASSERT_MSG_EQ (Ns2MobilityHelper::ConvertToBinary (binaryFile, binaryFile + ".bin"), false,
+                         "A binary trace must not be converted again");
+
+  int64_t nStatements = Ns2MobilityHelper::CountStatements (textFile);
+  NS_TEST_ASSERT_MSG_GT (nStatements, 0, "No statement read");
+  NS_TEST_EXPECT_MSG_EQ (Ns2MobilityHelper::CountStatements (binaryFile), nStatements,
+                         "Different statements in the binary trace");
+  CheckSameTables (InstallTables (textFile, 1), InstallTables (binaryFile, 1));
+
+  Simulator::Destroy ();
+  Ns2MobilityHelper::ClearTraceCache ();
+  std::remove (textFile.c_str ());
+  std::remove (binaryFile.c_str ());
+}
+
+/**
+ * \brief A text trace parsed on several threads gives the nodes the
+ * same movements as when parsed on a single one.
+ */
+class Ns2ParseThreadsTestCase : public Ns2TraceTestCase
+{
+public:
+  Ns2ParseThreadsTestCase ();
+private:
+  virtual void DoRun (void);
+};
+
+Ns2ParseThreadsTestCase::Ns2ParseThreadsTestCase ()
+  : Ns2TraceTestCase ("Parallel trace parsing")
+{
+}
+
+void
+Ns2ParseThreadsTestCase::DoRun (void)
+{
+  std::string textFile = CreateTempDirFilename ("ns2-threads-test.tcl");
+  // a few MiB, so that the trace is cut into several chunks
+  WriteTrace (textFile, 100, 600);
+
+  int64_t nStatements = Ns2MobilityHelper::CountStatements (textFile, 1);
+  NS_TEST_ASSERT_MSG_GT (nStatements, 0, "No statement read");
+  NS_TEST_EXPECT_MSG_EQ (Ns2MobilityHelper::CountStatements (textFile, 4), nStatements,
+                         "Different statements read on 4 threads");
+
+  // the cache would otherwise give the second install the first parse
+  Tables expected = InstallTables (textFile, 1);
+  Ns2MobilityHelper::ClearTraceCache ();
+  CheckSameTables (expected, InstallTables (textFile, 4));
+
+  Simulator::Destroy ();
+  Ns2MobilityHelper::ClearTraceCache ();
+  std::remove (textFile.c_str ());
+}
+
+
+
+class Ns2MobilityHelperTestSuite : public TestSuite
+{
+public:
+  Ns2MobilityHelperTestSuite ();
+};
+
+Ns2MobilityHelperTestSuite::Ns2MobilityHelperTestSuite ()
+  : TestSuite ("ns2-mobility-helper", UNIT)
+{
+  AddTestCase (new Ns2BinaryTraceTestCase, TestCase::QUICK);
+  AddTestCase (new Ns2ParseThreadsTestCase, TestCase::QUICK);
+}
+
+static Ns2MobilityHelperTestSuite g_ns2MobilityHelperTestSuite;
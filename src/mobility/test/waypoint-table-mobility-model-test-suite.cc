@@ -0,0 +1,244 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation;
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include "ns3/test.h"
+#include "ns3/simulator.h"
+#include "ns3/boolean.h"
+#include "ns3/waypoint-table-mobility-model.h"
+
+using namespace ns3;
+
+/**
+ * \brief Base of the waypoint table tests: builds a table of three
+ * segments and checks positions from scheduled events.
+ *
+ * The node waits at the origin until 1 s, moves along x at 1 m/s
+ * until 3 s, then along y at 2 m/s; at 5 s it jumps to (100, 0, 0)
+ * and keeps moving along y.
+ */
+class WaypointTableTestCase : public TestCase
+{
+public:
+  WaypointTableTestCase (std::string name);
+protected:
+  Ptr<WaypointTableMobilityModel> CreateModel (bool courseChangeEvents);
+  Ptr<const WaypointTableMobilityModel::Table> CreateTable (void);
+  void CheckPosition (Ptr<MobilityModel> model, Vector expected);
+};
+
+WaypointTableTestCase::WaypointTableTestCase (std::string name)
+  : TestCase (name)
+{
+}
+
+Ptr<WaypointTableMobilityModel>
+WaypointTableTestCase::CreateModel (bool courseChangeEvents)
+{
+  Ptr<WaypointTableMobilityModel> model = CreateObject<WaypointTableMobilityModel> ();
+  model->SetAttribute ("CourseChangeEvents", BooleanValue (courseChangeEvents));
+  return model;
+}
+
+Ptr<const WaypointTableMobilityModel::Table>
+WaypointTableTestCase::CreateTable (void)
+{
+  Ptr<WaypointTableMobilityModel> model = CreateModel (false);
+  model->AddVelocity (Seconds (1), Vector (1, 0, 0));
+  model->AddVelocity (Seconds (3), Vector (0, 2, 0));
+  model->AddPosition (Seconds (5), Vector (100, 0, 0));
+  Ptr<const WaypointTableMobilityModel::Table> table = model->GetTable ();
+  model->Dispose ();
+  return table;
+}
+
+void
+WaypointTableTestCase::CheckPosition (Ptr<MobilityModel> model, Vector expected)
+{
+  Vector position = model->GetPosition ();
+  NS_TEST_EXPECT_MSG_EQ_TOL (position.x, expected.x, 1e-9,
+                             "Wrong x at " << Simulator::Now ().GetSeconds ());
+  NS_TEST_EXPECT_MSG_EQ_TOL (position.y, expected.y, 1e-9,
+                             "Wrong y at " << Simulator::Now ().GetSeconds ());
+}
+
+
+/**
+ * \brief The position is interpolated within the segment in effect,
+ * whichever time the model is queried at.
+ */
+class WaypointTableCursorTestCase : public WaypointTableTestCase
+{
+public:
+  WaypointTableCursorTestCase ();
+private:
+  virtual void DoRun (void);
+};
+
+WaypointTableCursorTestCase::WaypointTableCursorTestCase ()
+  : WaypointTableTestCase ("Positions between the waypoints")
+{
+}
+
+void
+WaypointTableCursorTestCase::DoRun (void)
+{
+  Ptr<WaypointTableMobilityModel> model = CreateModel (false);
+  model->SetTable (CreateTable (), Seconds (0));
+  NS_TEST_ASSERT_MSG_EQ (model->GetNSegments (), 3u, "Wrong number of segments");
+  Simulator::Schedule (Seconds (0.5), &WaypointTableCursorTestCase::CheckPosition, this,
+                       model, Vector (0, 0, 0));
+  Simulator::Schedule (Seconds (2), &WaypointTableCursorTestCase::CheckPosition, this,
+                       model, Vector (1, 0, 0));
+  Simulator::Schedule (Seconds (4), &WaypointTableCursorTestCase::CheckPosition, this,
+                       model, Vector (2, 2, 0));
+  // several segments crossed between two queries
+  Simulator::Schedule (Seconds (6), &WaypointTableCursorTestCase::CheckPosition, this,
+                       model, Vector (100, 2, 0));
+
+  // the same table played from a later origin
+  Ptr<WaypointTableMobilityModel> late = CreateModel (false);
+  late->SetTable (model->GetTable (), Seconds (10));
+  Simulator::Schedule (Seconds (6), &WaypointTableCursorTestCase::CheckPosition, this,
+                       late, Vector (0, 0, 0));
+  Simulator::Schedule (Seconds (12), &WaypointTableCursorTestCase::CheckPosition, this,
+                       late, Vector (1, 0, 0));
+  Simulator::Run ();
+  Simulator::Destroy ();
+}
+
+
+/**
+ * \brief Course changes are notified once per query crossing segment
+ * starts, or from an event at each segment start with
+ * CourseChangeEvents.
+ */
+class WaypointTableCourseChangeTestCase : public WaypointTableTestCase
+{
+public:
+  WaypointTableCourseChangeTestCase ();
+private:
+  virtual void DoRun (void);
+  void CourseChanged (Ptr<const MobilityModel> model);
+  uint32_t m_courseChanges;
+};
+
+WaypointTableCourseChangeTestCase::WaypointTableCourseChangeTestCase ()
+  : WaypointTableTestCase ("Lazy and scheduled course changes"),
+    m_courseChanges (0)
+{
+}
+
+void
+WaypointTableCourseChangeTestCase::CourseChanged (Ptr<const MobilityModel> model)
+{
+  m_courseChanges++;
+}
+
+void
+WaypointTableCourseChangeTestCase::DoRun (void)
+{
+  Ptr<const WaypointTableMobilityModel::Table> table = CreateTable ();
+
+  // lazy: one notification for the table, one for the query at 6 s
+  Ptr<WaypointTableMobilityModel> model = CreateModel (false);
+  model->TraceConnectWithoutContext ("CourseChange",
+                                     MakeCallback (&WaypointTableCourseChangeTestCase::CourseChanged, this));
+  m_courseChanges = 0;
+  model->SetTable (table, Seconds (0));
+  Simulator::Schedule (Seconds (6), &WaypointTableCourseChangeTestCase::CheckPosition, this,
+                       model, Vector (100, 2, 0));
+  Simulator::Run ();
+  NS_TEST_EXPECT_MSG_EQ (m_courseChanges, 2u, "Wrong number of lazy course changes");
+  Simulator::Destroy ();
+
+  // on time: one for the table and one at each of the three segment starts
+  model = CreateModel (true);
+  model->TraceConnectWithoutContext ("CourseChange",
+                                     MakeCallback (&WaypointTableCourseChangeTestCase::CourseChanged, this));
+  m_courseChanges = 0;
+  model->SetTable (table, Seconds (0));
+  Simulator::Run ();
+  NS_TEST_EXPECT_MSG_EQ (m_courseChanges, 4u, "Wrong number of scheduled course changes");
+  Simulator::Destroy ();
+}
+
+
+/**
+ * \brief Models sharing a table copy it before changing it, and
+ * setting the position keeps the segments not started yet.
+ */
+class WaypointTableSharingTestCase : public WaypointTableTestCase
+{
+public:
+  WaypointTableSharingTestCase ();
+private:
+  virtual void DoRun (void);
+};
+
+WaypointTableSharingTestCase::WaypointTableSharingTestCase ()
+  : WaypointTableTestCase ("Shared tables and position changes")
+{
+}
+
+void
+WaypointTableSharingTestCase::DoRun (void)
+{
+  Ptr<const WaypointTableMobilityModel::Table> table = CreateTable ();
+  Ptr<WaypointTableMobilityModel> a = CreateModel (false);
+  Ptr<WaypointTableMobilityModel> b = CreateModel (false);
+  a->SetTable (table, Seconds (0));
+  b->SetTable (table, Seconds (0));
+  NS_TEST_ASSERT_MSG_EQ (a->GetTable (), b->GetTable (), "The table is not shared");
+
+  a->AddPosition (Seconds (7), Vector (0, 0, 0));
+  NS_TEST_EXPECT_MSG_NE (a->GetTable (), table, "The shared table is changed in place");
+  NS_TEST_EXPECT_MSG_EQ (b->GetTable (), table, "The other model lost the shared table");
+  NS_TEST_EXPECT_MSG_EQ (table->m_segments.size (), 3u, "The shared table was changed");
+  NS_TEST_EXPECT_MSG_EQ (a->GetNSegments (), 4u, "Wrong number of segments of the copy");
+
+  // b jumps at 2 s, moves on from there until 3 s, then follows its
+  // table again; a is unaffected
+  Simulator::Schedule (Seconds (2), &MobilityModel::SetPosition, b, Vector (50, 50, 0));
+  Simulator::Schedule (Seconds (2.5), &WaypointTableSharingTestCase::CheckPosition, this,
+                       b, Vector (50.5, 50, 0));
+  Simulator::Schedule (Seconds (2.5), &WaypointTableSharingTestCase::CheckPosition, this,
+                       a, Vector (1.5, 0, 0));
+  Simulator::Schedule (Seconds (4), &WaypointTableSharingTestCase::CheckPosition, this,
+                       b, Vector (2, 2, 0));
+  Simulator::Schedule (Seconds (6), &WaypointTableSharingTestCase::CheckPosition, this,
+                       b, Vector (100, 2, 0));
+  Simulator::Run ();
+  NS_TEST_EXPECT_MSG_EQ (b->GetNSegments (), 4u, "The later segments were not kept");
+  NS_TEST_EXPECT_MSG_EQ (table->m_segments.size (), 3u, "The shared table was changed");
+  Simulator::Destroy ();
+}
+
+
+class WaypointTableMobilityModelTestSuite : public TestSuite
+{
+public:
+  WaypointTableMobilityModelTestSuite ();
+};
+
+WaypointTableMobilityModelTestSuite::WaypointTableMobilityModelTestSuite ()
+  : TestSuite ("waypoint-table-mobility-model", UNIT)
+{
+  AddTestCase (new WaypointTableCursorTestCase, TestCase::QUICK);
+  AddTestCase (new WaypointTableCourseChangeTestCase, TestCase::QUICK);
+  AddTestCase (new WaypointTableSharingTestCase, TestCase::QUICK);
+}
+
+static WaypointTableMobilityModelTestSuite g_waypointTableMobilityModelTestSuite;
@@ -20,16 +20,35 @@
  * 
  */
 #include "ns3/log.h"
+#include "ns3/fatal-error.h"
 #include "ns3/double.h"
 #include "ns3/enum.h"
+#include "ns3/uinteger.h"
+#include "ns3/boolean.h"
+#include "ns3/trace-source-accessor.h"
+#include "ns3/phase-profiler.h"
 #include "ns3/mobility-model.h"
 #include "ns3/vanet-topology.h"
 #include <cmath>
+#include <limits>
+#include <algorithm>
 
 #include "itu-r-1411-los-propagation-loss-model.h"
 
 NS_LOG_COMPONENT_DEFINE ("ItuR1411LosPropagationLossModel");
 
+// histogram of the added obstacle loss: 2 dB bins, the last one
+// collecting everything above 98 dB
+#define ITUR1411_OBSTACLE_BIN_WIDTH 2.0
+#define ITUR1411_OBSTACLE_BINS 50
+
+// how far below the CCA threshold, in dB, the links the delivery table
+// drops arrive at the receiver at most
+#define ITUR1411_HYBRID_DROP_MARGIN 1.0
+
+// default RxSensitivity, in dBm: low enough for any signal to be received
+#define ITUR1411_NO_SENSITIVITY -1000.0
+
 namespace ns3 {
 
 NS_OBJECT_ENSURE_REGISTERED (ItuR1411LosPropagationLossModel)
@@ -43,91 +62,490 @@ ItuR1411LosPropagationLossModel::GetTypeId (void)
     .SetParent<PropagationLossModel> ()
     .AddConstructor<ItuR1411LosPropagationLossModel> ()
 
+    .AddAttribute ("DefaultAntennaHeight",
+                   "Antenna height in m used for nodes whose position has z <= 0",
+                   DoubleValue (1.5),
+                   MakeDoubleAccessor (&ItuR1411LosPropagationLossModel::SetDefaultAntennaHeight),
+                   MakeDoubleChecker<double> ())
     .AddAttribute ("Frequency",
                    "The propagation frequency in Hz",
                    DoubleValue (2160e6),
                    MakeDoubleAccessor (&ItuR1411LosPropagationLossModel::SetFrequency),
-                   MakeDoubleChecker<double> ());
+                   MakeDoubleChecker<double> ())
+    .AddAttribute ("RxSensitivity",
+                   "Power in dBm below which no receiver can decode a signal.  Once set, "
+                   "the obstacle loss is not evaluated beyond the range at which neither "
+                   "it nor CcaThreshold can be reached.",
+                   DoubleValue (ITUR1411_NO_SENSITIVITY),
+                   MakeDoubleAccessor (&ItuR1411LosPropagationLossModel::SetRxSensitivity),
+                   MakeDoubleChecker<double> ())
+    .AddAttribute ("CcaThreshold",
+                   "Power in dBm below which a signal does not hold the medium busy, "
+                   "by default the YansWifiPhy CcaMode1Threshold.  The links beyond the "
+                   "range culled with RxSensitivity, and those the delivery table drops, "
+                   "arrive below it; their power is only approximate, which affects "
+                   "only the interference they add up to.",
+                   DoubleValue (-99.0),
+                   MakeDoubleAccessor (&ItuR1411LosPropagationLossModel::SetCcaThreshold),
+                   MakeDoubleChecker<double> ())
+    .AddAttribute ("CacheSize",
+                   "Number of slots of the pairwise loss cache, 0 to disable it",
+                   UintegerValue (0),
+                   MakeUintegerAccessor (&ItuR1411LosPropagationLossModel::SetCacheSize,
+                                         &ItuR1411LosPropagationLossModel::GetCacheSize),
+                   MakeUintegerChecker<uint32_t> ())
+    .AddAttribute ("CacheQuantization",
+                   "If greater than 0, size in m of the grid cells a node must stay in "
+                   "for its cached loss to be reused",
+                   DoubleValue (0.0),
+                   MakeDoubleAccessor (&ItuR1411LosPropagationLossModel::m_cacheQuantization),
+                   MakeDoubleChecker<double> (0.0))
+    .AddAttribute ("CacheEpsilon",
+                   "Without quantization, maximum per-coordinate displacement in m "
+                   "for a cached loss to be reused",
+                   DoubleValue (0.0),
+                   MakeDoubleAccessor (&ItuR1411LosPropagationLossModel::m_cacheEpsilon),
+                   MakeDoubleChecker<double> (0.0))
+    .AddAttribute ("ObstacleWallLoss",
+                   "Loss in dB added for each building wall a link crosses, with an "
+                   "ObstacleIndex set",
+                   DoubleValue (9.0),
+                   MakeDoubleAccessor (&ItuR1411LosPropagationLossModel::m_obstacleWallLoss),
+                   MakeDoubleChecker<double> (0.0))
+    .AddAttribute ("ObstacleDepthLoss",
+                   "Loss in dB added for each m of a link inside a building, with an "
+                   "ObstacleIndex set",
+                   DoubleValue (0.4),
+                   MakeDoubleAccessor (&ItuR1411LosPropagationLossModel::m_obstacleDepthLoss),
+                   MakeDoubleChecker<double> (0.0))
+    .AddAttribute ("LinkCacheSize",
+                   "Number of slots of the cache of unobstructed links, 0 to disable it",
+                   UintegerValue (0),
+                   MakeUintegerAccessor (&ItuR1411LosPropagationLossModel::SetLinkCacheSize,
+                                         &ItuR1411LosPropagationLossModel::GetLinkCacheSize),
+                   MakeUintegerChecker<uint32_t> ())
+    .AddAttribute ("LinkCacheMaxValidity",
+                   "Largest displacement in m over which an unobstructed link is not "
+                   "tested again; it also bounds the search for the nearest building",
+                   DoubleValue (50.0),
+                   MakeDoubleAccessor (&ItuR1411LosPropagationLossModel::m_linkCacheMaxValidity),
+                   MakeDoubleChecker<double> (0.0))
+    .AddAttribute ("HybridCoreRadius",
+                   "If greater than 0, distance in m beyond which the delivery of a "
+                   "link is drawn from a table instead of evaluating the obstacles; "
+                   "RxSensitivity must then be set",
+                   DoubleValue (0.0),
+                   MakeDoubleAccessor (&ItuR1411LosPropagationLossModel::m_hybridCoreRadius),
+                   MakeDoubleChecker<double> (0.0))
+    .AddAttribute ("HybridBinWidth",
+                   "Width in m of the distance bins of the delivery table",
+                   DoubleValue (10.0),
+                   MakeDoubleAccessor (&ItuR1411LosPropagationLossModel::m_hybridBinWidth),
+                   MakeDoubleChecker<double> (0.1))
+    .AddAttribute ("HybridCalibrationLinks",
+                   "Number of links of each distance bin evaluated with the full model "
+                   "to fill its entry of the delivery table",
+                   UintegerValue (200),
+                   MakeUintegerAccessor (&ItuR1411LosPropagationLossModel::m_hybridCalibrationLinks),
+                   MakeUintegerChecker<uint32_t> (1))
+    .AddAttribute ("HybridValidationInterval",
+                   "Also evaluate one in this many links drawn from the table with the "
+                   "full model, to measure the delivery drift; 0 to disable",
+                   UintegerValue (100),
+                   MakeUintegerAccessor (&ItuR1411LosPropagationLossModel::m_hybridValidationInterval),
+                   MakeUintegerChecker<uint32_t> ())
+    .AddAttribute ("EnableStatistics",
+                   "Count the loss evaluations, see PrintStatistics",
+                   BooleanValue (false),
+                   MakeBooleanAccessor (&ItuR1411LosPropagationLossModel::m_statsEnabled),
+                   MakeBooleanChecker ())
+
+    .AddTraceSource ("ObstacleLoss",
+                     "An obstructed link: line-of-sight loss and added obstacle loss, in dB",
+                     MakeTraceSourceAccessor (&ItuR1411LosPropagationLossModel::m_obstacleLossTrace));
 
   return tid;
 }
 
 ItuR1411LosPropagationLossModel::ItuR1411LosPropagationLossModel ()
-  : PropagationLossModel ()
+  : PropagationLossModel (),
+    m_defaultAntennaHeight (1.5),
+    m_bpHa (0.0),
+    m_bpHb (0.0),
+    m_rxSensitivity (ITUR1411_NO_SENSITIVITY),
+    m_ccaThreshold (-99.0),
+    m_cullTxPower (std::numeric_limits<double>::quiet_NaN ()),
+    m_cullRangeSq (0.0),
+    m_cacheQuantization (0.0),
+    m_cacheEpsilon (0.0),
+    m_cacheHits (0),
+    m_cacheMisses (0),
+    m_linkCacheMaxValidity (50.0),
+    m_obstacleIndex (0),
+    m_obstacleWallLoss (9.0),
+    m_obstacleDepthLoss (0.4),
+    m_linkCacheHits (0),
+    m_linkCacheMisses (0),
+    m_hybridCoreRadius (0.0),
+    m_hybridBinWidth (10.0),
+    m_hybridCalibrationLinks (200),
+    m_hybridValidationInterval (100),
+    m_deliveryTxPower (std::numeric_limits<double>::quiet_NaN ()),
+    m_nCoreLinks (0),
+    m_nCalibrationLinks (0),
+    m_nAbstractedLinks (0),
+    m_nAbstractedDelivered (0),
+    m_nValidationLinks (0),
+    m_nValidationFull (0),
+    m_nValidationTable (0),
+    m_statsEnabled (false)
 {
+  m_deliveryRandom = CreateObject<UniformRandomVariable> ();
+  ResetStatistics ();
 }
 
 ItuR1411LosPropagationLossModel::~ItuR1411LosPropagationLossModel ()
 {
 }
 
-  // DEBUGGING
-  int lossCount = 0;
-
 double
 ItuR1411LosPropagationLossModel::GetLoss (Ptr<MobilityModel> a, Ptr<MobilityModel> b) const
 {
   NS_LOG_FUNCTION (this);
-  double dist = a->GetDistanceFrom (b);
+  if (m_statsEnabled)
+    {
+      m_nCalls++;
+    }
+  return GetLoss (PeekPointer (a), PeekPointer (b), GetAntennaPosition (a), GetAntennaPosition (b));
+}
+
+Vector
+ItuR1411LosPropagationLossModel::GetAntennaPosition (Ptr<MobilityModel> m) const
+{
+  Vector pos = m->GetPosition ();
+  if (pos.z <= 0)
+    {
+      pos.z = m_defaultAntennaHeight;
+    }
+  return pos;
+}
+
+double
+ItuR1411LosPropagationLossModel::GetLoss (const MobilityModel *pa, const MobilityModel *pb,
+                                          const Vector &aPos, const Vector &bPos) const
+{
+  if (m_cache.empty ())
+    {
+      return CalcLoss (pa, pb, aPos, bPos);
+    }
+
+  size_t h = reinterpret_cast<size_t> (pa) * 2654435761u ^ (reinterpret_cast<size_t> (pb) >> 4);
+  CacheSlot &slot = m_cache[h % m_cache.size ()];
+  if (slot.m_a == pa && slot.m_b == pb
+      && IsSamePosition (aPos, slot.m_aPos) && IsSamePosition (bPos, slot.m_bPos))
+    {
+      m_cacheHits++;
+      return slot.m_loss;
+    }
+
+  m_cacheMisses++;
+  slot.m_a = pa;
+  slot.m_b = pb;
+  slot.m_aPos = aPos;
+  slot.m_bPos = bPos;
+  slot.m_loss = CalcLoss (pa, pb, aPos, bPos);
+  return slot.m_loss;
+}
+
+double
+ItuR1411LosPropagationLossModel::GetMaxRange (double txPowerDbm, double rxSensitivityDbm) const
+{
+  double lbp = std::fabs (20 * std::log10 ((m_lambda * m_lambda)
+                                           / (8 * M_PI * m_defaultAntennaHeight * m_defaultAntennaHeight)));
+  double rbp = (4 * m_defaultAntennaHeight * m_defaultAntennaHeight) / m_lambda;
+  return CalcMaxRange (lbp, rbp, txPowerDbm - rxSensitivityDbm);
+}
+
+double
+ItuR1411LosPropagationLossModel::CalcMaxRange (double lbp, double rbp, double maxLoss)
+{
+  // the line-of-sight loss is continuous and increasing: it averages
+  // to lbp + 10 + 22.5 log10 (d / rbp) below the breakpoint and to
+  // lbp + 10 + 40 log10 (d / rbp) above it.  Obstacles only add loss.
+  double excess = maxLoss - lbp - 10;
+  double range = rbp * std::pow (10.0, excess / (excess <= 0 ? 22.5 : 40.0));
+  // margin against rounding, so that the range is conservative
+  return range * (1 + 1e-6);
+}
+
+bool
+ItuR1411LosPropagationLossModel::IsSamePosition (const Vector &p1, const Vector &p2) const
+{
+  if (m_cacheQuantization > 0)
+    {
+      return std::floor (p1.x / m_cacheQuantization) == std::floor (p2.x / m_cacheQuantization)
+             && std::floor (p1.y / m_cacheQuantization) == std::floor (p2.y / m_cacheQuantization)
+             && std::floor (p1.z / m_cacheQuantization) == std::floor (p2.z / m_cacheQuantization);
+    }
+  return std::fabs (p1.x - p2.x) <= m_cacheEpsilon
+         && std::fabs (p1.y - p2.y) <= m_cacheEpsilon
+         && std::fabs (p1.z - p2.z) <= m_cacheEpsilon;
+}
+
+void
+ItuR1411LosPropagationLossModel::UpdateBreakpoint (double ha, double hb) const
+{
+  NS_ASSERT_MSG (ha > 0 && hb > 0, "nodes' height must be greater than 0");
+  m_bpHa = ha;
+  m_bpHb = hb;
+  m_lbp = std::fabs (20 * std::log10 ((m_lambda * m_lambda) / (8 * M_PI * ha * hb)));
+  m_rbp = (4 * ha * hb) / m_lambda;
+  m_cullTxPower = std::numeric_limits<double>::quiet_NaN ();
+  NS_LOG_LOGIC (this << " Lbp " << m_lbp << " Rbp " << m_rbp << " lambda " << m_lambda);
+}
+
+double
+ItuR1411LosPropagationLossModel::CalcLoss (const MobilityModel *pa, const MobilityModel *pb,
+                                           const Vector &aPos, const Vector &bPos) const
+{
+  double loss = CalcLosLoss (aPos, bPos);
+  return loss + GetObstacleLoss (pa, pb, aPos, bPos, loss);
+}
+
+double
+ItuR1411LosPropagationLossModel::CalcLosLoss (const Vector &aPos, const Vector &bPos) const
+{
+  // the breakpoint only depends on the antenna heights, which are
+  // almost always the same for every pair
+  if (aPos.z != m_bpHa || bPos.z != m_bpHb)
+    {
+      UpdateBreakpoint (aPos.z, bPos.z);
+    }
+
+  double dx = aPos.x - bPos.x;
+  double dy = aPos.y - bPos.y;
+  double dz = aPos.z - bPos.z;
+  return BreakpointLoss (std::sqrt (dx * dx + dy * dy + dz * dz));
+}
+
+double
+ItuR1411LosPropagationLossModel::BreakpointLoss (double dist) const
+{
+  double logRatio = std::log10 (dist / m_rbp);
   double lossLow = 0.0;
   double lossUp = 0.0;
-
-  if(a->GetPosition ().z <= 0)
+  if (dist <= m_rbp)
     {
-      Vector aPos (a->GetPosition ().x, a->GetPosition ().y, 1.5);
-      a->SetPosition (aPos);
+      lossLow = m_lbp + 20 * logRatio;
+      lossUp = m_lbp + 20 + 25 * logRatio;
     }
-  if(b->GetPosition ().z <= 0)
+  else
     {
-      Vector bPos (b->GetPosition ().x, b->GetPosition ().y, 1.5);
-      b->SetPosition (bPos);
+      if (m_statsEnabled)
+        {
+          m_nBeyondBreakpoint++;
+        }
+      lossLow = m_lbp + 40 * logRatio;
+      lossUp = m_lbp + 20 + 40 * logRatio;
     }
 
-  NS_ASSERT_MSG (a->GetPosition ().z > 0 && b->GetPosition ().z > 0, "nodes' height must be greater than 0");
-  double Lbp = std::fabs (20 * std::log10 ((m_lambda * m_lambda) / (8 * M_PI * a->GetPosition ().z * b->GetPosition ().z)));
-  double Rbp = (4 * a->GetPosition ().z * b->GetPosition ().z) / m_lambda;
-  NS_LOG_LOGIC (this << " Lbp " << Lbp << " Rbp " << Rbp << " lambda " << m_lambda);
-  if (dist <= Rbp)
+  return (lossUp + lossLow) / 2;
+}
+
+double
+ItuR1411LosPropagationLossModel::CalcObstacleLoss (const Vector &aPos, const Vector &bPos,
+                                                   double loss) const
+{
+  NS_PROFILE_SCOPE ("ItuR1411Los::CalcObstacleLoss");
+  double L_obs = 0.0;
+  if (m_obstacleIndex != 0)
     {
-      lossLow = Lbp + 20 * std::log10 (dist / Rbp);
-      lossUp = Lbp + 20 + 25 * std::log10 (dist / Rbp);
+      // walls and depth of each building crossed
+      m_obstacleIndex->GetObstaclesBetween (aPos, bPos, m_obstacleHits);
+      for (std::vector<ObstacleIndex::Hit>::const_iterator i = m_obstacleHits.begin ();
+           i != m_obstacleHits.end (); ++i)
+        {
+          L_obs += m_obstacleWallLoss * i->m_walls + m_obstacleDepthLoss * i->m_insideLength;
+        }
     }
   else
     {
-      lossLow = Lbp + 40 * std::log10 (dist / Rbp);
-      lossUp = Lbp + 20 + 40 * std::log10 (dist / Rbp);
+      Topology * topology = Topology::GetTopology();
+      NS_ASSERT(topology != 0);
+
+      if (topology->HasObstacles() == true)
+        {
+          // additional loss for ostacles
+          Point p1(aPos.x, aPos.y);
+          Point p2(bPos.x, bPos.y);
+          double r = 200.0;
+
+          L_obs = topology->GetObstructedLossBetween(p1, p2, r);
+        }
+    }
+
+  if (L_obs > 0)
+    {
+      NS_LOG_LOGIC (this << " loss " << loss << " will add " << L_obs
+                         << " = " << L_obs / loss * 100.0 << "%");
+      if (m_statsEnabled)
+        {
+          m_nObstructed++;
+          uint32_t bin = std::min ((uint32_t) (L_obs / ITUR1411_OBSTACLE_BIN_WIDTH),
+                                   (uint32_t) ITUR1411_OBSTACLE_BINS - 1);
+          m_obstacleLossHistogram[bin]++;
+        }
+      m_obstacleLossTrace (loss, L_obs);
+      return L_obs;
     }
 
-  double loss = (lossUp + lossLow) / 2;
+  return 0.0;
+}
 
-  Topology * topology = Topology::GetTopology();
-  NS_ASSERT(topology != 0);
+double
+ItuR1411LosPropagationLossModel::GetObstacleLoss (const MobilityModel *pa, const MobilityModel *pb,
+                                                  const Vector &aPos, const Vector &bPos,
+                                                  double loss) const
+{
+  if (m_linkCache.empty () || m_obstacleIndex == 0)
+    {
+      return CalcObstacleLoss (aPos, bPos, loss);
+    }
 
-  if (topology->HasObstacles() == true)
+  // obstruction is symmetric: one slot for both directions
+  const Vector *pA = &aPos;
+  const Vector *pB = &bPos;
+  if (pb < pa)
+    {
+      std::swap (pa, pb);
+      std::swap (pA, pB);
+    }
+  size_t h = reinterpret_cast<size_t> (pa) * 2654435761u ^ (reinterpret_cast<size_t> (pb) >> 4);
+  LinkSlot &slot = m_linkCache[h % m_linkCache.size ()];
+  if (slot.m_a == pa && slot.m_b == pb)
+    {
+      // no point of the link has moved further than its ends
+      double ax = pA->x - slot.m_aPos.x;
+      double ay = pA->y - slot.m_aPos.y;
+      double bx = pB->x - slot.m_bPos.x;
+      double by = pB->y - slot.m_bPos.y;
+      if (std::max (ax * ax + ay * ay, bx * bx + by * by) < slot.m_validitySq)
+        {
+          m_linkCacheHits++;
+          return 0.0;
+        }
+    }
+
+  m_linkCacheMisses++;
+  double obstacleLoss = CalcObstacleLoss (aPos, bPos, loss);
+  if (obstacleLoss == 0.0)
+    {
+      // an obstructed link is not cached: its loss depends on the
+      // exact path through the buildings
+      double validity = m_obstacleIndex->GetClearance (*pA, *pB, m_linkCacheMaxValidity);
+      if (validity > 0.0)
+        {
+          slot.m_a = pa;
+          slot.m_b = pb;
+          slot.m_aPos = *pA;
+          slot.m_bPos = *pB;
+          slot.m_validitySq = validity * validity;
+        }
+    }
+  return obstacleLoss;
+}
+
+void
+ItuR1411LosPropagationLossModel::CalcRxPowers (double txPowerDbm, Vector txPos,
+                                               const std::vector<Vector> &rxPos,
+                                               std::vector<double> &rxPowerDbm,
+                                               double sensitivityDbm) const
+{
+  NS_LOG_FUNCTION (this << txPowerDbm << rxPos.size () << sensitivityDbm);
+  uint32_t n = rxPos.size ();
+  rxPowerDbm.resize (n);
+  if (m_statsEnabled)
+    {
+      m_nCalls += n;
+    }
+  if (txPos.z <= 0)
     {
-      // additional loss for ostacles
-      double p1_x = a->GetPosition ().x;
-      double p1_y = a->GetPosition ().y;
-      double p2_x = b->GetPosition ().x;
-      double p2_y = b->GetPosition ().y;
-      Point p1(p1_x, p1_y);
-      Point p2(p2_x, p2_y);
-      double r = 200.0;
+      txPos.z = m_defaultAntennaHeight;
+    }
 
-      double L_obs = topology->GetObstructedLossBetween(p1, p2, r);
-      if (L_obs > 0)
+  // line-of-sight pass: with every receiver at the same height, as is
+  // the case in practice, the breakpoint is fixed and the loop body is
+  // free of branches and stores other than the result
+  bool sameHeight = true;
+  double rxHeight = rxPos.empty () ? m_defaultAntennaHeight : rxPos[0].z;
+  for (uint32_t i = 0; i < n && sameHeight; i++)
+    {
+      sameHeight = (rxPos[i].z == rxHeight);
+    }
+  if (sameHeight)
+    {
+      if (rxHeight <= 0)
+        {
+          rxHeight = m_defaultAntennaHeight;
+        }
+      if (txPos.z != m_bpHa || rxHeight != m_bpHb)
+        {
+          UpdateBreakpoint (txPos.z, rxHeight);
+        }
+      double dz = txPos.z - rxHeight;
+      double lbp = m_lbp;
+      double invRbp = 1.0 / m_rbp;
+      double rbpSq = m_rbp * m_rbp;
+      for (uint32_t i = 0; i < n; i++)
+        {
+          double dx = txPos.x - rxPos[i].x;
+          double dy = txPos.y - rxPos[i].y;
+          double distSq = dx * dx + dy * dy + dz * dz;
+          // BreakpointLoss averages to lbp + 10 + slope * log10 (d / rbp),
+          // the slope being 22.5 below the breakpoint and 40 beyond it;
+          // the slope is selected, not branched on
+          double slope = (distSq > rbpSq) ? 40.0 : 22.5;
+          rxPowerDbm[i] = txPowerDbm - (lbp + 10 + slope * std::log10 (std::sqrt (distSq) * invRbp));
+        }
+      if (m_statsEnabled)
         {
-          lossCount++;
-          if ((lossCount % 1000) == 0)
+          // the loss exceeds lbp + 10 exactly beyond the breakpoint
+          double bpPower = txPowerDbm - lbp - 10;
+          uint64_t nBeyond = 0;
+          for (uint32_t i = 0; i < n; i++)
             {
-              double lossPct = L_obs / loss * 100.0;
-              NS_LOG_UNCOND ("Loss " << loss << " will add " << L_obs << " = " << lossPct << "%");
+              nBeyond += (rxPowerDbm[i] < bpPower);
             }
-          loss += L_obs;
+          m_nBeyondBreakpoint += nBeyond;
+        }
+    }
+  else
+    {
+      for (uint32_t i = 0; i < n; i++)
+        {
+          Vector pos = rxPos[i];
+          if (pos.z <= 0)
+            {
+              pos.z = m_defaultAntennaHeight;
+            }
+          rxPowerDbm[i] = txPowerDbm - CalcLosLoss (txPos, pos);
         }
     }
 
-  return loss;
+  // obstacles only add loss, so receivers already below the
+  // sensitivity cannot come back above it
+  for (uint32_t i = 0; i < n; i++)
+    {
+      if (rxPowerDbm[i] >= sensitivityDbm)
+        {
+          Vector pos = rxPos[i];
+          if (pos.z <= 0)
+            {
+              pos.z = m_defaultAntennaHeight;
+            }
+          rxPowerDbm[i] -= CalcObstacleLoss (txPos, pos, txPowerDbm - rxPowerDbm[i]);
+        }
+    }
 }
 
 
@@ -136,6 +554,119 @@ ItuR1411LosPropagationLossModel::SetFrequency (double freq)
 {
   NS_ASSERT (freq > 0.0);
   m_lambda = 299792458.0 / freq;
+  UpdateBreakpoint (m_defaultAntennaHeight, m_defaultAntennaHeight);
+  ClearCache ();
+  m_deliveryTable.clear ();
+}
+
+void
+ItuR1411LosPropagationLossModel::SetDefaultAntennaHeight (double height)
+{
+  NS_ASSERT (height > 0.0);
+  m_defaultAntennaHeight = height;
+  if (m_bpHa != 0.0)
+    {
+      UpdateBreakpoint (height, height);
+    }
+  ClearCache ();
+  m_deliveryTable.clear ();
+}
+
+void
+ItuR1411LosPropagationLossModel::SetRxSensitivity (double sensitivityDbm)
+{
+  m_rxSensitivity = sensitivityDbm;
+  m_cullTxPower = std::numeric_limits<double>::quiet_NaN ();
+  // which links the table delivers depends on the sensitivity
+  m_deliveryTable.clear ();
+}
+
+void
+ItuR1411LosPropagationLossModel::SetCcaThreshold (double thresholdDbm)
+{
+  m_ccaThreshold = thresholdDbm;
+  m_cullTxPower = std::numeric_limits<double>::quiet_NaN ();
+}
+
+void
+ItuR1411LosPropagationLossModel::SetCacheSize (uint32_t size)
+{
+  m_cache.resize (size);
+  ClearCache ();
+}
+
+uint32_t
+ItuR1411LosPropagationLossModel::GetCacheSize (void) const
+{
+  return m_cache.size ();
+}
+
+void
+ItuR1411LosPropagationLossModel::ClearCache (void)
+{
+  for (std::vector<CacheSlot>::iterator i = m_cache.begin (); i != m_cache.end (); ++i)
+    {
+      i->m_a = 0;
+      i->m_b = 0;
+    }
+}
+
+void
+ItuR1411LosPropagationLossModel::SetLinkCacheSize (uint32_t size)
+{
+  m_linkCache.resize (size);
+  ClearLinkCache ();
+}
+
+uint32_t
+ItuR1411LosPropagationLossModel::GetLinkCacheSize (void) const
+{
+  return m_linkCache.size ();
+}
+
+void
+ItuR1411LosPropagationLossModel::ClearLinkCache (void)
+{
+  for (std::vector<LinkSlot>::iterator i = m_linkCache.begin (); i != m_linkCache.end (); ++i)
+    {
+      i->m_a = 0;
+      i->m_b = 0;
+    }
+}
+
+void
+ItuR1411LosPropagationLossModel::SetObstacleIndex (const ObstacleIndex *index)
+{
+  NS_LOG_FUNCTION (this << index);
+  m_obstacleIndex = index;
+  // the cached losses and the delivery table hold the old obstacles
+  ClearCache ();
+  ClearLinkCache ();
+  m_deliveryTable.clear ();
+}
+
+uint64_t
+ItuR1411LosPropagationLossModel::GetCacheHits (void) const
+{
+  return m_cacheHits;
+}
+
+uint64_t
+ItuR1411LosPropagationLossModel::GetCacheMisses (void) const
+{
+  return m_cacheMisses;
+}
+
+uint64_t
+ItuR1411LosPropagationLossModel::GetLinkCacheHits (void) const
+{
+  return m_linkCacheHits;
+}
+
+uint64_t
+ItuR1411LosPropagationLossModel::GetLinkCacheMisses (void) const
+{
+  return m_linkCacheMisses;
 }
 
 
@@ -144,12 +675,204 @@ ItuR1411LosPropagationLossModel::DoCalcRxPower (double txPowerDbm,
 						Ptr<MobilityModel> a,
 						Ptr<MobilityModel> b) const
 {
-  return (txPowerDbm - GetLoss (a, b));
+  NS_PROFILE_SCOPE ("ItuR1411Los::DoCalcRxPower");
+  if (m_statsEnabled)
+    {
+      m_nCalls++;
+    }
+  Vector aPos = GetAntennaPosition (a);
+  Vector bPos = GetAntennaPosition (b);
+  if (aPos.z != m_bpHa || bPos.z != m_bpHb)
+    {
+      UpdateBreakpoint (aPos.z, bPos.z);
+    }
+  if (!(txPowerDbm == m_cullTxPower))
+    {
+      // the receivers beyond must neither decode nor sense the signal
+      double range = CalcMaxRange (m_lbp, m_rbp, txPowerDbm - std::min (m_rxSensitivity, m_ccaThreshold));
+      m_cullTxPower = txPowerDbm;
+      m_cullRangeSq = range * range;
+    }
+
+  double dx = aPos.x - bPos.x;
+  double dy = aPos.y - bPos.y;
+  double dz = aPos.z - bPos.z;
+  double distSq = dx * dx + dy * dy + dz * dz;
+  if (distSq > m_cullRangeSq)
+    {
+      // cannot be received nor sensed, with or without the obstacles:
+      // skip the cache and the obstacles
+      return txPowerDbm - BreakpointLoss (std::sqrt (distSq));
+    }
+  if (m_hybridCoreRadius > 0)
+    {
+      if (m_rxSensitivity <= ITUR1411_NO_SENSITIVITY)
+        {
+          // every calibration link would count as delivered
+          NS_FATAL_ERROR ("HybridCoreRadius requires RxSensitivity to be set");
+        }
+      if (distSq > m_hybridCoreRadius * m_hybridCoreRadius)
+        {
+          return txPowerDbm - GetBandLoss (aPos, bPos, std::sqrt (distSq), txPowerDbm);
+        }
+      m_nCoreLinks++;
+    }
+  return (txPowerDbm - GetLoss (PeekPointer (a), PeekPointer (b), aPos, bPos));
+}
+
+uint64_t
+ItuR1411LosPropagationLossModel::GetNCalls (void) const
+{
+  return m_nCalls;
+}
+
+uint64_t
+ItuR1411LosPropagationLossModel::GetNObstructed (void) const
+{
+  return m_nObstructed;
+}
+
+uint64_t
+ItuR1411LosPropagationLossModel::GetNBeyondBreakpoint (void) const
+{
+  return m_nBeyondBreakpoint;
+}
+
+const std::vector<uint64_t> &
+ItuR1411LosPropagationLossModel::GetObstacleLossHistogram (void) const
+{
+  return m_obstacleLossHistogram;
+}
+
+void
+ItuR1411LosPropagationLossModel::ResetStatistics (void)
+{
+  m_nCalls = 0;
+  m_nObstructed = 0;
+  m_nBeyondBreakpoint = 0;
+  m_obstacleLossHistogram.assign (ITUR1411_OBSTACLE_BINS, 0);
+}
+
+void
+ItuR1411LosPropagationLossModel::PrintStatistics (std::ostream &os) const
+{
+  os << "ItuR1411Los calls " << m_nCalls
+     << " obstructed " << m_nObstructed
+     << " beyond-breakpoint " << m_nBeyondBreakpoint
+     << " cache-hits " << m_cacheHits
+     << " cache-misses " << m_cacheMisses
+     << " link-cache-hits " << m_linkCacheHits
+     << " link-cache-misses " << m_linkCacheMisses << std::endl;
+  for (uint32_t i = 0; i < m_obstacleLossHistogram.size (); i++)
+    {
+      if (m_obstacleLossHistogram[i] > 0)
+        {
+          os << "ItuR1411Los obstacle-loss " << i * ITUR1411_OBSTACLE_BIN_WIDTH << " dB "
+             << m_obstacleLossHistogram[i] << std::endl;
+        }
+    }
+  if (m_hybridCoreRadius > 0)
+    {
+      os << "ItuR1411Los hybrid core " << m_nCoreLinks
+         << " calibration " << m_nCalibrationLinks
+         << " abstracted " << m_nAbstractedLinks
+         << " abstracted-delivered " << m_nAbstractedDelivered
+         << " validation " << m_nValidationLinks
+         << " validation-full-delivered " << m_nValidationFull
+         << " validation-table-delivered " << m_nValidationTable
+         << " delivery-drift " << GetDeliveryDrift () << std::endl;
+    }
+}
+
+double
+ItuR1411LosPropagationLossModel::GetBandLoss (const Vector &aPos, const Vector &bPos,
+                                              double dist, double txPowerDbm) const
+{
+  NS_PROFILE_SCOPE ("ItuR1411Los::GetBandLoss");
+  if (!(txPowerDbm == m_deliveryTxPower))
+    {
+      // which links reach the sensitivity depends on the power
+      m_deliveryTable.clear ();
+      m_deliveryTxPower = txPowerDbm;
+    }
+  uint32_t bin = (uint32_t) (dist / m_hybridBinWidth);
+  if (bin >= m_deliveryTable.size ())
+    {
+      DeliveryBin empty = { 0, 0, 0.0, 0.0 };
+      m_deliveryTable.resize (bin + 1, empty);
+    }
+  DeliveryBin &entry = m_deliveryTable[bin];
+  double loss = CalcLosLoss (aPos, bPos);
+  double maxLoss = txPowerDbm - m_rxSensitivity;
+
+  if (entry.m_nLinks < m_hybridCalibrationLinks)
+    {
+      m_nCalibrationLinks++;
+      double obstacleLoss = CalcObstacleLoss (aPos, bPos, loss);
+      entry.m_nLinks++;
+      if (loss + obstacleLoss <= maxLoss)
+        {
+          entry.m_nDelivered++;
+          entry.m_deliveredLoss += obstacleLoss;
+        }
+      else
+        {
+          entry.m_droppedLoss += obstacleLoss;
+        }
+      return loss + obstacleLoss;
+    }
+
+  m_nAbstractedLinks++;
+  bool delivered = m_deliveryRandom->GetValue () * entry.m_nLinks < entry.m_nDelivered;
+  if (m_hybridValidationInterval > 0 && m_nAbstractedLinks % m_hybridValidationInterval == 0)
+    {
+      m_nValidationLinks++;
+      m_nValidationTable += delivered;
+      m_nValidationFull += (loss + CalcObstacleLoss (aPos, bPos, loss) <= maxLoss);
+    }
+  if (delivered)
+    {
+      m_nAbstractedDelivered++;
+      return std::min (loss + entry.m_deliveredLoss / entry.m_nDelivered, maxLoss);
+    }
+  // a dropped link the PHY would still sense would defer its neighbours
+  // more than the full model, whose dropped links are mostly far weaker
+  double minLoss = std::max (maxLoss, txPowerDbm - m_ccaThreshold) + ITUR1411_HYBRID_DROP_MARGIN;
+  return std::max (loss + entry.m_droppedLoss / (entry.m_nLinks - entry.m_nDelivered), minLoss);
+}
+
+uint64_t
+ItuR1411LosPropagationLossModel::GetNCoreLinks (void) const
+{
+  return m_nCoreLinks;
+}
+
+uint64_t
+ItuR1411LosPropagationLossModel::GetNCalibrationLinks (void) const
+{
+  return m_nCalibrationLinks;
+}
+
+uint64_t
+ItuR1411LosPropagationLossModel::GetNAbstractedLinks (void) const
+{
+  return m_nAbstractedLinks;
+}
+
+double
+ItuR1411LosPropagationLossModel::GetDeliveryDrift (void) const
+{
+  if (m_nValidationLinks == 0)
+    {
+      return 0.0;
+    }
+  return ((double) m_nValidationTable - (double) m_nValidationFull) / m_nValidationLinks;
 }
 
 int64_t
 ItuR1411LosPropagationLossModel::DoAssignStreams (int64_t stream)
 {
-  return 0;
+  m_deliveryRandom->SetStream (stream);
+  return 1;
 }
 } // namespace ns3
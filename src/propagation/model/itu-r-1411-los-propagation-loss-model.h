@@ -24,10 +24,15 @@
 #define ITU_R_1411_LOS_PROPAGATION_LOSS_MODEL_H
 
 #include "ns3/propagation-loss-model.h"
+#include "ns3/vector.h"
+#include "ns3/traced-callback.h"
+#include "ns3/random-variable-stream.h"
+#include "ns3/obstacle-index.h"
+#include <vector>
+#include <ostream>
 
 namespace ns3 {
 
-
 /**
  * \ingroup propagation
  *
@@ -38,6 +43,56 @@ namespace ns3 {
  * frequency range 300 MHz to 100 GHz.  
  * For more information about the model, please see
  * the propagation module documentation in .rst format.
+ *
+ * The obstacle loss comes from the buildings of the ObstacleIndex given
+ * to SetObstacleIndex: each building the link crosses adds
+ * ObstacleWallLoss per wall and ObstacleDepthLoss per metre of the link
+ * inside it.  Without an index, it comes from the vanet Topology.
+ *
+ * Optionally, the loss of each ordered pair of mobility models can be
+ * cached in a fixed number of direct-mapped slots (attribute
+ * CacheSize).  A cached loss is reused as long as both nodes stay
+ * within CacheEpsilon of the positions it was computed for or, if
+ * CacheQuantization is set, in the same grid cells of that size.
+ *
+ * The link cache (attribute LinkCacheSize) remembers, per unordered
+ * pair, the links found unobstructed together with a validity radius:
+ * the distance from the link to the nearest building, bounded by
+ * LinkCacheMaxValidity.  Until one of the two nodes has moved that far
+ * the obstacle loss is known to be zero and is not evaluated again.
+ * The radius comes from the same ObstacleIndex as the obstacle loss,
+ * without which nothing is cached.
+ *
+ * If RxSensitivity is set, DoCalcRxPower returns the line-of-sight
+ * power, without looking up the cache or the obstacles, for the
+ * receivers beyond the range at which neither that sensitivity nor
+ * CcaThreshold can be reached.  The obstacles only lower that power, so
+ * that these receivers neither decode nor sense the signal with the
+ * full model either; the only approximation left is the interference
+ * they add up, from signals each below CcaThreshold, which the line of
+ * sight overestimates.
+ *
+ * If HybridCoreRadius is set as well, DoCalcRxPower only evaluates the
+ * obstacles for the receivers within that radius; without RxSensitivity
+ * it aborts, since every link would then count as delivered.  For the
+ * band beyond it, a delivery table per HybridBinWidth distance bin holds
+ * the fraction of links that the full model puts above RxSensitivity,
+ * and the mean obstacle loss of the links above and below it.  The
+ * table is cleared whenever the sensitivity, the frequency, the antenna
+ * height, the transmission power or the obstacles change.  The table is
+ * built from the first HybridCalibrationLinks links of each bin, which
+ * use the full model.  After that, each link of the bin draws whether it
+ * is delivered, and the matching mean loss is added to its
+ * line-of-sight loss.  Links the table drops arrive below both
+ * RxSensitivity and CcaThreshold, so that they neither get decoded
+ * nor hold the medium busy.  Every HybridValidationInterval-th drawn
+ * link is also evaluated with the full model, to measure how far the
+ * delivery ratio of the band drifts from it.
+ *
+ * The table only replaces the evaluation of the obstacles: the PHY path
+ * is not bypassed.  Every link, delivered or dropped, still reaches its
+ * receiver through the channel, and the PHY processes it from its power
+ * as for any other frame.
  */
 class ItuR1411LosPropagationLossModel : public PropagationLossModel
 {
@@ -57,6 +112,14 @@ public:
    */
   void SetFrequency (double freq);
 
+  /**
+   * Set the antenna height used for the nodes whose position has
+   * z <= 0.  Their mobility model is left untouched.
+   *
+   * \param height the height in m
+   */
+  void SetDefaultAntennaHeight (double height);
+
   /** 
    * 
    * 
@@ -68,8 +131,189 @@ public:
    */
   double GetLoss (Ptr<MobilityModel> a, Ptr<MobilityModel> b) const;
 
+  /**
+   * Compute in one pass the power received from one transmitter by
+   * many receivers, as a broadcast to all the nodes of a channel needs.
+   * The pairwise loss cache is not used.  With all the receivers at the
+   * same height, the line-of-sight losses are computed in a loop free
+   * of branches and per receiver bookkeeping, which compilers can
+   * vectorize when vector versions of sqrt and log10 are available
+   * (e.g. GCC with glibc's libmvec and -ffast-math).  The obstacle
+   * losses are then evaluated one receiver at a time; the
+   * micro-benchmarks of vanet-routing-compare compare the whole call
+   * with one CalcRxPower per receiver.
+   *
+   * The obstacle loss is only added for the receivers whose
+   * line-of-sight power is at least sensitivityDbm; the others are
+   * left with their line-of-sight power, which is an upper bound.
+   *
+   * \param txPowerDbm the transmission power in dBm
+   * \param txPos the position of the transmitter
+   * \param rxPos the positions of the receivers
+   * \param rxPowerDbm resized to rxPos and set to the received powers in dBm
+   * \param sensitivityDbm receivers below this power can be skipped
+   */
+  void CalcRxPowers (double txPowerDbm, Vector txPos,
+                     const std::vector<Vector> &rxPos,
+                     std::vector<double> &rxPowerDbm,
+                     double sensitivityDbm = -1000.0) const;
+
+  /**
+   * Conservative bound on the distance at which a signal can still be
+   * received with the default antenna height: beyond it the
+   * line-of-sight loss alone, before any obstacle, exceeds
+   * txPowerDbm - rxSensitivityDbm.
+   *
+   * \param txPowerDbm the transmission power in dBm
+   * \param rxSensitivityDbm the lowest power a receiver can decode in dBm
+   * \return the range in m
+   */
+  double GetMaxRange (double txPowerDbm, double rxSensitivityDbm) const;
+
+  /**
+   * Set the buildings the obstacle loss, and the validity radius of the
+   * link cache, are derived from.
+   *
+   * \param index the built obstacle index, which must outlive this
+   *        model, or 0 to take the obstacle loss from the Topology again
+   *        and stop caching links
+   */
+  void SetObstacleIndex (const ObstacleIndex *index);
+
+  /**
+   * \return the number of GetLoss calls answered from the cache
+   */
+  uint64_t GetCacheHits (void) const;
+
+  /**
+   * \return the number of GetLoss calls that had to compute the loss
+   * while the cache was enabled
+   */
+  uint64_t GetCacheMisses (void) const;
+
+  /**
+   * \return the number of obstacle losses skipped thanks to the link cache
+   */
+  uint64_t GetLinkCacheHits (void) const;
+
+  /**
+   * \return the number of obstacle losses evaluated while the link
+   * cache was enabled
+   */
+  uint64_t GetLinkCacheMisses (void) const;
+
+  /**
+   * \return the number of links inside HybridCoreRadius, evaluated with
+   * the full model
+   */
+  uint64_t GetNCoreLinks (void) const;
+
+  /**
+   * \return the number of links beyond HybridCoreRadius evaluated with
+   * the full model to build the delivery table
+   */
+  uint64_t GetNCalibrationLinks (void) const;
+
+  /**
+   * \return the number of links beyond HybridCoreRadius whose delivery
+   * was drawn from the delivery table
+   */
+  uint64_t GetNAbstractedLinks (void) const;
+
+  /**
+   * \return the delivery ratio the table gave the validation links
+   * minus the one the full model gave them, 0 without validation links
+   */
+  double GetDeliveryDrift (void) const;
+
+  /**
+   * The counters below are only maintained while the EnableStatistics
+   * attribute is true.
+   *
+   * \return the number of losses requested, including cached ones
+   */
+  uint64_t GetNCalls (void) const;
+
+  /**
+   * \return the number of computed losses an obstacle was added to
+   */
+  uint64_t GetNObstructed (void) const;
+
+  /**
+   * \return the number of computed losses beyond the breakpoint distance
+   */
+  uint64_t GetNBeyondBreakpoint (void) const;
+
+  /**
+   * \return the number of obstructed links per 2 dB bin of added
+   * obstacle loss, the last bin also counting all larger losses
+   */
+  const std::vector<uint64_t> &GetObstacleLossHistogram (void) const;
+
+  /**
+   * Reset the counters and the histogram
+   */
+  void ResetStatistics (void);
+
+  /**
+   * Print the counters, the cache counters and the non-empty bins of
+   * the obstacle loss histogram, one line each
+   *
+   * \param os the output stream
+   */
+  void PrintStatistics (std::ostream &os) const;
+
 private:
 
+  struct CacheSlot
+  {
+    const MobilityModel *m_a; // 0 if the slot is empty
+    const MobilityModel *m_b;
+    Vector m_aPos;
+    Vector m_bPos;
+    double m_loss;
+  };
+
+  struct LinkSlot
+  {
+    const MobilityModel *m_a; // 0 if the slot is empty; m_a < m_b
+    const MobilityModel *m_b;
+    Vector m_aPos;
+    Vector m_bPos;
+    double m_validitySq; // squared displacement below which the link stays clear
+  };
+
+  struct DeliveryBin
+  {
+    uint32_t m_nLinks;      // calibration links
+    uint32_t m_nDelivered;  // calibration links above the sensitivity
+    double m_deliveredLoss; // sum of their obstacle losses
+    double m_droppedLoss;   // sum of the obstacle losses of the others
+  };
+
+  Vector GetAntennaPosition (Ptr<MobilityModel> m) const;
+  double GetLoss (const MobilityModel *pa, const MobilityModel *pb,
+                  const Vector &aPos, const Vector &bPos) const;
+  static double CalcMaxRange (double lbp, double rbp, double maxLoss);
+  void SetRxSensitivity (double sensitivityDbm);
+  void SetCcaThreshold (double thresholdDbm);
+  double CalcLoss (const MobilityModel *pa, const MobilityModel *pb,
+                   const Vector &aPos, const Vector &bPos) const;
+  double CalcLosLoss (const Vector &aPos, const Vector &bPos) const;
+  double BreakpointLoss (double dist) const;
+  double CalcObstacleLoss (const Vector &aPos, const Vector &bPos, double loss) const;
+  double GetObstacleLoss (const MobilityModel *pa, const MobilityModel *pb,
+                          const Vector &aPos, const Vector &bPos, double loss) const;
+  void UpdateBreakpoint (double ha, double hb) const;
+  bool IsSamePosition (const Vector &p1, const Vector &p2) const;
+  void SetCacheSize (uint32_t size);
+  uint32_t GetCacheSize (void) const;
+  void ClearCache (void);
+  void SetLinkCacheSize (uint32_t size);
+  uint32_t GetLinkCacheSize (void) const;
+  void ClearLinkCache (void);
+  double GetBandLoss (const Vector &aPos, const Vector &bPos, double dist, double txPowerDbm) const;
+
   // inherited from PropagationLossModel
   virtual double DoCalcRxPower (double txPowerDbm,
                                 Ptr<MobilityModel> a,
@@ -77,6 +321,58 @@ private:
   virtual int64_t DoAssignStreams (int64_t stream);
   
   double m_lambda; // wavelength
+  double m_defaultAntennaHeight;
+
+  // breakpoint loss and distance for the last pair of antenna heights
+  mutable double m_bpHa;
+  mutable double m_bpHb;
+  mutable double m_lbp;
+  mutable double m_rbp;
+
+  // squared range beyond which neither m_rxSensitivity nor
+  // m_ccaThreshold can be reached at m_cullTxPower, for the heights of
+  // the breakpoint above
+  double m_rxSensitivity;
+  double m_ccaThreshold;
+  mutable double m_cullTxPower;
+  mutable double m_cullRangeSq;
+
+  mutable std::vector<CacheSlot> m_cache;
+  double m_cacheQuantization;
+  double m_cacheEpsilon;
+  mutable uint64_t m_cacheHits;
+  mutable uint64_t m_cacheMisses;
+
+  mutable std::vector<LinkSlot> m_linkCache;
+  double m_linkCacheMaxValidity;
+  const ObstacleIndex *m_obstacleIndex;
+  double m_obstacleWallLoss;  // dB per wall crossed
+  double m_obstacleDepthLoss; // dB per m inside a building
+  mutable std::vector<ObstacleIndex::Hit> m_obstacleHits;
+  mutable uint64_t m_linkCacheHits;
+  mutable uint64_t m_linkCacheMisses;
+
+  double m_hybridCoreRadius; // 0 for the full model everywhere
+  double m_hybridBinWidth;
+  uint32_t m_hybridCalibrationLinks;
+  uint32_t m_hybridValidationInterval; // 0 to validate nothing
+  mutable std::vector<DeliveryBin> m_deliveryTable;
+  mutable double m_deliveryTxPower; // the table holds for this power only
+  Ptr<UniformRandomVariable> m_deliveryRandom;
+  mutable uint64_t m_nCoreLinks;
+  mutable uint64_t m_nCalibrationLinks;
+  mutable uint64_t m_nAbstractedLinks;
+  mutable uint64_t m_nAbstractedDelivered;
+  mutable uint64_t m_nValidationLinks;
+  mutable uint64_t m_nValidationFull;  // validation links the full model delivered
+  mutable uint64_t m_nValidationTable; // validation links the table delivered
+
+  bool m_statsEnabled;
+  mutable uint64_t m_nCalls;
+  mutable uint64_t m_nObstructed;
+  mutable uint64_t m_nBeyondBreakpoint;
+  mutable std::vector<uint64_t> m_obstacleLossHistogram;
+  TracedCallback<double, double> m_obstacleLossTrace;
 };
 
 } // namespace ns3
@@ -0,0 +1,485 @@
+/* -*-  Mode: C++; c-file-style: "gnu"; indent-tabs-mode:nil; -*- */
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation;
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+#include "ns3/log.h"
+#include "ns3/assert.h"
+#include <algorithm>
+#include <limits>
+#include <cmath>
+
+#include "obstacle-index.h"
+
+NS_LOG_COMPONENT_DEFINE ("ObstacleIndex");
+
+namespace ns3 {
+
+static double
+PointSegmentDistanceSq (double px, double py, double ax, double ay, double bx, double by)
+{
+  double dx = bx - ax;
+  double dy = by - ay;
+  double lengthSq = dx * dx + dy * dy;
+  double t = 0.0;
+  if (lengthSq > 0.0)
+    {
+      t = std::max (0.0, std::min (1.0, ((px - ax) * dx + (py - ay) * dy) / lengthSq));
+    }
+  double ex = ax + t * dx - px;
+  double ey = ay + t * dy - py;
+  return ex * ex + ey * ey;
+}
+
+// Upper bound on the number of grid cells; the cell size is increased
+// if needed to stay below it
+#define OBSTACLE_INDEX_MAX_CELLS (1 << 22)
+
+ObstacleIndex::ObstacleIndex ()
+  : m_stamp (0),
+    m_cellSize (1.0),
+    m_minX (0.0),
+    m_minY (0.0),
+    m_nx (0),
+    m_ny (0)
+{
+}
+
+uint32_t
+ObstacleIndex::AddObstacle (const std::vector<Vector> &vertices)
+{
+  NS_ASSERT_MSG (vertices.size () >= 3, "an obstacle needs at least 3 vertices");
+  Obstacle obstacle;
+  obstacle.m_firstVertex = m_vx.size ();
+  obstacle.m_nVertices = vertices.size ();
+  obstacle.m_minX = obstacle.m_maxX = vertices[0].x;
+  obstacle.m_minY = obstacle.m_maxY = vertices[0].y;
+  for (std::vector<Vector>::const_iterator i = vertices.begin (); i != vertices.end (); ++i)
+    {
+      m_vx.push_back (i->x);
+      m_vy.push_back (i->y);
+      obstacle.m_minX = std::min (obstacle.m_minX, i->x);
+      obstacle.m_minY = std::min (obstacle.m_minY, i->y);
+      obstacle.m_maxX = std::max (obstacle.m_maxX, i->x);
+      obstacle.m_maxY = std::max (obstacle.m_maxY, i->y);
+    }
+  m_obstacles.push_back (obstacle);
+  return m_obstacles.size () - 1;
+}
+
+uint32_t
+ObstacleIndex::GetNObstacles (void) const
+{
+  return m_obstacles.size ();
+}
+
+void
+ObstacleIndex::Build (double cellSize)
+{
+  NS_LOG_FUNCTION (this << cellSize);
+  m_cellStart.clear ();
+  m_cellItems.clear ();
+  m_visited.assign (m_obstacles.size (), 0);
+  m_stamp = 0;
+  if (m_obstacles.empty ())
+    {
+      return;
+    }
+
+  double maxX = m_obstacles[0].m_maxX;
+  double maxY = m_obstacles[0].m_maxY;
+  double extent = 0.0;
+  m_minX = m_obstacles[0].m_minX;
+  m_minY = m_obstacles[0].m_minY;
+  for (std::vector<Obstacle>::const_iterator i = m_obstacles.begin (); i != m_obstacles.end (); ++i)
+    {
+      m_minX = std::min (m_minX, i->m_minX);
+      m_minY = std::min (m_minY, i->m_minY);
+      maxX = std::max (maxX, i->m_maxX);
+      maxY = std::max (maxY, i->m_maxY);
+      extent += std::max (i->m_maxX - i->m_minX, i->m_maxY - i->m_minY);
+    }
+  if (cellSize <= 0.0)
+    {
+      // cells about the size of a building keep both the number of
+      // cells walked and the number of buildings per cell small
+      cellSize = std::max (extent / m_obstacles.size (), 1.0);
+    }
+  double width = std::max (maxX - m_minX, cellSize);
+  double height = std::max (maxY - m_minY, cellSize);
+  while ((width / cellSize + 1) * (height / cellSize + 1) > OBSTACLE_INDEX_MAX_CELLS)
+    {
+      cellSize *= 2;
+    }
+  m_cellSize = cellSize;
+  m_nx = (uint32_t) std::ceil (width / m_cellSize);
+  m_ny = (uint32_t) std::ceil (height / m_cellSize);
+
+  // counting sort of the obstacles into every cell their bounding box overlaps
+  uint32_t nCells = m_nx * m_ny;
+  m_cellStart.assign (nCells + 1, 0);
+  for (int pass = 0; pass < 2; pass++)
+    {
+      std::vector<uint32_t> fill;
+      if (pass == 1)
+        {
+          for (uint32_t c = 0; c < nCells; c++)
+            {
+              m_cellStart[c + 1] += m_cellStart[c];
+            }
+          m_cellItems.resize (m_cellStart[nCells]);
+          fill.assign (m_cellStart.begin (), m_cellStart.end () - 1);
+        }
+      for (uint32_t id = 0; id < m_obstacles.size (); id++)
+        {
+          const Obstacle &o = m_obstacles[id];
+          uint32_t cx0 = std::min ((uint32_t) ((o.m_minX - m_minX) / m_cellSize), m_nx - 1);
+          uint32_t cx1 = std::min ((uint32_t) ((o.m_maxX - m_minX) / m_cellSize), m_nx - 1);
+          uint32_t cy0 = std::min ((uint32_t) ((o.m_minY - m_minY) / m_cellSize), m_ny - 1);
+          uint32_t cy1 = std::min ((uint32_t) ((o.m_maxY - m_minY) / m_cellSize), m_ny - 1);
+          for (uint32_t cy = cy0; cy <= cy1; cy++)
+            {
+              for (uint32_t cx = cx0; cx <= cx1; cx++)
+                {
+                  uint32_t c = cy * m_nx + cx;
+                  if (pass == 0)
+                    {
+                      m_cellStart[c + 1]++;
+                    }
+                  else
+                    {
+                      m_cellItems[fill[c]++] = id;
+                    }
+                }
+            }
+        }
+    }
+  NS_LOG_DEBUG ("Indexed " << m_obstacles.size () << " obstacles in " << m_nx << "x" << m_ny
+                           << " cells of " << m_cellSize << " m");
+}
+
+void
+ObstacleIndex::GetObstaclesBetween (const Vector &p1, const Vector &p2, std::vector<Hit> &hits) const
+{
+  hits.clear ();
+  Walk (p1, p2, &hits);
+}
+
+bool
+ObstacleIndex::IsObstructed (const Vector &p1, const Vector &p2) const
+{
+  return Walk (p1, p2, 0);
+}
+
+double
+ObstacleIndex::GetClearance (const Vector &p1, const Vector &p2, double maxDistance) const
+{
+  if (m_cellStart.empty ())
+    {
+      return maxDistance;
+    }
+  if (++m_stamp == 0)
+    {
+      m_visited.assign (m_obstacles.size (), 0);
+      m_stamp = 1;
+    }
+
+  // every cell within maxDistance of the bounding box of the segment
+  double minX = std::min (p1.x, p2.x);
+  double maxX = std::max (p1.x, p2.x);
+  double minY = std::min (p1.y, p2.y);
+  double maxY = std::max (p1.y, p2.y);
+  double gx0 = std::floor ((minX - maxDistance - m_minX) / m_cellSize);
+  double gx1 = std::floor ((maxX + maxDistance - m_minX) / m_cellSize);
+  double gy0 = std::floor ((minY - maxDistance - m_minY) / m_cellSize);
+  double gy1 = std::floor ((maxY + maxDistance - m_minY) / m_cellSize);
+  if (gx1 < 0 || gy1 < 0 || gx0 >= m_nx || gy0 >= m_ny)
+    {
+      return maxDistance;
+    }
+  uint32_t cx0 = (uint32_t) std::max (gx0, 0.0);
+  uint32_t cx1 = (uint32_t) std::min (gx1, m_nx - 1.0);
+  uint32_t cy0 = (uint32_t) std::max (gy0, 0.0);
+  uint32_t cy1 = (uint32_t) std::min (gy1, m_ny - 1.0);
+
+  double clearance = maxDistance;
+  for (uint32_t cy = cy0; cy <= cy1; cy++)
+    {
+      for (uint32_t cx = cx0; cx <= cx1; cx++)
+        {
+          uint32_t c = cy * m_nx + cx;
+          for (uint32_t k = m_cellStart[c]; k < m_cellStart[c + 1]; k++)
+            {
+              uint32_t id = m_cellItems[k];
+              if (m_visited[id] == m_stamp)
+                {
+                  continue;
+                }
+              m_visited[id] = m_stamp;
+
+              // the gap between the bounding boxes is a lower bound
+              const Obstacle &o = m_obstacles[id];
+              double gapX = std::max (0.0, std::max (o.m_minX - maxX, minX - o.m_maxX));
+              double gapY = std::max (0.0, std::max (o.m_minY - maxY, minY - o.m_maxY));
+              if (gapX * gapX + gapY * gapY >= clearance * clearance)
+                {
+                  continue;
+                }
+              if (TestObstacle (id, p1, p2, 0))
+                {
+                  return 0.0;
+                }
+              clearance = std::min (clearance, GetEdgeDistance (id, p1, p2));
+            }
+        }
+    }
+  return clearance;
+}
+
+double
+ObstacleIndex::GetEdgeDistance (uint32_t id, const Vector &p1, const Vector &p2) const
+{
+  // two segments that do not cross are closest at an end of one of them
+  const Obstacle &o = m_obstacles[id];
+  double distSq = std::numeric_limits<double>::infinity ();
+  for (uint32_t k = 0; k < o.m_nVertices; k++)
+    {
+      uint32_t a = o.m_firstVertex + k;
+      uint32_t b = o.m_firstVertex + (k + 1) % o.m_nVertices;
+      distSq = std::min (distSq, PointSegmentDistanceSq (m_vx[a], m_vy[a], p1.x, p1.y, p2.x, p2.y));
+      distSq = std::min (distSq, PointSegmentDistanceSq (p1.x, p1.y, m_vx[a], m_vy[a], m_vx[b], m_vy[b]));
+      distSq = std::min (distSq, PointSegmentDistanceSq (p2.x, p2.y, m_vx[a], m_vy[a], m_vx[b], m_vy[b]));
+    }
+  return std::sqrt (distSq);
+}
+
+bool
+ObstacleIndex::Walk (const Vector &p1, const Vector &p2, std::vector<Hit> *hits) const
+{
+  if (m_cellStart.empty ())
+    {
+      return false;
+    }
+  if (++m_stamp == 0)
+    {
+      m_visited.assign (m_obstacles.size (), 0);
+      m_stamp = 1;
+    }
+
+  // segment in grid units: g(t) = g1 + t * d, t in [0, 1]
+  double gx1 = (p1.x - m_minX) / m_cellSize;
+  double gy1 = (p1.y - m_minY) / m_cellSize;
+  double dx = (p2.x - m_minX) / m_cellSize - gx1;
+  double dy = (p2.y - m_minY) / m_cellSize - gy1;
+
+  // clip the segment to the grid (Liang-Barsky)
+  double t0 = 0.0;
+  double t1 = 1.0;
+  double p[4] = { -dx, dx, -dy, dy };
+  double q[4] = { gx1, m_nx - gx1, gy1, m_ny - gy1 };
+  for (int k = 0; k < 4; k++)
+    {
+      if (p[k] == 0.0)
+        {
+          if (q[k] < 0.0)
+            {
+              return false;
+            }
+        }
+      else
+        {
+          double r = q[k] / p[k];
+          if (p[k] < 0.0)
+            {
+              t0 = std::max (t0, r);
+            }
+          else
+            {
+              t1 = std::min (t1, r);
+            }
+        }
+    }
+  if (t0 > t1)
+    {
+      return false;
+    }
+
+  // walk the cells crossed by the clipped segment (Amanatides-Woo)
+  const double inf = std::numeric_limits<double>::infinity ();
+  int32_t ix = std::min ((int32_t) std::floor (gx1 + t0 * dx), (int32_t) m_nx - 1);
+  int32_t iy = std::min ((int32_t) std::floor (gy1 + t0 * dy), (int32_t) m_ny - 1);
+  int32_t ex = std::min ((int32_t) std::floor (gx1 + t1 * dx), (int32_t) m_nx - 1);
+  int32_t ey = std::min ((int32_t) std::floor (gy1 + t1 * dy), (int32_t) m_ny - 1);
+  ix = std::max (ix, 0);
+  iy = std::max (iy, 0);
+  ex = std::max (ex, 0);
+  ey = std::max (ey, 0);
+  int32_t stepX = (dx > 0.0) ? 1 : -1;
+  int32_t stepY = (dy > 0.0) ? 1 : -1;
+  double tMaxX = (dx != 0.0) ? ((ix + (stepX > 0 ? 1 : 0)) - gx1) / dx : inf;
+  double tMaxY = (dy != 0.0) ? ((iy + (stepY > 0 ? 1 : 0)) - gy1) / dy : inf;
+  double tDeltaX = (dx != 0.0) ? stepX / dx : inf;
+  double tDeltaY = (dy != 0.0) ? stepY / dy : inf;
+
+  bool hit = false;
+  for (uint32_t steps = 0; steps <= m_nx + m_ny; steps++)
+    {
+      uint32_t c = iy * m_nx + ix;
+      for (uint32_t k = m_cellStart[c]; k < m_cellStart[c + 1]; k++)
+        {
+          uint32_t id = m_cellItems[k];
+          if (m_visited[id] == m_stamp)
+            {
+              continue;
+            }
+          m_visited[id] = m_stamp;
+          if (hits == 0)
+            {
+              if (TestObstacle (id, p1, p2, 0))
+                {
+                  return true;
+                }
+            }
+          else
+            {
+              Hit h;
+              if (TestObstacle (id, p1, p2, &h))
+                {
+                  hits->push_back (h);
+                  hit = true;
+                }
+            }
+        }
+      if (ix == ex && iy == ey)
+        {
+          break;
+        }
+      if (tMaxX < tMaxY)
+        {
+          ix += stepX;
+          tMaxX += tDeltaX;
+        }
+      else
+        {
+          iy += stepY;
+          tMaxY += tDeltaY;
+        }
+      if (ix < 0 || iy < 0 || ix >= (int32_t) m_nx || iy >= (int32_t) m_ny)
+        {
+          break;
+        }
+    }
+  return hit;
+}
+
+bool
+ObstacleIndex::TestObstacle (uint32_t id, const Vector &p1, const Vector &p2, Hit *hit) const
+{
+  const Obstacle &o = m_obstacles[id];
+
+  // bounding box culling
+  if (std::max (p1.x, p2.x) < o.m_minX || std::min (p1.x, p2.x) > o.m_maxX
+      || std::max (p1.y, p2.y) < o.m_minY || std::min (p1.y, p2.y) > o.m_maxY)
+    {
+      return false;
+    }
+
+  // exact edge tests: parameter along the segment of each crossing
+  double rx = p2.x - p1.x;
+  double ry = p2.y - p1.y;
+  m_crossings.clear ();
+  for (uint32_t k = 0; k < o.m_nVertices; k++)
+    {
+      uint32_t a = o.m_firstVertex + k;
+      uint32_t b = o.m_firstVertex + (k + 1) % o.m_nVertices;
+      double sx = m_vx[b] - m_vx[a];
+      double sy = m_vy[b] - m_vy[a];
+      double denom = rx * sy - ry * sx;
+      if (denom == 0.0)
+        {
+          // parallel to the edge: grazing, not crossing
+          continue;
+        }
+      double qx = m_vx[a] - p1.x;
+      double qy = m_vy[a] - p1.y;
+      double t = (qx * sy - qy * sx) / denom;
+      double u = (qx * ry - qy * rx) / denom;
+      // half-open on the edge so that a crossing at a vertex counts once
+      if (t >= 0.0 && t <= 1.0 && u >= 0.0 && u < 1.0)
+        {
+          if (hit == 0)
+            {
+              return true;
+            }
+          m_crossings.push_back (t);
+        }
+    }
+
+  bool inside = IsInside (id, p1.x, p1.y);
+  if (m_crossings.empty () && !inside)
+    {
+      return false;
+    }
+  if (hit == 0)
+    {
+      return true;
+    }
+
+  // length inside: alternate in/out at each crossing
+  std::sort (m_crossings.begin (), m_crossings.end ());
+  double insideT = 0.0;
+  double prev = 0.0;
+  for (std::vector<double>::const_iterator i = m_crossings.begin (); i != m_crossings.end (); ++i)
+    {
+      if (inside)
+        {
+          insideT += *i - prev;
+        }
+      inside = !inside;
+      prev = *i;
+    }
+  if (inside)
+    {
+      insideT += 1.0 - prev;
+    }
+  hit->m_id = id;
+  hit->m_walls = m_crossings.size ();
+  hit->m_insideLength = insideT * std::sqrt (rx * rx + ry * ry);
+  return true;
+}
+
+bool
+ObstacleIndex::IsInside (uint32_t id, double x, double y) const
+{
+  // even-odd rule
+  const Obstacle &o = m_obstacles[id];
+  if (x < o.m_minX || x > o.m_maxX || y < o.m_minY || y > o.m_maxY)
+    {
+      return false;
+    }
+  bool inside = false;
+  for (uint32_t k = 0, j = o.m_nVertices - 1; k < o.m_nVertices; j = k++)
+    {
+      double xk = m_vx[o.m_firstVertex + k];
+      double yk = m_vy[o.m_firstVertex + k];
+      double xj = m_vx[o.m_firstVertex + j];
+      double yj = m_vy[o.m_firstVertex + j];
+      if ((yk > y) != (yj > y) && x < (xj - xk) * (y - yk) / (yj - yk) + xk)
+        {
+          inside = !inside;
+        }
+    }
+  return inside;
+}
+
+} // namespace ns3
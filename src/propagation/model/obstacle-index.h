@@ -0,0 +1,144 @@
+/* -*-  Mode: C++; c-file-style: "gnu"; indent-tabs-mode:nil; -*- */
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation;
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef OBSTACLE_INDEX_H
+#define OBSTACLE_INDEX_H
+
+#include <vector>
+#include <stdint.h>
+#include "ns3/vector.h"
+
+namespace ns3 {
+
+/**
+ * \ingroup propagation
+ *
+ * \brief spatial index over obstacle (building) footprints
+ *
+ * Obstacles are 2D polygons; the z coordinate of their vertices is
+ * ignored.  Once all obstacles are added, Build () bins their bounding
+ * boxes into a uniform grid.  A query for the segment between two
+ * points then walks only the grid cells the segment crosses, discards
+ * obstacles whose bounding box the segment misses, and runs the exact
+ * edge tests on the few obstacles left.
+ *
+ * This is meant to back obstacle stores such as the one queried by
+ * ItuR1411LosPropagationLossModel, whose per-link cost would otherwise
+ * grow with the total number of buildings.
+ */
+class ObstacleIndex
+{
+public:
+  /**
+   * \brief An obstacle crossed by a segment
+   */
+  struct Hit
+  {
+    uint32_t m_id;         ///< obstacle id, as returned by AddObstacle
+    uint32_t m_walls;      ///< number of edges the segment crosses
+    double m_insideLength; ///< length of the segment inside the obstacle, m
+  };
+
+  ObstacleIndex ();
+
+  /**
+   * \param vertices the polygon vertices, in order (at least 3)
+   * \return the id of the obstacle
+   *
+   * Obstacles added after Build () are only visible once Build () is
+   * called again.
+   */
+  uint32_t AddObstacle (const std::vector<Vector> &vertices);
+
+  /**
+   * \param cellSize the grid cell size, m.  When zero, a size is
+   *        derived from the average obstacle extent.
+   */
+  void Build (double cellSize = 0.0);
+
+  /**
+   * \return the number of obstacles
+   */
+  uint32_t GetNObstacles (void) const;
+
+  /**
+   * \param p1 the first end of the segment
+   * \param p2 the second end of the segment
+   * \param hits cleared, then filled with the obstacles the segment
+   *        crosses or lies in
+   */
+  void GetObstaclesBetween (const Vector &p1, const Vector &p2, std::vector<Hit> &hits) const;
+
+  /**
+   * \param p1 the first end of the segment
+   * \param p2 the second end of the segment
+   * \return whether any obstacle is crossed by the segment
+   */
+  bool IsObstructed (const Vector &p1, const Vector &p2) const;
+
+  /**
+   * Distance from the segment to the nearest obstacle, searched up to
+   * maxDistance.  As long as both ends move by less than this distance,
+   * no point of the segment can reach an obstacle, so the segment
+   * stays unobstructed.
+   *
+   * \param p1 the first end of the segment
+   * \param p2 the second end of the segment
+   * \param maxDistance the search radius, m
+   * \return 0 if the segment crosses or lies in an obstacle, else the
+   *         distance to the nearest obstacle edge, at most maxDistance
+   */
+  double GetClearance (const Vector &p1, const Vector &p2, double maxDistance) const;
+
+private:
+  struct Obstacle
+  {
+    uint32_t m_firstVertex; // index in m_vx/m_vy of the first vertex
+    uint32_t m_nVertices;
+    double m_minX;
+    double m_minY;
+    double m_maxX;
+    double m_maxY;
+  };
+
+  // Calls TestObstacle for each distinct obstacle in the cells the
+  // segment crosses.  Hits are appended to hits, or, if hits is 0,
+  // the walk stops at the first hit.  Returns whether anything was hit.
+  bool Walk (const Vector &p1, const Vector &p2, std::vector<Hit> *hits) const;
+  // Exact test of one obstacle; returns whether the segment hits it
+  bool TestObstacle (uint32_t id, const Vector &p1, const Vector &p2, Hit *hit) const;
+  bool IsInside (uint32_t id, double x, double y) const;
+  // Distance from the segment to the edges of an obstacle it does not hit
+  double GetEdgeDistance (uint32_t id, const Vector &p1, const Vector &p2) const;
+
+  std::vector<Obstacle> m_obstacles;
+  std::vector<double> m_vx;           // vertex x coordinates, all obstacles
+  std::vector<double> m_vy;           // vertex y coordinates, all obstacles
+  std::vector<uint32_t> m_cellStart;  // index in m_cellItems of the first obstacle of each cell
+  std::vector<uint32_t> m_cellItems;  // obstacle ids, sorted by cell
+  mutable std::vector<uint32_t> m_visited; // query stamp of each obstacle
+  mutable uint32_t m_stamp;                // current query stamp
+  mutable std::vector<double> m_crossings; // scratch for segment crossings
+  double m_cellSize;
+  double m_minX;
+  double m_minY;
+  uint32_t m_nx;
+  uint32_t m_ny;
+};
+
+} // namespace ns3
+
+#endif // OBSTACLE_INDEX_H